@@ -0,0 +1,44 @@
+<?php
+
+// Destroys many suspended fibers at once, each suspended a few frames deep with a finally block to run.
+//
+// php -d extension=fiber bench/cancel.php [fibers] [depth]
+
+$total = (int) ($argv[1] ?? 100000);
+$depth = (int) ($argv[2] ?? 16);
+
+function nested(int $depth): void
+{
+    try {
+        if ($depth > 0) {
+            nested($depth - 1);
+        } else {
+            Fiber::suspend();
+        }
+    } finally {
+        $GLOBALS['unwound']++;
+    }
+}
+
+$unwound = 0;
+$fibers = [];
+
+for ($i = 0; $i < $total; $i++) {
+    $fiber = new Fiber('nested');
+    $fiber->start($depth);
+
+    $fibers[] = $fiber;
+}
+
+$start = microtime(true);
+
+$fibers = [];
+
+$elapsed = microtime(true) - $start;
+
+printf("%d fibers destroyed in %.3f s (%.2f us per fiber), %d finally blocks run\n",
+    $total,
+    $elapsed,
+    $elapsed * 1000000 / $total,
+    $unwound
+);
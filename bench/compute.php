@@ -0,0 +1,41 @@
+<?php
+
+// Fibers doing arithmetic in hot loops between switches, where the JIT pays off and traces are left by switches.
+//
+// php -d extension=fiber bench/compute.php [fibers] [rounds]
+
+$count = (int) ($argv[1] ?? 100);
+$rounds = (int) ($argv[2] ?? 1000);
+
+function work(int $seed): float
+{
+    $sum = 0.0;
+
+    while (true) {
+        for ($i = 0; $i < 1000; $i++) {
+            $sum += sqrt($i * $seed) / ($i + 1);
+        }
+
+        $seed = Fiber::suspend($sum);
+    }
+}
+
+$fibers = [];
+
+for ($i = 0; $i < $count; $i++) {
+    $fibers[$i] = new Fiber('work');
+    $fibers[$i]->start($i + 1);
+}
+
+$start = hrtime(true);
+$total = 0.0;
+
+for ($round = 0; $round < $rounds; $round++) {
+    foreach ($fibers as $i => $fiber) {
+        $total += $fiber->resume($round + $i);
+    }
+}
+
+$elapsed = hrtime(true) - $start;
+
+printf("compute  %d fibers x %d rounds in %.3f s (checksum %.3f)\n", $count, $rounds, $elapsed / 1e9, $total);
@@ -0,0 +1,45 @@
+<?php
+
+// Creates fibers that stay suspended inside a reference cycle and drops them,
+// memory usage has to stay flat once the cycle collector has run.
+//
+// php -d extension=fiber bench/gc.php [fibers]
+
+$total = (int) ($argv[1] ?? 2000000);
+$report = max(1, intdiv($total, 20));
+
+class Node
+{
+    public $fiber;
+    public $payload;
+}
+
+$start = microtime(true);
+$base = memory_get_usage();
+
+for ($i = 1; $i <= $total; $i++) {
+    $node = new Node();
+    $node->payload = str_repeat('x', 64);
+
+    // The fiber references the node from a suspended frame, the node references the fiber.
+    $node->fiber = new Fiber(function (Node $node) {
+        $local = [$node, $node->payload];
+        Fiber::suspend($local);
+    });
+
+    $node->fiber->start($node);
+
+    unset($node);
+
+    if ($i % $report === 0) {
+        $collected = gc_collect_cycles();
+
+        printf("%9d fibers  %8.2f MB  (+%d bytes)  collected %d  %.2fs\n",
+            $i,
+            memory_get_usage() / 1048576,
+            memory_get_usage() - $base,
+            $collected,
+            microtime(true) - $start
+        );
+    }
+}
@@ -0,0 +1,54 @@
+<?php
+
+// Messages from a forked worker through Fiber\IpcChannel compared to a Unix socket pair with serialize().
+//
+// php -d extension=fiber bench/ipc.php [messages] [bytes]
+
+$total = (int) ($argv[1] ?? 1000000);
+$payload = ['id' => 0, 'data' => str_repeat('x', (int) ($argv[2] ?? 64))];
+
+function run(string $name, int $total, callable $send, callable $receive): void
+{
+    $pid = pcntl_fork();
+
+    if ($pid === 0) {
+        $send();
+        exit(0);
+    }
+
+    $start = hrtime(true);
+
+    for ($i = 0; $i < $total; $i++) {
+        $receive();
+    }
+
+    $elapsed = hrtime(true) - $start;
+
+    pcntl_waitpid($pid, $status);
+
+    printf("%-8s %d messages in %.3f s (%.1f ns per message)\n", $name, $total, $elapsed / 1e9, $elapsed / $total);
+}
+
+$channel = new Fiber\IpcChannel(4 * 1024 * 1024);
+
+run('channel', $total, function () use ($channel, $total, $payload): void {
+    for ($i = 0; $i < $total; $i++) {
+        $payload['id'] = $i;
+        $channel->send(serialize($payload));
+    }
+}, function () use ($channel): void {
+    unserialize($channel->receive());
+});
+
+[$a, $b] = stream_socket_pair(STREAM_PF_UNIX, STREAM_SOCK_STREAM, STREAM_IPPROTO_IP);
+
+run('socket', $total, function () use ($a, $total, $payload): void {
+    for ($i = 0; $i < $total; $i++) {
+        $payload['id'] = $i;
+        $data = serialize($payload);
+        fwrite($a, pack('N', strlen($data)) . $data);
+    }
+}, function () use ($b): void {
+    $length = unpack('N', fread($b, 4))[1];
+    unserialize(fread($b, $length));
+});
@@ -0,0 +1,25 @@
+#!/bin/sh
+
+# Runs the switch and compute benchmarks without JIT, with function JIT and with tracing JIT.
+#
+# PHP=/path/to/php EXTENSION=/path/to/fiber.so sh bench/jit.sh
+
+PHP=${PHP:-php}
+EXTENSION=${EXTENSION:-fiber}
+DIR=$(dirname "$0")
+
+for JIT in off function tracing; do
+    echo "opcache.jit=$JIT"
+
+    for BENCH in switch compute; do
+        "$PHP" -n \
+            -d extension="$EXTENSION" \
+            -d zend_extension=opcache \
+            -d opcache.enable_cli=1 \
+            -d opcache.jit="$JIT" \
+            -d opcache.jit_buffer_size=64M \
+            "$DIR/$BENCH.php"
+    done
+
+    echo
+done
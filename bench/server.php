@@ -0,0 +1,32 @@
+<?php
+
+// Minimal HTTP server with one Fiber\Server per forked worker on a shared SO_REUSEPORT port, drive it with a local
+// load generator, e.g.:
+//
+// php -d extension=fiber bench/server.php [workers] [port] [max_connections]
+// wrk -t 4 -c 256 -d 10s http://127.0.0.1:8080/
+
+$workers = (int) ($argv[1] ?? 4);
+$port = (int) ($argv[2] ?? 8080);
+$max = (int) ($argv[3] ?? 0);
+
+$response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 13\r\n\r\nHello, World!";
+
+$handler = function ($connection) use ($response): void {
+    while (($request = fread($connection, 8192)) !== false && $request !== '') {
+        fwrite($connection, $response);
+    }
+};
+
+for ($i = 0; $i < $workers; $i++) {
+    if (pcntl_fork() === 0) {
+        $server = Fiber\Server::listen('127.0.0.1:' . $port, $handler, ['max_connections' => $max]);
+
+        Fiber\Poller::run();
+        exit(0);
+    }
+}
+
+printf("%d workers listening on 127.0.0.1:%d\n", $workers, $port);
+
+while (pcntl_wait($status) > 0);
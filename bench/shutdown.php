@@ -0,0 +1,25 @@
+<?php
+
+// Leaves suspended fibers behind at request end, compare the logged shutdown time of both policies:
+//
+// php -d extension=fiber -d fiber.shutdown_report=1 -d fiber.shutdown_policy=unwind bench/shutdown.php
+// php -d extension=fiber -d fiber.shutdown_report=1 -d fiber.shutdown_policy=release bench/shutdown.php
+
+$total = (int) ($argv[1] ?? 20000);
+$fibers = [];
+
+for ($i = 0; $i < $total; $i++) {
+    $fiber = new Fiber(function () {
+        try {
+            Fiber::suspend();
+        } finally {
+            $cleanup = true;
+        }
+    });
+
+    $fiber->start();
+
+    $fibers[] = $fiber;
+}
+
+printf("%d fibers suspended, %.2f MB\n", count($fibers), memory_get_usage() / 1048576);
@@ -0,0 +1,27 @@
+<?php
+
+// Round trips between the main thread and a fiber, run through bench/jit.sh for JIT on / off numbers.
+//
+// php -d extension=fiber bench/switch.php [switches]
+
+$total = (int) ($argv[1] ?? 5000000);
+
+$fiber = new Fiber(function (): void {
+    $value = 0;
+
+    while (true) {
+        $value = Fiber::suspend($value + 1);
+    }
+});
+
+$value = $fiber->start();
+
+$start = hrtime(true);
+
+for ($i = 0; $i < $total; $i++) {
+    $value = $fiber->resume($value);
+}
+
+$elapsed = hrtime(true) - $start;
+
+printf("switch   %d round trips in %.3f s (%.1f ns per round trip)\n", $total, $elapsed / 1e9, $elapsed / $total);
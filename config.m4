@@ -1,6 +1,12 @@
 PHP_ARG_ENABLE(fiber, whether to enable fiber support,
 [  --enable-fiber          Enable fiber fiber support], no)
 
+PHP_ARG_WITH(fiber-uring, whether to use io_uring in fiber,
+[  --without-fiber-uring   Disable io_uring support (liburing) in fiber], yes, no)
+
+PHP_ARG_ENABLE(fiber-dtrace, whether to enable fiber static probes,
+[  --enable-fiber-dtrace   Enable SystemTap / DTrace static probes (sys/sdt.h) in fiber], no, no)
+
 if test "$PHP_FIBER" != "no"; then
   AC_DEFINE(HAVE_FIBER, 1, [ ])
   
@@ -8,11 +14,57 @@ if test "$PHP_FIBER" != "no"; then
 
   fiber_source_files="src/php_fiber.c \
     src/fiber.c \
-    src/fiber_stack.c"
+    src/fiber_blocking.c \
+    src/fiber_group.c \
+    src/fiber_interrupt.c \
+    src/fiber_ipc.c \
+    src/fiber_local.c \
+    src/fiber_observer.c \
+    src/fiber_offload.c \
+    src/fiber_perf.c \
+    src/fiber_poll.c \
+    src/fiber_process.c \
+    src/fiber_profiler.c \
+    src/fiber_registry.c \
+    src/fiber_server.c \
+    src/fiber_stack.c \
+    src/fiber_stats.c \
+    src/fiber_stream.c \
+    src/fiber_thread_pool.c \
+    src/fiber_uring.c \
+    src/fiber_watchdog.c"
   
   fiber_use_asm="yes"
   fiber_user_ucontext="no"
   
+  AC_CHECK_HEADERS([sys/epoll.h sys/eventfd.h sys/signalfd.h linux/perf_event.h])
+
+  PHP_ADD_LIBRARY(pthread,, FIBER_SHARED_LIBADD)
+
+  AC_CHECK_HEADER(zlib.h, [
+    PHP_CHECK_LIBRARY(z, deflateBound, [
+      AC_DEFINE(HAVE_FIBER_ZLIB, 1, [Whether zlib is available for offloaded compression])
+      PHP_ADD_LIBRARY(z,, FIBER_SHARED_LIBADD)
+    ])
+  ])
+
+  if test "$PHP_FIBER_URING" != "no"; then
+    AC_CHECK_HEADER(liburing.h, [
+      PHP_CHECK_LIBRARY(uring, io_uring_get_probe_ring, [
+        AC_DEFINE(HAVE_FIBER_URING, 1, [Whether io_uring is available])
+        PHP_ADD_LIBRARY(uring,, FIBER_SHARED_LIBADD)
+      ])
+    ])
+  fi
+
+  if test "$PHP_FIBER_DTRACE" != "no"; then
+    AC_CHECK_HEADER(sys/sdt.h, [
+      AC_DEFINE(HAVE_FIBER_DTRACE, 1, [Whether fiber static probes are enabled])
+    ], [
+      AC_MSG_ERROR([sys/sdt.h is required for --enable-fiber-dtrace, install systemtap-sdt-dev(el)])
+    ])
+  fi
+
   AC_CHECK_HEADER(ucontext.h, [
     fiber_use_ucontext="yes"
   ])
@@ -72,6 +124,8 @@ if test "$PHP_FIBER" != "no"; then
   
   PHP_NEW_EXTENSION(fiber, $fiber_source_files, $ext_shared,, \\$(FIBER_CFLAGS))
   PHP_SUBST(FIBER_CFLAGS)
+  PHP_SUBST(FIBER_SHARED_LIBADD)
+  PHP_ADD_EXTENSION_DEP(fiber, hash)
   PHP_ADD_MAKEFILE_FRAGMENT
   
   PHP_INSTALL_HEADERS([ext/fiber], [config.h include/*.h])
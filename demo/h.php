@@ -0,0 +1,20 @@
+<?php
+
+// Children spawned by a group are resumed by joinAll() until all of them have finished.
+
+$group = new Fiber\Group;
+$results = [];
+
+foreach ([3, 1, 2] as $steps) {
+    $group->spawn(function (int $steps) use (&$results): void {
+        for ($i = 0; $i < $steps; ++$i) {
+            Fiber::suspend();
+        }
+
+        $results[] = $steps;
+    }, $steps);
+}
+
+$group->joinAll();
+
+var_dump($results);
@@ -0,0 +1,15 @@
+<?php
+
+// Iterating a fiber yields the values passed to Fiber::suspend(), even from within nested calls.
+
+$f = new Fiber(function (array $values): array {
+    return array_map(function (int $value): int {
+        return Fiber::suspend($value * 2) ?? $value;
+    }, $values);
+});
+
+foreach ($f as $key => $value) {
+    var_dump($key, $value);
+}
+
+var_dump($f->getStatus(), $f->getReturn());
@@ -0,0 +1,25 @@
+<?php
+
+// Iterating a fiber that parks on the native poller, foreach runs the poller until the fiber suspends a value.
+
+$paths = [__FILE__, __DIR__, __DIR__ . '/i.php'];
+
+$f = new Fiber(function () use ($paths): int {
+    $total = 0;
+
+    foreach ($paths as $path) {
+        // Parks the fiber until a worker thread has completed the stat() call.
+        $stat = Fiber\Blocking::run('stat', $path);
+        $total += $stat['size'];
+
+        Fiber::suspend([basename($path), $stat['size']]);
+    }
+
+    return $total;
+});
+
+foreach ($f as $key => [$name, $size]) {
+    var_dump($key, $name, $size);
+}
+
+var_dump($f->getStatus(), $f->getReturn());
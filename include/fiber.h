@@ -16,6 +16,14 @@
 
 #include "php.h"
 
+#ifdef PHP_WIN32
+# define PHP_FIBER_API __declspec(dllexport)
+#elif defined(__GNUC__) && __GNUC__ >= 4
+# define PHP_FIBER_API __attribute__ ((visibility("default")))
+#else
+# define PHP_FIBER_API
+#endif
+
 BEGIN_EXTERN_C()
 
 void zend_fiber_ce_register();
@@ -23,8 +31,30 @@ void zend_fiber_ce_unregister();
 
 void zend_fiber_shutdown();
 
+#define ZEND_FIBER_PERF_COUNTERS 4
+
+/* Max number of extensions observing fibers, each observer owns one slot in every fiber. */
+#define ZEND_FIBER_MAX_OBSERVERS 8
+
+/* Number of Fiber\Local values stored inline in every fiber, more are kept in a separate table. */
+#define ZEND_FIBER_LOCAL_SLOTS 4
+
 typedef void* zend_fiber_context;
 typedef struct _zend_fiber zend_fiber;
+typedef struct _zend_fiber_group zend_fiber_group;
+typedef struct _zend_fiber_server zend_fiber_server;
+
+/* Drops the native registration (poller, thread pool, io_uring) of a parked fiber that will never be woken. */
+typedef void (* zend_fiber_unpark_func)(zend_fiber *fiber, void *data);
+
+typedef struct _zend_fiber_locals {
+	/* Values of Fiber\Local indexes below ZEND_FIBER_LOCAL_SLOTS, UNDEF if not set. */
+	zval slots[ZEND_FIBER_LOCAL_SLOTS];
+
+	/* Values of the remaining indexes, allocated on first use. */
+	zval *overflow;
+	uint32_t overflow_size;
+} zend_fiber_locals;
 
 struct _zend_fiber {
 	/* Fiber PHP object handle. */
@@ -33,6 +63,13 @@ struct _zend_fiber {
 	/* Status of the fiber, one of the ZEND_FIBER_STATUS_* constants. */
 	zend_uchar status;
 
+	/* Combination of ZEND_FIBER_FLAG_* bits. */
+	uint32_t flags;
+
+	/* Set while the fiber is parked, invoked if the fiber is freed or the request ends before it has been woken. */
+	zend_fiber_unpark_func unpark;
+	void *unpark_data;
+
 	/* Callback and info / cache to be used when fiber is started. */
 	zend_fcall_info fci;
 	zend_fcall_info_cache fci_cache;
@@ -54,6 +91,52 @@ struct _zend_fiber {
 
 	/* Max size of the C stack being used by the fiber. */
 	size_t stack_size;
+
+	/* Group that spawned the fiber, NULL if the fiber is not owned by a group. */
+	zend_fiber_group *group;
+
+	/* Server that accepted the connection handled by the fiber, NULL otherwise. */
+	zend_fiber_server *server;
+
+	/* Links in the list of started, unfinished fibers (FIBER_G(fibers)). */
+	zend_fiber *registry_prev;
+	zend_fiber *registry_next;
+
+	/* Monotonic time (ns) the fiber was last switched to and run time of the current slice (fiber.slow_slice_ms). */
+	uint64_t slice_start;
+	uint64_t slice_time;
+
+	/* Where the fiber has been created (nearest user frame), NULL if created without user code. */
+	zend_string *created_file;
+	uint32_t created_line;
+
+	/* Runtime counters in zend_fiber_ticks() units, see Fiber::getStats(). */
+	uint64_t created_at;
+	uint64_t first_run_at;
+	uint64_t switched_at;
+	uint64_t run_ticks;
+	uint64_t suspended_ticks;
+	uint64_t resumes;
+
+	/* Net change of Zend MM usage while the fiber was running and its soft budget (0 if none), see Fiber::getStats(). */
+	int64_t memory;
+	size_t memory_budget;
+
+	/* Hardware counters charged to the fiber (fiber.perf_counters), see Fiber::getPerfCounters(). */
+	uint64_t perf[ZEND_FIBER_PERF_COUNTERS];
+
+	/* Fiber-local values (Fiber\Local), released once the fiber has finished. */
+	zend_fiber_locals locals;
+
+	/* Per-extension data of observers, indexed by the handle returned from zend_fiber_observer_register(). */
+	void *observer_slots[ZEND_FIBER_MAX_OBSERVERS];
+
+	/* Unwind marker thrown into the fiber when it has been destroyed, held until the fiber has finished. */
+	zend_object *unwind;
+
+	/* Table of zvals handed to the cycle collector by get_gc, grown as needed. */
+	zval *gc_buffer;
+	uint32_t gc_buffer_size;
 };
 
 static const zend_uchar ZEND_FIBER_STATUS_INIT = 0;
@@ -62,8 +145,78 @@ static const zend_uchar ZEND_FIBER_STATUS_RUNNING = 2;
 static const zend_uchar ZEND_FIBER_STATUS_FINISHED = 3;
 static const zend_uchar ZEND_FIBER_STATUS_DEAD = 4;
 
+/* Fiber is suspended until a native event (I/O readiness, thread pool job) resumes it. */
+static const uint32_t ZEND_FIBER_FLAG_PARKED = (1 << 0);
+
+/* Socket streams park the fiber instead of blocking (overrides fiber.async_streams). */
+static const uint32_t ZEND_FIBER_FLAG_ASYNC_STREAMS = (1 << 1);
+
+/* Socket streams block as usual (overrides fiber.async_streams). */
+static const uint32_t ZEND_FIBER_FLAG_SYNC_STREAMS = (1 << 2);
+
+/* Fiber is never suspended when its time slice is used up. */
+static const uint32_t ZEND_FIBER_FLAG_NO_PREEMPT = (1 << 3);
+
+/* Fiber has been suspended by the time slice interrupt instead of calling Fiber::suspend(). */
+static const uint32_t ZEND_FIBER_FLAG_PREEMPTED = (1 << 4);
+
+/* Fiber has exceeded its soft memory budget, the warning is raised only once. */
+static const uint32_t ZEND_FIBER_FLAG_OVER_BUDGET = (1 << 5);
+
+/* Fiber has been parked when the process forked, the event it waits for belongs to the parent (stays parked). */
+static const uint32_t ZEND_FIBER_FLAG_ORPHANED = (1 << 6);
+
+/* Suspended fibers are unwound at request end, finally blocks and destructors run. */
+static const zend_long ZEND_FIBER_SHUTDOWN_UNWIND = 0;
+
+/* Suspended fibers (except parked ones) are released at request end without running any more of their code, values of
+ * their frames are destroyed (destructors run) and their VM stacks are freed. */
+static const zend_long ZEND_FIBER_SHUTDOWN_RELEASE = 1;
+
 typedef void (* zend_fiber_func)();
 
+/* Callbacks of an extension keeping per-fiber state, any of them may be NULL. The fiber passed to the switch
+ * callbacks is NULL for the main thread, slot points to the slot of the observer in the fiber (or main thread). */
+typedef struct _zend_fiber_observer {
+	/* Fiber object has been created, it has not been started yet. */
+	void (* create)(zend_fiber *fiber, void **slot);
+
+	/* Called on every switch, first for the fiber being left, then for the one being entered. */
+	void (* switch_out)(zend_fiber *fiber, void **slot);
+	void (* switch_in)(zend_fiber *fiber, void **slot);
+
+	/* Fiber object is about to be freed, data held in the slot has to be released. */
+	void (* destroy)(zend_fiber *fiber, void **slot);
+} zend_fiber_observer;
+
+extern zend_class_entry *zend_ce_fiber;
+extern zend_class_entry *zend_ce_fiber_error;
+
+void zend_fiber_init(zend_fiber *fiber, zend_fcall_info *fci, zend_fcall_info_cache *fci_cache);
+zend_bool zend_fiber_switch_to(zend_fiber *fiber);
+
+/* Checks for the internal frame running the fiber callable, which is the bottom frame of every fiber. */
+zend_bool zend_fiber_is_run_func(const zend_function *func);
+
+zend_bool zend_fiber_do_start(zend_fiber *fiber, zval *params, uint32_t param_count);
+zend_bool zend_fiber_do_resume(zend_fiber *fiber, zval *value);
+void zend_fiber_do_suspend(zend_fiber *fiber, zval *value, zval *return_value);
+
+#if PHP_VERSION_ID >= 80000
+/* Called by the VM interrupt hook while destroyed fibers unwind, throws the marker again if a catch block took it. */
+void zend_fiber_unwind_interrupt(zend_execute_data *execute_data);
+#endif
+void zend_fiber_do_cancel(zend_fiber *fiber);
+
+/* Finishes all suspended fibers according to fiber.shutdown_policy, called once objects are destructed at request end. */
+void zend_fiber_shutdown_fibers();
+
+/* Registers an observer, must be called during MINIT. Returns the handle of its slot or -1 if all slots are taken. */
+PHP_FIBER_API int zend_fiber_observer_register(const zend_fiber_observer *observer);
+
+/* Returns the slot of the observer in the running fiber, or in the main thread. */
+PHP_FIBER_API void **zend_fiber_observer_slot(int handle);
+
 char *zend_fiber_backend_info();
 
 zend_fiber_context zend_fiber_create_root_context();
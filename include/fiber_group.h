@@ -0,0 +1,52 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_GROUP_H
+#define FIBER_GROUP_H
+
+#include "fiber.h"
+
+BEGIN_EXTERN_C()
+
+struct _zend_fiber_group {
+	/* Fiber group PHP object handle. */
+	zend_object std;
+
+	/* Fibers spawned by the group that have not finished yet, keyed by object handle. */
+	HashTable children;
+
+	/* Number of children that have not finished yet. */
+	uint32_t pending;
+
+	/* Fiber suspended in joinAll(), NULL if nobody is waiting. */
+	zend_fiber *waiter;
+
+	/* Child being resumed by joinAll() outside of a fiber, its error is not seen by any other resumer. */
+	zend_fiber *resuming;
+
+	/* First error thrown by a child, UNDEF until a child fails. */
+	zval error;
+};
+
+void zend_fiber_group_ce_register();
+
+void zend_fiber_group_child_done(zend_fiber *fiber);
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
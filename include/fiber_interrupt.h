@@ -0,0 +1,62 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_INTERRUPT_H
+#define FIBER_INTERRUPT_H
+
+#include "fiber.h"
+
+#ifndef PHP_WIN32
+/* Helper threads raising VM interrupts (time slices, sampling profiler) are available. */
+#define ZEND_FIBER_TICKER 1
+#endif
+
+BEGIN_EXTERN_C()
+
+typedef struct _zend_fiber_ticker zend_fiber_ticker;
+
+#if PHP_VERSION_ID >= 80200
+typedef zend_atomic_bool zend_fiber_vm_interrupt;
+#else
+typedef volatile zend_bool zend_fiber_vm_interrupt;
+#endif
+
+/* Pending work for the VM interrupt hook, set from the ticker thread. */
+#define ZEND_FIBER_INTERRUPT_PREEMPT (1 << 0)
+#define ZEND_FIBER_INTERRUPT_SAMPLE (1 << 1)
+
+/* Set while destroyed fibers unwind, see zend_fiber_unwind_interrupt(). */
+#define ZEND_FIBER_INTERRUPT_UNWIND (1 << 2)
+
+/* Chains the fiber hook into zend_interrupt_function. */
+void zend_fiber_interrupt_startup();
+void zend_fiber_interrupt_shutdown();
+
+/* Starts the ticker thread of the current PHP thread if time slicing is enabled. */
+void zend_fiber_ticker_start();
+void zend_fiber_ticker_stop();
+
+/* Forgets the ticker inherited by a forked child. */
+void zend_fiber_ticker_fork();
+
+/* Sets bits of ZEND_FIBER_INTERRUPT_* and raises EG(vm_interrupt), safe to call from any thread. */
+void zend_fiber_interrupt_raise(uint32_t *pending, zend_fiber_vm_interrupt *vm_interrupt, uint32_t bits);
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,33 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_IPC_H
+#define FIBER_IPC_H
+
+#include "fiber.h"
+
+BEGIN_EXTERN_C()
+
+/* Default size of the shared ring of a Fiber\IpcChannel. */
+#define ZEND_FIBER_IPC_CAPACITY (1024 * 1024)
+
+void zend_fiber_ipc_ce_register();
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
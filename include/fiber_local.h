@@ -0,0 +1,36 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_LOCAL_H
+#define FIBER_LOCAL_H
+
+#include "fiber.h"
+
+BEGIN_EXTERN_C()
+
+void zend_fiber_local_ce_register();
+
+/* Releases all values, the locals can be used again afterwards. */
+void zend_fiber_locals_destroy(zend_fiber_locals *locals);
+
+/* Frees the table of released indexes. */
+void zend_fiber_local_gshutdown();
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
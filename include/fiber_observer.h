@@ -0,0 +1,37 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_OBSERVER_H
+#define FIBER_OBSERVER_H
+
+#include "fiber.h"
+
+BEGIN_EXTERN_C()
+
+/* Number of registered observers, notifications are skipped entirely while it is 0. */
+extern uint32_t zend_fiber_observer_count;
+
+void zend_fiber_observer_create(zend_fiber *fiber);
+void zend_fiber_observer_destroy(zend_fiber *fiber);
+
+/* Called when switching from one fiber to another one, NULL stands for the main thread. */
+void zend_fiber_observer_switch(zend_fiber *from, zend_fiber *to);
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,45 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_PERF_H
+#define FIBER_PERF_H
+
+#include "fiber.h"
+
+#if defined(__linux__) && defined(HAVE_LINUX_PERF_EVENT_H)
+#define ZEND_FIBER_PERF 1
+#endif
+
+BEGIN_EXTERN_C()
+
+typedef struct _zend_fiber_perf zend_fiber_perf;
+
+/* Charges the counter deltas since the previous call to the given fiber (NULL for main thread). */
+void zend_fiber_perf_charge(zend_fiber *fiber);
+
+/* Fills return_value with the counters of the fiber, NULL if hardware counters are not available. */
+void zend_fiber_perf_get(zend_fiber *fiber, zval *return_value);
+
+void zend_fiber_perf_shutdown();
+
+/* Closes the counters inherited by a forked child, they are opened again on first use. */
+void zend_fiber_perf_fork();
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
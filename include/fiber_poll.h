@@ -0,0 +1,102 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_POLL_H
+#define FIBER_POLL_H
+
+#include "fiber.h"
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_EVENTFD_H)
+#define ZEND_FIBER_POLL 1
+
+#include <sys/epoll.h>
+#endif
+
+#define ZEND_FIBER_POLL_BATCH 64
+
+BEGIN_EXTERN_C()
+
+typedef struct _zend_fiber_poll_waiter zend_fiber_poll_waiter;
+
+struct _zend_fiber_poll_waiter {
+	/* File descriptor being watched. */
+	int fd;
+
+	/* Requested events and events reported by the kernel. */
+	uint32_t events;
+	uint32_t revents;
+
+	/* Fiber parked on the descriptor, NULL when awaited from main thread. */
+	zend_fiber *fiber;
+
+	/* Invoked for persistent registrations instead of resuming a fiber. */
+	void (* handler)(zend_fiber_poll_waiter *waiter);
+
+	/* Monotonic deadline (in nanoseconds) of a timed wait, 0 if not in the timer list. */
+	uint64_t deadline;
+	zend_fiber_poll_waiter *timer_prev;
+	zend_fiber_poll_waiter *timer_next;
+
+	/* Set if the wait ended because the deadline passed. */
+	zend_bool expired;
+};
+
+void zend_fiber_poll_ce_register();
+void zend_fiber_poll_shutdown();
+
+/* Called in a forked child, a new poller is created on use and fibers parked in the parent are orphaned. */
+void zend_fiber_poll_fork();
+
+uint32_t zend_fiber_poll_await(int fd, uint32_t events);
+
+/* Like zend_fiber_poll_await() but gives up after timeout milliseconds (-1 for none), returns 0 without an error then. */
+uint32_t zend_fiber_poll_await_timeout(int fd, uint32_t events, zend_long timeout);
+int zend_fiber_poll_dispatch(int timeout);
+
+zend_bool zend_fiber_poll_add_handler(zend_fiber_poll_waiter *waiter);
+void zend_fiber_poll_remove_handler(zend_fiber_poll_waiter *waiter);
+
+void zend_fiber_poll_ref();
+void zend_fiber_poll_unref();
+
+void zend_fiber_poll_wake(zend_fiber *fiber);
+void zend_fiber_poll_defer(zend_fiber *fiber);
+
+/* Drops the registration of a parked fiber, used when it is freed without having been unwound (fatal error, exit). */
+void zend_fiber_poll_abandon(zend_fiber *fiber);
+
+/* Abandons all parked fibers, registrations must not outlive the stacks and objects of the request. */
+void zend_fiber_poll_abandon_all();
+
+static zend_always_inline void zend_fiber_park(zend_fiber *fiber, zend_fiber_unpark_func unpark, void *data)
+{
+	fiber->flags |= ZEND_FIBER_FLAG_PARKED;
+	fiber->unpark = unpark;
+	fiber->unpark_data = data;
+}
+
+static zend_always_inline void zend_fiber_unpark(zend_fiber *fiber)
+{
+	fiber->flags &= ~ZEND_FIBER_FLAG_PARKED;
+	fiber->unpark = NULL;
+	fiber->unpark_data = NULL;
+}
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,45 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_PROBES_H
+#define FIBER_PROBES_H
+
+/*
+ * Static probes of provider "fiber" (--enable-fiber-dtrace), e.g. bpftrace -e 'usdt:fiber.so:fiber:switch__entry'.
+ *
+ * Fiber probes receive the object handle of the fiber, its C stack size and status:
+ *   start, switch__entry, switch__exit, suspend, finish, dead, destroy
+ *
+ * Stack probes receive the stack address and its size:
+ *   stack__allocate, stack__free
+ */
+
+#ifdef HAVE_FIBER_DTRACE
+#include <sys/sdt.h>
+
+#define ZEND_FIBER_PROBE(probe, f) \
+	DTRACE_PROBE3(fiber, probe, (uint32_t) (f)->std.handle, (size_t) (f)->stack_size, (int) (f)->status)
+
+#define ZEND_FIBER_PROBE_STACK(probe, pointer, size) \
+	DTRACE_PROBE2(fiber, probe, (void *) (pointer), (size_t) (size))
+#else
+#define ZEND_FIBER_PROBE(probe, f)
+#define ZEND_FIBER_PROBE_STACK(probe, pointer, size)
+#endif
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
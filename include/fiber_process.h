@@ -0,0 +1,35 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_PROCESS_H
+#define FIBER_PROCESS_H
+
+#include "fiber.h"
+
+BEGIN_EXTERN_C()
+
+typedef struct _zend_fiber_signal_state zend_fiber_signal_state;
+
+void zend_fiber_process_ce_register();
+
+/* Closes the signalfd and unblocks all signals taken over by it. */
+void zend_fiber_signal_shutdown();
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,41 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_PROFILER_H
+#define FIBER_PROFILER_H
+
+#include "fiber.h"
+
+BEGIN_EXTERN_C()
+
+typedef struct _zend_fiber_profiler zend_fiber_profiler;
+
+void zend_fiber_profiler_ce_register();
+
+/* Records the stack of the running fiber, called by the VM interrupt hook. */
+void zend_fiber_profiler_sample(zend_execute_data *execute_data);
+
+/* Stops the sampler thread and discards samples not fetched yet. */
+void zend_fiber_profiler_shutdown();
+
+/* Forgets the profiler inherited by a forked child without joining its sampler thread. */
+void zend_fiber_profiler_fork();
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
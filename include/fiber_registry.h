@@ -0,0 +1,48 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_REGISTRY_H
+#define FIBER_REGISTRY_H
+
+#include "fiber.h"
+#include "zend_smart_str.h"
+
+BEGIN_EXTERN_C()
+
+/* Links a started fiber into the list of live fibers of the current thread. */
+void zend_fiber_registry_add(zend_fiber *fiber);
+
+/* Unlinks a finished or destroyed fiber, does nothing if the fiber is not linked. */
+void zend_fiber_registry_remove(zend_fiber *fiber);
+
+/* Topmost VM frame of a started, unfinished fiber, NULL otherwise. */
+zend_execute_data *zend_fiber_get_frame(zend_fiber *fiber);
+
+/* Appends "Class::function" (or "{main}" / the included file) of the frame. */
+void zend_fiber_append_frame_name(smart_str *str, zend_execute_data *ex);
+
+void zend_fiber_registry_get_all(zval *return_value);
+void zend_fiber_registry_get_trace(zend_fiber *fiber, zend_long options, zend_long limit, zval *return_value);
+zend_string *zend_fiber_registry_dump();
+
+/* Lists every suspended fiber with creation site, suspended time, stack size and stack, NULL if there are none. */
+zend_string *zend_fiber_registry_leaks();
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,33 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_SERVER_H
+#define FIBER_SERVER_H
+
+#include "fiber.h"
+
+BEGIN_EXTERN_C()
+
+void zend_fiber_server_ce_register();
+
+/* Called when the fiber of an accepted connection has finished, accepting resumes if it had been paused. */
+void zend_fiber_server_connection_done(zend_fiber *fiber);
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
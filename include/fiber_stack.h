@@ -26,6 +26,15 @@ typedef struct _zend_fiber_stack {
 zend_bool zend_fiber_stack_allocate(zend_fiber_stack *stack, unsigned int size);
 void zend_fiber_stack_free(zend_fiber_stack *stack);
 
+/* Checks fiber.max_stack_memory for a new stack of the given size, unmaps pooled stacks to make room. */
+zend_bool zend_fiber_stack_reserve(size_t size);
+
+/* Bytes mapped for a stack of the given size, including guard pages. */
+size_t zend_fiber_stack_mapped_size(size_t size);
+
+/* Unmaps stacks kept for reuse. */
+void zend_fiber_stack_pool_shutdown();
+
 #if _POSIX_MAPPED_FILES
 #define ZEND_FIBER_MMAP 1
 
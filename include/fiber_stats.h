@@ -0,0 +1,55 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_STATS_H
+#define FIBER_STATS_H
+
+#include "fiber.h"
+#include "fiber_watchdog.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+/* Invariant TSC, an order of magnitude cheaper than clock_gettime() and good enough for accounting. */
+#define ZEND_FIBER_TICKS_TSC 1
+#endif
+
+BEGIN_EXTERN_C()
+
+/* Timestamp used by the runtime counters, converted with zend_fiber_ticks_to_ns(). */
+static zend_always_inline uint64_t zend_fiber_ticks()
+{
+#ifdef ZEND_FIBER_TICKS_TSC
+	return __builtin_ia32_rdtsc();
+#else
+	return zend_fiber_clock();
+#endif
+}
+
+/* Calibrates the tick rate, must be called during module startup. */
+void zend_fiber_stats_startup();
+
+uint64_t zend_fiber_ticks_to_ns(uint64_t ticks);
+
+/* Fills return_value with the counters of the given fiber. */
+void zend_fiber_stats_get(zend_fiber *fiber, zval *return_value);
+
+/* Prints aggregated counters of the current thread as phpinfo() rows. */
+void zend_fiber_stats_info();
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
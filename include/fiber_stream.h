@@ -0,0 +1,40 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_STREAM_H
+#define FIBER_STREAM_H
+
+#include "fiber.h"
+
+BEGIN_EXTERN_C()
+
+/* Hooks all registered socket transports, must be called after other extensions registered theirs. */
+void zend_fiber_stream_startup();
+void zend_fiber_stream_shutdown();
+
+/* Hooks transports registered after startup (not in ZTS builds, streams of those transports block there). */
+void zend_fiber_stream_activate();
+
+zend_bool zend_fiber_stream_is_async();
+
+/* Makes a socket stream created from a descriptor park fibers on would-block like streams opened by transports. */
+void zend_fiber_stream_adopt(php_stream *stream);
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
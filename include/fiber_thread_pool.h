@@ -0,0 +1,66 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_THREAD_POOL_H
+#define FIBER_THREAD_POOL_H
+
+#include "fiber.h"
+
+BEGIN_EXTERN_C()
+
+typedef struct _zend_fiber_job zend_fiber_job;
+typedef struct _zend_fiber_thread_pool zend_fiber_thread_pool;
+
+struct _zend_fiber_job {
+	/* Executed on a worker thread, must only touch plain C data owned by the job. */
+	void (* run)(zend_fiber_job *job);
+
+	/* Releases the job, always invoked on the PHP thread. */
+	void (* free)(zend_fiber_job *job);
+
+	/* Fiber waiting for the job, NULL when awaited from main thread. */
+	zend_fiber *fiber;
+
+	/* Next job in the queue of the pool. */
+	zend_fiber_job *next;
+
+	/* Set once the job has been run and its completion has been seen by the PHP thread. */
+	zend_bool done;
+
+	/* Set if the waiting fiber has been destroyed, the pool will free the job once it completes. */
+	zend_bool abandoned;
+
+	/* Request the job has been submitted in (pool generation), completions seen by a later request are dropped. */
+	uint32_t generation;
+};
+
+void zend_fiber_blocking_ce_register();
+void zend_fiber_offload_ce_register();
+
+zend_bool zend_fiber_thread_pool_await(zend_fiber_job *job);
+void zend_fiber_thread_pool_shutdown();
+
+/* Detaches the pool from the poller at request end, workers keep running and the pool is registered again on use. */
+void zend_fiber_thread_pool_reset();
+
+/* Drops the pool inherited by a forked child, a new one is started on use. */
+void zend_fiber_thread_pool_fork();
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
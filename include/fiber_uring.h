@@ -0,0 +1,45 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_URING_H
+#define FIBER_URING_H
+
+#include "fiber.h"
+
+#define ZEND_FIBER_URING_ENTRIES 256
+
+BEGIN_EXTERN_C()
+
+typedef struct _zend_fiber_uring zend_fiber_uring;
+
+void zend_fiber_uring_ce_register();
+
+/* Closes the ring, called at request end after parked fibers have been abandoned, it is set up again on use. */
+void zend_fiber_uring_shutdown();
+
+/* Drops the ring inherited by a forked child without touching the submissions of the parent. */
+void zend_fiber_uring_fork();
+
+/* Submits all queued operations with a single io_uring_enter(), called before the poller blocks. */
+void zend_fiber_uring_flush();
+
+zend_bool zend_fiber_uring_available();
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
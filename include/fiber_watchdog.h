@@ -0,0 +1,66 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifndef FIBER_WATCHDOG_H
+#define FIBER_WATCHDOG_H
+
+#include "fiber.h"
+
+#ifdef PHP_WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+BEGIN_EXTERN_C()
+
+/* Monotonic clock in nanoseconds. */
+static zend_always_inline uint64_t zend_fiber_clock()
+{
+#ifdef PHP_WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+
+	if (UNEXPECTED(frequency.QuadPart == 0)) {
+		QueryPerformanceFrequency(&frequency);
+	}
+
+	QueryPerformanceCounter(&counter);
+
+	return (uint64_t) ((double) counter.QuadPart * 1000000000.0 / (double) frequency.QuadPart);
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+/* Called before switching from prev (NULL for main thread) to next and once control is back in prev. */
+void zend_fiber_watchdog_switch(zend_fiber *prev, zend_fiber *next);
+void zend_fiber_watchdog_return(zend_fiber *prev);
+
+/* Reports the fiber if its slice exceeded fiber.slow_slice_ms, called by the fiber before it yields. */
+void zend_fiber_watchdog_check(zend_fiber *fiber, zend_bool finished);
+
+void zend_fiber_watchdog_shutdown();
+
+END_EXTERN_C()
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
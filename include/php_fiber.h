@@ -15,6 +15,13 @@
 #define PHP_FIBER_H
 
 #include "fiber.h"
+#include "fiber_interrupt.h"
+#include "fiber_local.h"
+#include "fiber_perf.h"
+#include "fiber_profiler.h"
+#include "fiber_process.h"
+#include "fiber_thread_pool.h"
+#include "fiber_uring.h"
 
 extern zend_module_entry fiber_module_entry;
 #define phpext_fiber_ptr &fiber_module_entry
@@ -32,12 +39,140 @@ ZEND_BEGIN_MODULE_GLOBALS(fiber)
 	/* Active fiber, NULL when in main thread. */
 	zend_fiber *current_fiber;
 
+	/* Most recently started fiber of the list of started, unfinished fibers. */
+	zend_fiber *fibers;
+
+	/* Fiber\Local values of the main thread. */
+	zend_fiber_locals locals;
+
+	/* Next unused Fiber\Local index and indexes released by destroyed Fiber\Local objects (persistent). */
+	uint32_t local_next;
+	uint32_t *local_free;
+	uint32_t local_free_count;
+	uint32_t local_free_size;
+
+	/* Observer slots of the main thread, see zend_fiber_observer_slot(). */
+	void *observer_slots[ZEND_FIBER_MAX_OBSERVERS];
+
 	/* Default fiber C stack size. */
 	zend_long stack_size;
 
 	/* Error to be thrown into a fiber (will be populated by throw()). */
 	zval *error;
 
+	/* Native poller (epoll) used to park fibers, -1 until first use. */
+	int poll_fd;
+
+	/* Number of parked waiters and in-flight jobs that will resume someone. */
+	uint32_t poll_pending;
+
+	/* Waiters with a timeout ordered by deadline, bounds the time spent in epoll_wait(). */
+	struct _zend_fiber_poll_waiter *poll_timers;
+	struct _zend_fiber_poll_waiter *poll_timers_last;
+
+	/* Fibers to be resumed by the next dispatch, see zend_fiber_poll_defer(). */
+	zend_fiber **poll_deferred;
+	uint32_t poll_deferred_count;
+	uint32_t poll_deferred_size;
+
+	/* Worker threads running blocking operations, created on first use. */
+	zend_fiber_thread_pool *thread_pool;
+
+	/* Number of worker threads in the pool. */
+	zend_long thread_pool_size;
+
+	/* Inputs of Fiber\Offload smaller than this (in bytes) are processed inline. */
+	zend_long offload_threshold;
+
+	/* Signalfd state of Fiber\Signal, created on first use. */
+	zend_fiber_signal_state *signals;
+
+	/* Socket streams used within fibers park the fiber instead of blocking. */
+	zend_bool async_streams;
+
+	/* Shared io_uring instance, created on first use. */
+	zend_fiber_uring *uring;
+
+	/* Set if io_uring could not be set up, operations use plain syscalls. */
+	zend_bool uring_failed;
+
+	/* Quantum (in milliseconds) after which a fiber that did not suspend is preempted, 0 to disable. */
+	zend_long time_slice;
+
+	/* Thread raising the preemption interrupt, created on first switch if time slicing is enabled. */
+	zend_fiber_ticker *ticker;
+
+	/* Incremented on every switch, the ticker preempts if it did not change for a whole quantum. */
+	uint32_t slice;
+
+	/* Combination of ZEND_FIBER_INTERRUPT_* bits to be handled by the VM interrupt hook. */
+	uint32_t interrupt_pending;
+
+	/* Fibers running longer than this (in milliseconds) without suspending are reported, 0 to disable. */
+	zend_long slow_slice;
+
+	/* Callable receiving slow slice reports, a warning is raised if undefined. */
+	zval slow_slice_handler;
+
+	/* Set while a slow slice is being reported. */
+	zend_bool watchdog_active;
+
+	/* Fiber objects alive by status, indexed by ZEND_FIBER_STATUS_*. */
+	uint32_t fiber_count[5];
+
+	/* Number of switches into a fiber. */
+	uint64_t switches;
+
+	/* Native fiber stacks currently mapped, pooled stacks included, and their size (without guard pages). */
+	uint32_t stack_count;
+	size_t stack_bytes;
+
+	/* Stacks of finished fibers kept mapped for reuse, at most fiber.stack_pool of them. */
+	struct _zend_fiber_stack *stack_pool;
+	uint32_t stack_pool_count;
+	uint32_t stack_pool_alloc;
+	zend_long stack_pool_size;
+
+	/* Starting a fiber fails if its stack would exceed this total (fiber.max_stack_memory), 0 for no limit. */
+	zend_long max_stack_memory;
+
+	/* Zend MM usage at the last switch, the difference is charged to the fiber that was running. */
+	size_t memory_mark;
+
+	/* Attribute hardware performance counters to fibers on every switch. */
+	zend_bool perf_counters;
+
+	/* Per-thread perf_event_open() group, opened on first switch with perf_counters enabled. */
+	zend_fiber_perf *perf;
+
+	/* Set if the kernel denied access to the counters, the mode is off for the rest of the thread. */
+	zend_bool perf_failed;
+
+	/* Running sampling profiler (Fiber\Profiler), NULL if not started. */
+	zend_fiber_profiler *profiler;
+
+	/* How suspended fibers are finished at request end (fiber.shutdown_policy), one of ZEND_FIBER_SHUTDOWN_*. */
+	zend_long shutdown_policy;
+
+	/* Log the number of fibers finished at request end and the time it took. */
+	zend_bool shutdown_report;
+
+	/* Log suspended fibers with creation site and stack before finishing them at request end (fiber.leak_report). */
+	zend_bool leak_report;
+
+	/* Set once suspended fibers have been finished during request shutdown. */
+	zend_bool shutdown_done;
+
+	/* Unwind marker thrown into destroyed fibers, created once per request without a backtrace. */
+	zend_object *unwind;
+
+	/* Destroyed fibers that are still running their finally blocks. */
+	uint32_t unwinding;
+
+	/* Fibers finished by the last request shutdown and the time (ns) it took, shown by phpinfo(). */
+	uint32_t shutdown_count;
+	uint64_t shutdown_time;
+
 ZEND_END_MODULE_GLOBALS(fiber)
 
 extern ZEND_DECLARE_MODULE_GLOBALS(fiber)
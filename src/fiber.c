@@ -18,24 +18,38 @@
 #include "zend_interfaces.h"
 #include "zend_exceptions.h"
 #include "zend_closures.h"
+#include "zend_builtin_functions.h"
 
 #include "php_fiber.h"
 #include "fiber.h"
+#include "fiber_group.h"
+#include "fiber_interrupt.h"
+#include "fiber_local.h"
+#include "fiber_observer.h"
+#include "fiber_perf.h"
+#include "fiber_poll.h"
+#include "fiber_probes.h"
+#include "fiber_stack.h"
+#include "fiber_registry.h"
+#include "fiber_server.h"
+#include "fiber_stats.h"
+#include "fiber_watchdog.h"
 
 #ifndef ZEND_PARSE_PARAMETERS_NONE
 #define ZEND_PARSE_PARAMETERS_NONE() zend_parse_parameters_none()
 #endif
 
-static zend_class_entry *zend_ce_fiber;
-static zend_class_entry *zend_ce_fiber_error;
+zend_class_entry *zend_ce_fiber;
+zend_class_entry *zend_ce_fiber_error;
 static zend_object_handlers zend_fiber_handlers;
 
 static zend_object *zend_fiber_object_create(zend_class_entry *ce);
 static void zend_fiber_object_destroy(zend_object *object);
+static void zend_fiber_release(zend_fiber *fiber);
+static void zend_fiber_run();
 
-static zend_op_array fiber_run_func;
-static zend_try_catch_element fiber_terminate_try_catch_array = { 0, 1, 0, 0 };
-static zend_op fiber_run_op[2];
+/* Internal function of the bottom frame of every fiber, no opcodes are involved in starting a fiber. */
+static zend_internal_function fiber_run_func;
 
 #define ZEND_FIBER_BACKUP_EG(stack, stack_page_size, exec) do { \
 	stack = EG(vm_stack); \
@@ -53,8 +67,82 @@ static zend_op fiber_run_op[2];
 	EG(current_execute_data) = exec; \
 } while (0)
 
+/* Trace the tracing JIT is running on the current stack, side exits look it up after switching back. */
+#if PHP_VERSION_ID >= 80000
+#define ZEND_FIBER_BACKUP_JIT(trace_num) (trace_num) = EG(jit_trace_num)
+#define ZEND_FIBER_RESTORE_JIT(trace_num) EG(jit_trace_num) = (trace_num)
+#else
+#define ZEND_FIBER_BACKUP_JIT(trace_num) (trace_num) = 0
+#define ZEND_FIBER_RESTORE_JIT(trace_num) (void) (trace_num)
+#endif
+
+/* Keeps the per-status counters shown by phpinfo() in sync. */
+static zend_always_inline void zend_fiber_set_status(zend_fiber *fiber, zend_uchar status)
+{
+	FIBER_G(fiber_count)[fiber->status]--;
+	FIBER_G(fiber_count)[status]++;
+
+	fiber->status = status;
+}
+
+
+/* Charges the change of Zend MM usage since the last switch to the fiber that was running (NULL for main thread). */
+static zend_always_inline void zend_fiber_charge_memory(zend_fiber *fiber)
+{
+	size_t usage;
+
+	usage = zend_memory_usage(0);
+
+	if (fiber != NULL) {
+		fiber->memory += (int64_t) usage - (int64_t) FIBER_G(memory_mark);
+	}
+
+	FIBER_G(memory_mark) = usage;
+}
+
+
+/* Handlers of unwind markers, those of Error (no cloning) in a table of their own that identifies a marker. */
+static zend_object_handlers zend_fiber_unwind_handlers;
+
+static zend_always_inline zend_bool zend_fiber_is_unwind(zend_object *ex)
+{
+	return ex != NULL && ex->handlers == &zend_fiber_unwind_handlers;
+}
+
+
+/* The marker only exists to run finally blocks, it is dropped wherever it would reach user code outside the fiber. */
+static zend_always_inline void zend_fiber_strip_unwind()
+{
+	if (UNEXPECTED(EG(exception) != NULL) && zend_fiber_is_unwind(EG(exception))) {
+		zend_clear_exception();
+	}
+}
+
+
+#if PHP_VERSION_ID < 80000
+static user_opcode_handler_t zend_fiber_prev_catch_handler;
+
+/* Catch blocks never match the unwind marker, it is rethrown as by a catch of an unrelated class and finally blocks
+ * still run. Versions without a JIT only, opcache disables the JIT if a user opcode handler is installed. */
+static int zend_fiber_catch_handler(zend_execute_data *execute_data)
+{
+	zend_exception_restore();
+
+	if (UNEXPECTED(zend_fiber_is_unwind(EG(exception)))) {
+		zend_rethrow_exception(execute_data);
+		return ZEND_USER_OPCODE_CONTINUE;
+	}
+
+	if (zend_fiber_prev_catch_handler != NULL) {
+		return zend_fiber_prev_catch_handler(execute_data);
+	}
 
-static zend_bool zend_fiber_switch_to(zend_fiber *fiber)
+	return ZEND_USER_OPCODE_DISPATCH;
+}
+#endif
+
+
+zend_bool zend_fiber_switch_to(zend_fiber *fiber)
 {
 	zend_fiber_context root;
 
@@ -75,322 +163,1713 @@ static zend_bool zend_fiber_switch_to(zend_fiber *fiber)
 	zend_execute_data *exec;
 	zend_vm_stack stack;
 	size_t stack_page_size;
+	uint32_t jit_trace_num;
+	uint64_t now;
+
+	if (UNEXPECTED(FIBER_G(ticker) == NULL) && FIBER_G(time_slice) > 0) {
+		zend_fiber_ticker_start();
+	}
 
 	ZEND_FIBER_BACKUP_EG(stack, stack_page_size, exec);
+	ZEND_FIBER_BACKUP_JIT(jit_trace_num);
 
 	prev = FIBER_G(current_fiber);
 	FIBER_G(current_fiber) = fiber;
+	FIBER_G(slice)++;
+
+	/* Keeps the frames of a fiber resuming another one reachable for Fiber::getTrace(). */
+	if (prev != NULL) {
+		prev->exec = exec;
+		prev->stack = stack;
+	}
+	FIBER_G(switches)++;
+
+	now = zend_fiber_ticks();
+
+	if (prev != NULL) {
+		prev->run_ticks += now - prev->switched_at;
+	}
+
+	if (fiber->first_run_at == 0) {
+		fiber->first_run_at = now;
+	} else {
+		fiber->suspended_ticks += now - fiber->switched_at;
+		fiber->resumes++;
+	}
+
+	fiber->switched_at = now;
+
+	zend_fiber_charge_memory(prev);
+
+	if (UNEXPECTED(FIBER_G(perf_counters))) {
+		zend_fiber_perf_charge(prev);
+	}
+
+	if (UNEXPECTED(FIBER_G(slow_slice) > 0)) {
+		zend_fiber_watchdog_switch(prev, fiber);
+	}
+
+	if (UNEXPECTED(zend_fiber_observer_count > 0)) {
+		zend_fiber_observer_switch(prev, fiber);
+	}
+
+	ZEND_FIBER_PROBE(switch__entry, fiber);
 
 	result = zend_fiber_switch_context((prev == NULL) ? root : prev->context, fiber->context);
 
+	ZEND_FIBER_PROBE(switch__exit, fiber);
+
 	FIBER_G(current_fiber) = prev;
+	FIBER_G(slice)++;
+
+	now = zend_fiber_ticks();
+
+	fiber->run_ticks += now - fiber->switched_at;
+	fiber->switched_at = now;
+
+	if (prev != NULL) {
+		prev->switched_at = now;
+	}
+
+	zend_fiber_charge_memory(fiber);
+
+	if (UNEXPECTED(FIBER_G(perf_counters))) {
+		zend_fiber_perf_charge(fiber);
+	}
+
+	if (UNEXPECTED(FIBER_G(slow_slice) > 0)) {
+		zend_fiber_watchdog_return(prev);
+	}
+
+	if (UNEXPECTED(zend_fiber_observer_count > 0)) {
+		zend_fiber_observer_switch(fiber, prev);
+	}
 
 	ZEND_FIBER_RESTORE_EG(stack, stack_page_size, exec);
+	ZEND_FIBER_RESTORE_JIT(jit_trace_num);
+
+	zend_fiber_strip_unwind();
+
+	if (UNEXPECTED(fiber->memory_budget > 0) && fiber->memory > (int64_t) fiber->memory_budget
+		&& !(fiber->flags & ZEND_FIBER_FLAG_OVER_BUDGET)) {
+		fiber->flags |= ZEND_FIBER_FLAG_OVER_BUDGET;
+
+		zend_error(E_WARNING, "Fiber exceeded its memory budget of %zu bytes (%" PRId64 " bytes)", fiber->memory_budget, fiber->memory);
+	}
+
+	if (fiber->group != NULL && fiber->status >= ZEND_FIBER_STATUS_FINISHED) {
+		zend_fiber_group_child_done(fiber);
+	}
+
+	if (fiber->server != NULL && fiber->status >= ZEND_FIBER_STATUS_FINISHED) {
+		zend_fiber_server_connection_done(fiber);
+	}
 
 	return result;
 }
 
 
-static void zend_fiber_run()
+zend_bool zend_fiber_is_run_func(const zend_function *func)
 {
-	zend_fiber *fiber;
+	return func == (const zend_function *) &fiber_run_func;
+}
 
-	fiber = FIBER_G(current_fiber);
-	ZEND_ASSERT(fiber != NULL);
 
-	EG(vm_stack) = fiber->stack;
-	EG(vm_stack_top) = fiber->stack->top;
-	EG(vm_stack_end) = fiber->stack->end;
-	EG(vm_stack_page_size) = ZEND_FIBER_VM_STACK_SIZE;
+void zend_fiber_init(zend_fiber *fiber, zend_fcall_info *fci, zend_fcall_info_cache *fci_cache)
+{
+	fiber->fci = *fci;
+	fiber->fci_cache = *fci_cache;
 
-	fiber->exec = (zend_execute_data *) EG(vm_stack_top);
-	EG(vm_stack_top) = (zval *) fiber->exec + ZEND_CALL_FRAME_SLOT;
-	zend_vm_init_call_frame(fiber->exec, ZEND_CALL_TOP_FUNCTION, (zend_function *) &fiber_run_func, 0, NULL);
-	fiber->exec->opline = fiber_run_op;
-	fiber->exec->call = NULL;
-	fiber->exec->return_value = NULL;
-	fiber->exec->prev_execute_data = NULL;
+	zend_fiber_set_status(fiber, ZEND_FIBER_STATUS_INIT);
+	fiber->stack_size = FIBER_G(stack_size);
 
-	EG(current_execute_data) = fiber->exec;
+	// Keep a reference to closures or callable objects as long as the fiber lives.
+	Z_TRY_ADDREF(fiber->fci.function_name);
+}
 
-	execute_ex(fiber->exec);
 
-	zval_ptr_dtor(&fiber->fci.function_name);
-	zval_ptr_dtor(&fiber->value);
-	zval_ptr_dtor(&fiber->result);
+zend_bool zend_fiber_do_start(zend_fiber *fiber, zval *params, uint32_t param_count)
+{
+	fiber->fci.params = params;
+	fiber->fci.param_count = param_count;
+#if PHP_VERSION_ID < 80000
+	fiber->fci.no_separation = 1;
+#endif
 
-	zend_vm_stack_destroy();
-	fiber->stack = NULL;
-	fiber->exec = NULL;
+	/* Native stacks are mapped outside of memory_limit. */
+	if (!zend_fiber_stack_reserve(fiber->stack_size)) {
+		zend_throw_error(zend_ce_fiber_error, "Cannot start fiber, fiber.max_stack_memory of " ZEND_LONG_FMT " bytes would be exceeded", FIBER_G(max_stack_memory));
+		return 0;
+	}
 
-	zend_fiber_suspend(fiber->context);
+	fiber->context = zend_fiber_create_context();
 
-	abort();
+	if (fiber->context == NULL) {
+		zend_throw_error(NULL, "Failed to create native fiber context");
+		return 0;
+	}
+
+	if (!zend_fiber_create(fiber->context, zend_fiber_run, fiber->stack_size)) {
+		zend_throw_error(NULL, "Failed to create native fiber");
+		return 0;
+	}
+
+	fiber->stack = (zend_vm_stack) emalloc(ZEND_FIBER_VM_STACK_SIZE);
+	fiber->stack->top = ZEND_VM_STACK_ELEMENTS(fiber->stack) + 1;
+	fiber->stack->end = (zval *) ((char *) fiber->stack + ZEND_FIBER_VM_STACK_SIZE);
+	fiber->stack->prev = NULL;
+
+	ZEND_FIBER_PROBE(start, fiber);
+
+	zend_fiber_registry_add(fiber);
+
+	if (!zend_fiber_switch_to(fiber)) {
+		zend_throw_error(NULL, "Failed switching to fiber");
+		return 0;
+	}
+
+	return 1;
 }
 
 
-static int fiber_run_opcode_handler(zend_execute_data *exec)
+zend_bool zend_fiber_do_resume(zend_fiber *fiber, zval *value)
 {
-	zend_fiber *fiber;
-	zval retval;
+	Z_TRY_DELREF(fiber->value);
 
-	fiber = FIBER_G(current_fiber);
-	ZEND_ASSERT(fiber != NULL);
+	if (value == NULL) {
+		ZVAL_NULL(&fiber->value);
+	} else {
+		ZVAL_COPY(&fiber->value, value);
+	}
 
-	fiber->status = ZEND_FIBER_STATUS_RUNNING;
-	fiber->fci.retval = &retval;
+	zend_fiber_set_status(fiber, ZEND_FIBER_STATUS_RUNNING);
 
-	zend_call_function(&fiber->fci, &fiber->fci_cache);
+	if (!zend_fiber_switch_to(fiber)) {
+		zend_throw_error(NULL, "Failed switching to fiber");
+		return 0;
+	}
 
-	if (EG(exception)) {
-		if (fiber->status == ZEND_FIBER_STATUS_DEAD) {
-			zend_clear_exception();
-		} else {
-			fiber->status = ZEND_FIBER_STATUS_DEAD;
-		}
+	return 1;
+}
+
+
+/* Unwinds a destroyed fiber with the unwind marker, an Error created once per request without a backtrace. */
+static void zend_fiber_throw_unwind(zend_fiber *fiber)
+{
+	zend_execute_data *exec;
+	zval tmp;
+
+	/* Kept by a fiber that is unwinding further up or by user code, the next fiber gets a marker of its own. */
+	if (FIBER_G(unwind) != NULL && GC_REFCOUNT(FIBER_G(unwind)) > 1) {
+		OBJ_RELEASE(FIBER_G(unwind));
+		FIBER_G(unwind) = NULL;
+	}
+
+	if (FIBER_G(unwind) == NULL) {
+		/* Without an active frame the exception does not capture a backtrace. */
+		exec = EG(current_execute_data);
+		EG(current_execute_data) = NULL;
+
+		object_init_ex(&tmp, zend_ce_error);
+
+		EG(current_execute_data) = exec;
+
+#if PHP_VERSION_ID >= 80000
+		zend_update_property_string(zend_ce_error, Z_OBJ(tmp), "message", sizeof("message") - 1, "Fiber has been destroyed");
+#else
+		zend_update_property_string(zend_ce_error, &tmp, "message", sizeof("message") - 1, "Fiber has been destroyed");
+#endif
+
+		Z_OBJ(tmp)->handlers = &zend_fiber_unwind_handlers;
+		FIBER_G(unwind) = Z_OBJ(tmp);
 	} else {
-		fiber->status = ZEND_FIBER_STATUS_FINISHED;
-		ZVAL_COPY_VALUE(&fiber->result, &retval);
+		/* Thrown while another exception was pending, that exception has been chained onto the marker. */
+		ZVAL_OBJ(&tmp, FIBER_G(unwind));
+
+#if PHP_VERSION_ID >= 80000
+		zend_update_property_null(zend_ce_error, Z_OBJ(tmp), "previous", sizeof("previous") - 1);
+#else
+		zend_update_property_null(zend_ce_error, &tmp, "previous", sizeof("previous") - 1);
+#endif
+	}
+
+	/* Released once the fiber has finished, zend_fiber_unwind_interrupt() looks for the marker of the fiber. */
+	if (fiber->unwind == NULL) {
+		GC_ADDREF(FIBER_G(unwind));
+		fiber->unwind = FIBER_G(unwind);
+		FIBER_G(unwinding)++;
+
+#if PHP_VERSION_ID >= 80000
+		zend_fiber_interrupt_raise(&FIBER_G(interrupt_pending), &EG(vm_interrupt), ZEND_FIBER_INTERRUPT_UNWIND);
+#endif
 	}
 
-	return ZEND_USER_OPCODE_RETURN;
+	GC_ADDREF(FIBER_G(unwind));
+	ZVAL_OBJ(&tmp, FIBER_G(unwind));
+
+	zend_throw_exception_object(&tmp);
 }
 
 
-static zend_object *zend_fiber_object_create(zend_class_entry *ce)
+#if PHP_VERSION_ID >= 80000
+/* Checks for a frame suspended in a finally block, the block has been entered without the marker pending. */
+static zend_bool zend_fiber_unwind_in_finally(zend_execute_data *ex)
 {
-	zend_fiber *fiber;
+	zend_try_catch_element *try_catch;
+	uint32_t op_num;
+	int i;
 
-	fiber = emalloc(sizeof(zend_fiber));
-	memset(fiber, 0, sizeof(zend_fiber));
+	op_num = (uint32_t) (ex->opline - ex->func->op_array.opcodes);
 
-	zend_object_std_init(&fiber->std, ce);
-	fiber->std.handlers = &zend_fiber_handlers;
+	for (i = 0; i < ex->func->op_array.last_try_catch; i++) {
+		try_catch = &ex->func->op_array.try_catch_array[i];
 
-	ZVAL_UNDEF(&fiber->value);
-	ZVAL_UNDEF(&fiber->result);
-	
-	return &fiber->std;
+		if (try_catch->finally_op && op_num >= try_catch->finally_op && op_num < try_catch->finally_end) {
+			return 1;
+		}
+	}
+
+	return 0;
 }
 
 
-static void zend_fiber_object_destroy(zend_object *object)
+/* Rethrows the marker of the unwinding fiber once a catch block has taken it. Catch blocks cannot be skipped on
+ * versions with a JIT, so the marker is thrown again at the next VM interrupt after the catch block as if the catch
+ * had not matched. Finally blocks entered in between complete first. */
+void zend_fiber_unwind_interrupt(zend_execute_data *execute_data)
 {
 	zend_fiber *fiber;
+	zend_object *marker;
+	zend_execute_data *ex;
+	zend_try_catch_element *try_catch;
+	zval *cv;
+	zval *end;
+	uint32_t refs;
+	uint32_t op_num;
+	int i;
+
+	if (FIBER_G(unwinding) == 0) {
+		return;
+	}
 
-	fiber = (zend_fiber *) object;
+	/* Fibers resumed by an unwinding fiber run in between, the check stays armed until all of them are done. */
+	zend_fiber_interrupt_raise(&FIBER_G(interrupt_pending), &EG(vm_interrupt), ZEND_FIBER_INTERRUPT_UNWIND);
 
-	if (fiber->status == ZEND_FIBER_STATUS_SUSPENDED) {
-		fiber->status = ZEND_FIBER_STATUS_DEAD;
+	fiber = FIBER_G(current_fiber);
 
-		zend_fiber_switch_to(fiber);
+	if (fiber == NULL || fiber->unwind == NULL || EG(exception) != NULL) {
+		return;
 	}
 
-	if (fiber->status == ZEND_FIBER_STATUS_INIT) {
-		zval_ptr_dtor(&fiber->fci.function_name);
+	if (execute_data == NULL || execute_data->func == NULL || !ZEND_USER_CODE(execute_data->func->type)) {
+		return;
 	}
 
-	zend_fiber_destroy(fiber->context);
+	/* References held by the fiber, by the per-request marker and by the thrown exception being propagated. */
+	marker = fiber->unwind;
+	refs = GC_REFCOUNT(marker) - 1 - (FIBER_G(unwind) == marker);
 
-	zend_object_std_dtor(&fiber->std);
+	for (ex = execute_data; ex != NULL; ex = ex->prev_execute_data) {
+		if (ex->func == NULL || !ZEND_USER_CODE(ex->func->type) || (ZEND_CALL_INFO(ex) & ZEND_CALL_CODE)) {
+			continue;
+		}
+
+		if (zend_fiber_unwind_in_finally(ex)) {
+			return;
+		}
+
+		cv = ZEND_CALL_VAR_NUM(ex, 0);
+		end = cv + ex->func->op_array.last_var;
+
+		for (; cv != end; cv++) {
+			if (Z_TYPE_P(cv) == IS_OBJECT && Z_OBJ_P(cv) == marker) {
+				refs--;
+			}
+		}
+	}
+
+	/* Pending in a finally block or around a destructor, or kept by user code somewhere else than in a variable. */
+	if (refs != 0) {
+		return;
+	}
+
+	/* Thrown from the catch of the innermost try the frame is in, that catch does not see the marker again. */
+	op_num = (uint32_t) (execute_data->opline - execute_data->func->op_array.opcodes);
+
+	for (i = execute_data->func->op_array.last_try_catch - 1; i >= 0; i--) {
+		try_catch = &execute_data->func->op_array.try_catch_array[i];
+
+		if (op_num >= try_catch->try_op && op_num < try_catch->catch_op) {
+			execute_data->opline = &execute_data->func->op_array.opcodes[try_catch->catch_op];
+			break;
+		}
+	}
+
+	GC_ADDREF(marker);
+	zend_throw_exception_internal(marker);
 }
+#endif
 
 
-/* {{{ proto Fiber::__construct(callable $callback) */
-ZEND_METHOD(Fiber, __construct)
+void zend_fiber_do_suspend(zend_fiber *fiber, zval *value, zval *return_value)
 {
-	zend_fiber *fiber;
+	zend_execute_data *exec;
+	size_t stack_page_size;
+	uint32_t jit_trace_num;
+	zval *error;
 
-	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+	if (UNEXPECTED(FIBER_G(slow_slice) > 0)) {
+		zend_fiber_watchdog_check(fiber, 0);
+	}
 
-	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 1, 1)
-		Z_PARAM_FUNC_EX(fiber->fci, fiber->fci_cache, 1, 0)
-	ZEND_PARSE_PARAMETERS_END();
+	Z_TRY_DELREF(fiber->value);
 
-	fiber->status = ZEND_FIBER_STATUS_INIT;
-	fiber->stack_size = FIBER_G(stack_size);
+	if (value == NULL) {
+		ZVAL_NULL(&fiber->value);
+	} else {
+		ZVAL_COPY(&fiber->value, value);
+	}
+
+	zend_fiber_set_status(fiber, ZEND_FIBER_STATUS_SUSPENDED);
+
+	ZEND_FIBER_PROBE(suspend, fiber);
+
+	ZEND_FIBER_BACKUP_EG(fiber->stack, stack_page_size, fiber->exec);
+	ZEND_FIBER_BACKUP_JIT(jit_trace_num);
+
+	zend_fiber_suspend(fiber->context);
+
+	ZEND_FIBER_RESTORE_EG(fiber->stack, stack_page_size, fiber->exec);
+	ZEND_FIBER_RESTORE_JIT(jit_trace_num);
+
+	if (fiber->status == ZEND_FIBER_STATUS_DEAD) {
+		zend_fiber_throw_unwind(fiber);
+		return;
+	}
+
+	error = FIBER_G(error);
+
+	if (error == NULL) {
+		if (return_value != NULL) {
+			ZVAL_COPY(return_value, &fiber->value);
+		}
+		return;
+	}
+
+	FIBER_G(error) = NULL;
+	exec = EG(current_execute_data);
+
+	/* A fiber preempted by the VM interrupt hook is suspended in user code, its opline already is the next one. */
+	if (exec->func != NULL && ZEND_USER_CODE(exec->func->type)) {
+		zend_throw_exception_object(error);
+		return;
+	}
+
+	exec->opline--;
+	zend_throw_exception_object(error);
+	exec->opline++;
+}
+
+
+void zend_fiber_do_cancel(zend_fiber *fiber)
+{
+	/* Unwinding would run the cleanup of a wait that only exists in the parent process. */
+	if (UNEXPECTED(fiber->flags & ZEND_FIBER_FLAG_ORPHANED) && fiber->status == ZEND_FIBER_STATUS_SUSPENDED) {
+		zend_fiber_release(fiber);
+		return;
+	}
+
+	if (fiber->status == ZEND_FIBER_STATUS_SUSPENDED) {
+		zend_fiber_set_status(fiber, ZEND_FIBER_STATUS_DEAD);
+
+		zend_fiber_switch_to(fiber);
+	}
+}
+
+
+/* Destroys the values held by the frames of a suspended fiber the way leaving them would, no code of the fiber runs
+ * (destructors of released objects do). Must be called with the VM stack of the fiber being the current one. */
+static void zend_fiber_destroy_frames(zend_fiber *fiber)
+{
+	zend_execute_data *ex;
+	uint32_t call_info;
+	zval *cv;
+	zval *end;
+
+	for (ex = fiber->exec; ex != NULL; ex = ex->prev_execute_data) {
+		call_info = ZEND_CALL_INFO(ex);
+
+		/* Frames of running generators are owned by the generator objects. */
+		if (call_info & ZEND_CALL_GENERATOR) {
+			continue;
+		}
+
+		if (ex->func != NULL && ZEND_USER_CODE(ex->func->type)) {
+			/* The opline is the one the frame is suspended in, temporaries defined before it are live. */
+			zend_cleanup_unfinished_execution(ex, (uint32_t) (ex->opline - ex->func->op_array.opcodes), 0);
+
+			if (call_info & ZEND_CALL_CODE) {
+				/* Included or evaluated code keeps its variables in the symbol table of its caller. */
+				zend_detach_symbol_table(ex);
+				destroy_op_array(&ex->func->op_array);
+				efree_size(ex->func, sizeof(zend_op_array));
+			} else {
+				cv = ZEND_CALL_VAR_NUM(ex, 0);
+				end = cv + ex->func->op_array.last_var;
+
+				for (; cv != end; cv++) {
+					zval_ptr_dtor(cv);
+					ZVAL_UNDEF(cv);
+				}
+
+				zend_vm_stack_free_extra_args(ex);
+
+				if (call_info & ZEND_CALL_HAS_SYMBOL_TABLE) {
+					zend_clean_and_cache_symbol_table(ex->symbol_table);
+				}
+			}
+		} else {
+			zend_vm_stack_free_args(ex);
+		}
+
+#if PHP_VERSION_ID >= 80000
+		if (call_info & ZEND_CALL_HAS_EXTRA_NAMED_PARAMS) {
+			zend_free_extra_named_params(ex->extra_named_params);
+		}
+#endif
+
+		if (call_info & ZEND_CALL_RELEASE_THIS) {
+			OBJ_RELEASE(Z_OBJ(ex->This));
+		}
+
+		if (call_info & ZEND_CALL_CLOSURE) {
+			OBJ_RELEASE(ZEND_CLOSURE_OBJECT(ex->func));
+		}
+	}
+}
+
+
+/* Drops a suspended fiber without switching into it, values of its frames are destroyed and its VM stack is freed. */
+static void zend_fiber_release(zend_fiber *fiber)
+{
+	zend_vm_stack stack;
+	zval *stack_top;
+	zval *stack_end;
+	size_t stack_page_size;
+
+	zend_fiber_set_status(fiber, ZEND_FIBER_STATUS_DEAD);
+
+	ZEND_FIBER_PROBE(dead, fiber);
+
+	zval_ptr_dtor(&fiber->fci.function_name);
+	ZVAL_UNDEF(&fiber->fci.function_name);
+
+	zval_ptr_dtor(&fiber->value);
+	ZVAL_UNDEF(&fiber->value);
+
+	zend_fiber_locals_destroy(&fiber->locals);
+
+	if (fiber->stack != NULL) {
+		stack = EG(vm_stack);
+		stack_top = EG(vm_stack_top);
+		stack_end = EG(vm_stack_end);
+		stack_page_size = EG(vm_stack_page_size);
+
+		/* Unfinished calls are popped and destructors push their frames, all on the stack of the fiber. */
+		EG(vm_stack) = fiber->stack;
+		EG(vm_stack_top) = fiber->stack->top;
+		EG(vm_stack_end) = fiber->stack->end;
+		EG(vm_stack_page_size) = ZEND_FIBER_VM_STACK_SIZE;
+
+		zend_fiber_destroy_frames(fiber);
+
+		/* Frees the page chain as zend_fiber_run() does once the fiber has finished. */
+		zend_vm_stack_destroy();
+
+		EG(vm_stack) = stack;
+		EG(vm_stack_top) = stack_top;
+		EG(vm_stack_end) = stack_end;
+		EG(vm_stack_page_size) = stack_page_size;
+	}
+
+	fiber->exec = NULL;
+	fiber->stack = NULL;
+
+	zend_fiber_destroy(fiber->context);
+	fiber->context = NULL;
+}
+
+
+void zend_fiber_shutdown_fibers()
+{
+	zend_fiber *fiber;
+	uint64_t start;
+	uint32_t count;
+	zend_string *leaks;
+	char buf[128];
+
+	FIBER_G(shutdown_done) = 1;
+
+	if (FIBER_G(fibers) == NULL) {
+		return;
+	}
+
+	/* Fibers still suspended at this point have never been resumed to completion and are still referenced. */
+	if (FIBER_G(leak_report)) {
+		leaks = zend_fiber_registry_leaks();
+
+		if (leaks != NULL) {
+			php_log_err(ZSTR_VAL(leaks));
+			zend_string_release(leaks);
+		}
+	}
+
+	start = zend_fiber_clock();
+	count = 0;
+
+	/* Unwinding may start new fibers, they are added at the head and picked up as well. */
+	while ((fiber = FIBER_G(fibers)) != NULL) {
+		zend_fiber_registry_remove(fiber);
+
+		if (fiber->status != ZEND_FIBER_STATUS_SUSPENDED) {
+			continue;
+		}
+
+		count++;
+
+		/* Parked fibers are registered with the poller or thread pool, unwinding cancels those registrations. */
+		if (FIBER_G(shutdown_policy) == ZEND_FIBER_SHUTDOWN_RELEASE && !(fiber->flags & ZEND_FIBER_FLAG_PARKED)) {
+			zend_fiber_release(fiber);
+			continue;
+		}
+
+		GC_ADDREF(&fiber->std);
+		zend_fiber_do_cancel(fiber);
+		OBJ_RELEASE(&fiber->std);
+	}
+
+	FIBER_G(shutdown_count) = count;
+	FIBER_G(shutdown_time) = zend_fiber_clock() - start;
+
+	if (FIBER_G(shutdown_report)) {
+		snprintf(buf, sizeof(buf), "Fiber: %s %u suspended fibers at shutdown in %.3f ms",
+			(FIBER_G(shutdown_policy) == ZEND_FIBER_SHUTDOWN_RELEASE) ? "released" : "unwound",
+			count,
+			FIBER_G(shutdown_time) / 1000000.0
+		);
+
+		php_log_err(buf);
+	}
+}
+
+
+static void zend_fiber_run()
+{
+	zend_fiber *fiber;
+	zval retval;
+
+	fiber = FIBER_G(current_fiber);
+	ZEND_ASSERT(fiber != NULL);
+
+	EG(vm_stack) = fiber->stack;
+	EG(vm_stack_top) = fiber->stack->top;
+	EG(vm_stack_end) = fiber->stack->end;
+	EG(vm_stack_page_size) = ZEND_FIBER_VM_STACK_SIZE;
+
+	/* Bottom frame of the fiber, the callable is invoked from C as from any internal function. */
+	fiber->exec = (zend_execute_data *) EG(vm_stack_top);
+	EG(vm_stack_top) = (zval *) fiber->exec + ZEND_CALL_FRAME_SLOT;
+	zend_vm_init_call_frame(fiber->exec, ZEND_CALL_TOP_FUNCTION, (zend_function *) &fiber_run_func, 0, NULL);
+	fiber->exec->opline = NULL;
+	fiber->exec->call = NULL;
+	fiber->exec->return_value = NULL;
+	fiber->exec->prev_execute_data = NULL;
+
+	EG(current_execute_data) = fiber->exec;
+
+#if PHP_VERSION_ID >= 80000
+	EG(jit_trace_num) = 0;
+#endif
+
+	zend_fiber_set_status(fiber, ZEND_FIBER_STATUS_RUNNING);
+	fiber->fci.retval = &retval;
+
+	zend_call_function(&fiber->fci, &fiber->fci_cache);
+
+	/* A destroyed fiber ends with the marker or with whatever finally blocks threw while unwinding, neither leaves it. */
+	if (EG(exception)) {
+		if (fiber->status == ZEND_FIBER_STATUS_DEAD) {
+			zend_clear_exception();
+		} else {
+			zend_fiber_set_status(fiber, ZEND_FIBER_STATUS_DEAD);
+		}
+
+		ZEND_FIBER_PROBE(dead, fiber);
+	} else if (fiber->status == ZEND_FIBER_STATUS_DEAD) {
+		/* Returned after the marker had been taken by user code that was not thrown again, no result. */
+		zval_ptr_dtor(&retval);
+
+		ZEND_FIBER_PROBE(dead, fiber);
+	} else {
+		zend_fiber_set_status(fiber, ZEND_FIBER_STATUS_FINISHED);
+		ZVAL_COPY_VALUE(&fiber->result, &retval);
+
+		ZEND_FIBER_PROBE(finish, fiber);
+
+		if (UNEXPECTED(FIBER_G(slow_slice) > 0)) {
+			zend_fiber_watchdog_check(fiber, 1);
+		}
+	}
+
+	if (fiber->unwind != NULL) {
+		OBJ_RELEASE(fiber->unwind);
+		fiber->unwind = NULL;
+		FIBER_G(unwinding)--;
+	}
+
+	zend_fiber_registry_remove(fiber);
+	zend_fiber_locals_destroy(&fiber->locals);
+
+	/* The result is kept for getReturn() and released with the fiber object. */
+	zval_ptr_dtor(&fiber->fci.function_name);
+	ZVAL_UNDEF(&fiber->fci.function_name);
+
+	zval_ptr_dtor(&fiber->value);
+	ZVAL_UNDEF(&fiber->value);
+
+	zend_vm_stack_destroy();
+	fiber->stack = NULL;
+	fiber->exec = NULL;
+
+	zend_fiber_suspend(fiber->context);
+
+	abort();
+}
+
+
+static zend_object *zend_fiber_object_create(zend_class_entry *ce)
+{
+	zend_fiber *fiber;
+
+	fiber = emalloc(sizeof(zend_fiber));
+	memset(fiber, 0, sizeof(zend_fiber));
+
+	zend_object_std_init(&fiber->std, ce);
+	fiber->std.handlers = &zend_fiber_handlers;
+
+	ZVAL_UNDEF(&fiber->value);
+	ZVAL_UNDEF(&fiber->result);
+
+	/* Filename strings are interned or owned by the op array, capturing them is a refcount increment. */
+	fiber->created_file = zend_get_executed_filename_ex();
+
+	if (fiber->created_file != NULL) {
+		zend_string_addref(fiber->created_file);
+		fiber->created_line = zend_get_executed_lineno();
+	}
+
+	fiber->created_at = zend_fiber_ticks();
+	FIBER_G(fiber_count)[ZEND_FIBER_STATUS_INIT]++;
+
+	if (UNEXPECTED(zend_fiber_observer_count > 0)) {
+		zend_fiber_observer_create(fiber);
+	}
+	
+	return &fiber->std;
+}
+
+
+static void zend_fiber_gc_add(zend_fiber *fiber, uint32_t *n, zval *zv)
+{
+	if (!Z_REFCOUNTED_P(zv)) {
+		return;
+	}
+
+	if (*n == fiber->gc_buffer_size) {
+		fiber->gc_buffer_size = (fiber->gc_buffer_size == 0) ? 16 : fiber->gc_buffer_size * 2;
+		fiber->gc_buffer = (zval *) safe_erealloc(fiber->gc_buffer, fiber->gc_buffer_size, sizeof(zval), 0);
+	}
+
+	ZVAL_COPY_VALUE(&fiber->gc_buffer[(*n)++], zv);
+}
+
+
+/* Collects the values owned by a frame of a suspended fiber, returns its symbol table if it has one attached. */
+static HashTable *zend_fiber_gc_frame(zend_fiber *fiber, uint32_t *n, zend_execute_data *ex)
+{
+	zend_function *func;
+	zend_op_array *op_array;
+	const zend_live_range *range;
+	uint32_t info;
+	uint32_t num_args;
+	uint32_t op_num;
+	uint32_t i;
+	zval tmp;
+	zval *zv;
+
+	func = ex->func;
+	info = ZEND_CALL_INFO(ex);
+	num_args = ZEND_CALL_NUM_ARGS(ex);
+
+	if ((info & ZEND_CALL_RELEASE_THIS) && Z_TYPE(ex->This) == IS_OBJECT) {
+		zend_fiber_gc_add(fiber, n, &ex->This);
+	}
+
+	if (info & ZEND_CALL_CLOSURE) {
+		ZVAL_OBJ(&tmp, ZEND_CLOSURE_OBJECT(func));
+		zend_fiber_gc_add(fiber, n, &tmp);
+	}
+
+#if PHP_VERSION_ID >= 80000
+	if (info & ZEND_CALL_HAS_EXTRA_NAMED_PARAMS) {
+		ZVAL_ARR(&tmp, ex->extra_named_params);
+		zend_fiber_gc_add(fiber, n, &tmp);
+	}
+#endif
+
+	if (!ZEND_USER_CODE(func->type)) {
+		for (i = 1; i <= num_args; i++) {
+			zend_fiber_gc_add(fiber, n, ZEND_CALL_ARG(ex, i));
+		}
+
+		return NULL;
+	}
+
+	op_array = &func->op_array;
+
+	/* Compiled variables live in the symbol table (as INDIRECT slots) once one has been attached. */
+	if (!(info & ZEND_CALL_HAS_SYMBOL_TABLE)) {
+		for (i = 0; i < (uint32_t) op_array->last_var; i++) {
+			zend_fiber_gc_add(fiber, n, ZEND_CALL_VAR_NUM(ex, i));
+		}
+	}
+
+	if ((info & ZEND_CALL_FREE_EXTRA_ARGS) && num_args > op_array->num_args) {
+		zv = ZEND_CALL_VAR_NUM(ex, op_array->last_var + op_array->T);
+
+		for (i = op_array->num_args; i < num_args; i++, zv++) {
+			zend_fiber_gc_add(fiber, n, zv);
+		}
+	}
+
+	/* Temporaries alive at the suspended opline, same ranges as used when unwinding the frame. */
+	if (ex->opline != NULL && op_array->last_live_range > 0) {
+		op_num = (uint32_t) (ex->opline - op_array->opcodes);
+
+		for (i = 0; i < op_array->last_live_range; i++) {
+			range = &op_array->live_range[i];
+
+			if (range->start > op_num) {
+				break;
+			}
+
+			if (op_num < range->end) {
+				switch (range->var & ZEND_LIVE_MASK) {
+					case ZEND_LIVE_TMPVAR:
+					case ZEND_LIVE_LOOP:
+						zend_fiber_gc_add(fiber, n, ZEND_CALL_VAR(ex, range->var & ~ZEND_LIVE_MASK));
+						break;
+				}
+			}
+		}
+	}
+
+	return (info & ZEND_CALL_HAS_SYMBOL_TABLE) ? ex->symbol_table : NULL;
+}
+
+
+#if PHP_VERSION_ID >= 80000
+static HashTable *zend_fiber_object_get_gc(zend_object *object, zval **table, int *n)
+{
+	zend_fiber *fiber = (zend_fiber *) object;
+#else
+static HashTable *zend_fiber_object_get_gc(zval *object, zval **table, int *n)
+{
+	zend_fiber *fiber = (zend_fiber *) Z_OBJ_P(object);
+#endif
+	zend_execute_data *ex;
+	HashTable *symbol_table;
+	HashTable *frame_table;
+	uint32_t count;
+	uint32_t i;
+	zval *zv;
+
+	count = 0;
+	symbol_table = NULL;
+
+	zend_fiber_gc_add(fiber, &count, &fiber->fci.function_name);
+	zend_fiber_gc_add(fiber, &count, &fiber->value);
+	zend_fiber_gc_add(fiber, &count, &fiber->result);
+
+	for (i = 0; i < ZEND_FIBER_LOCAL_SLOTS; i++) {
+		zend_fiber_gc_add(fiber, &count, &fiber->locals.slots[i]);
+	}
+
+	for (i = 0; i < fiber->locals.overflow_size; i++) {
+		zend_fiber_gc_add(fiber, &count, &fiber->locals.overflow[i]);
+	}
+
+	/* Frames of running fibers are referenced from the C stack as well, only suspended ones are scanned. */
+	if (fiber->status == ZEND_FIBER_STATUS_SUSPENDED && fiber != FIBER_G(current_fiber)) {
+		for (ex = fiber->exec; ex != NULL; ex = ex->prev_execute_data) {
+			if (ex->func == NULL) {
+				continue;
+			}
+
+			if (zend_fiber_is_run_func(ex->func)) {
+				break;
+			}
+
+			frame_table = zend_fiber_gc_frame(fiber, &count, ex);
+
+			if (frame_table == NULL) {
+				continue;
+			}
+
+			/* Only one table can be returned, the values of others are added to the buffer. */
+			if (symbol_table != NULL) {
+				ZEND_HASH_FOREACH_VAL(symbol_table, zv) {
+					if (Z_TYPE_P(zv) == IS_INDIRECT) {
+						zv = Z_INDIRECT_P(zv);
+					}
+
+					zend_fiber_gc_add(fiber, &count, zv);
+				} ZEND_HASH_FOREACH_END();
+			}
+
+			symbol_table = frame_table;
+		}
+	}
+
+	*table = fiber->gc_buffer;
+	*n = (int) count;
+
+	return symbol_table;
+}
+
+
+typedef struct _zend_fiber_iterator {
+	zend_object_iterator it;
+
+	/* Number of values the fiber has suspended with so far. */
+	zend_long key;
+} zend_fiber_iterator;
+
+
+/* Runs a fiber driven by foreach until it suspends with a value or finishes, preemptions are not iteration steps and
+ * a parked fiber is resumed by the native poller. */
+static void zend_fiber_iterator_settle(zend_fiber *fiber)
+{
+	while (fiber->status == ZEND_FIBER_STATUS_SUSPENDED && !EG(exception)) {
+		if (fiber->flags & ZEND_FIBER_FLAG_PARKED) {
+			if (FIBER_G(poll_pending) == 0 || (fiber->flags & ZEND_FIBER_FLAG_ORPHANED)) {
+				zend_throw_error(zend_ce_fiber_error, "Cannot iterate fiber, the native event it is waiting for cannot occur");
+				return;
+			}
+
+			if (zend_fiber_poll_dispatch(-1) < 0) {
+				return;
+			}
+		} else if (fiber->flags & ZEND_FIBER_FLAG_PREEMPTED) {
+			if (!zend_fiber_do_resume(fiber, NULL)) {
+				return;
+			}
+		} else {
+			return;
+		}
+	}
+}
+
+
+static void zend_fiber_iterator_resume(zend_fiber *fiber)
+{
+	if (zend_fiber_do_resume(fiber, NULL)) {
+		zend_fiber_iterator_settle(fiber);
+	}
+}
+
+
+static void zend_fiber_iterator_dtor(zend_object_iterator *it)
+{
+	zval_ptr_dtor(&it->data);
+}
+
+
+static int zend_fiber_iterator_valid(zend_object_iterator *it)
+{
+	zend_fiber *fiber;
+
+	fiber = (zend_fiber *) Z_OBJ(it->data);
+
+	/* A fiber that started parked (or was iterated while parked) has no current value yet. */
+	zend_fiber_iterator_settle(fiber);
+
+	return (fiber->status == ZEND_FIBER_STATUS_SUSPENDED && !EG(exception)) ? SUCCESS : FAILURE;
+}
+
+
+static zval *zend_fiber_iterator_get_current_data(zend_object_iterator *it)
+{
+	return &((zend_fiber *) Z_OBJ(it->data))->value;
+}
+
+
+static void zend_fiber_iterator_get_current_key(zend_object_iterator *it, zval *key)
+{
+	ZVAL_LONG(key, ((zend_fiber_iterator *) it)->key);
+}
+
+
+static void zend_fiber_iterator_move_forward(zend_object_iterator *it)
+{
+	zend_fiber *fiber;
+
+	fiber = (zend_fiber *) Z_OBJ(it->data);
+
+	if (fiber->status != ZEND_FIBER_STATUS_SUSPENDED) {
+		return;
+	}
+
+	((zend_fiber_iterator *) it)->key++;
+
+	zend_fiber_iterator_resume(fiber);
+}
+
+
+/* Starts a fiber that has not been started yet, iteration of a suspended fiber continues with its current value. */
+static void zend_fiber_iterator_rewind(zend_object_iterator *it)
+{
+	zend_fiber *fiber;
+
+	fiber = (zend_fiber *) Z_OBJ(it->data);
+
+	if (fiber->status != ZEND_FIBER_STATUS_INIT) {
+		return;
+	}
+
+	if (zend_fiber_do_start(fiber, NULL, 0)) {
+		zend_fiber_iterator_settle(fiber);
+	}
+}
+
+
+static const zend_object_iterator_funcs zend_fiber_iterator_funcs = {
+	zend_fiber_iterator_dtor,
+	zend_fiber_iterator_valid,
+	zend_fiber_iterator_get_current_data,
+	zend_fiber_iterator_get_current_key,
+	zend_fiber_iterator_move_forward,
+	zend_fiber_iterator_rewind,
+	NULL,
+#if PHP_VERSION_ID >= 80000
+	NULL
+#endif
+};
+
+
+static zend_object_iterator *zend_fiber_get_iterator(zend_class_entry *ce, zval *object, int by_ref)
+{
+	zend_fiber_iterator *iterator;
+
+	if (by_ref) {
+		zend_throw_error(zend_ce_fiber_error, "Cannot iterate a fiber by reference");
+		return NULL;
+	}
+
+	if (((zend_fiber *) Z_OBJ_P(object))->status >= ZEND_FIBER_STATUS_RUNNING) {
+		zend_throw_error(zend_ce_fiber_error, "Cannot iterate a fiber that is running or has finished");
+		return NULL;
+	}
+
+	iterator = emalloc(sizeof(zend_fiber_iterator));
+	zend_iterator_init(&iterator->it);
+
+	ZVAL_COPY(&iterator->it.data, object);
+	iterator->it.funcs = &zend_fiber_iterator_funcs;
+	iterator->key = 0;
+
+	return &iterator->it;
+}
+
+
+/* Unwinds a suspended fiber, runs as destructor so that the cycle collector finishes it before freeing anything. */
+static void zend_fiber_object_dtor(zend_object *object)
+{
+	zend_fiber *fiber;
+
+	fiber = (zend_fiber *) object;
+
+	/* Request end with no code running, all suspended fibers are finished in one go. */
+	if (UNEXPECTED(EG(flags) & EG_FLAGS_IN_SHUTDOWN) && EG(current_execute_data) == NULL
+		&& FIBER_G(current_fiber) == NULL && !FIBER_G(shutdown_done)) {
+		zend_fiber_shutdown_fibers();
+	}
+
+	zend_fiber_do_cancel(fiber);
+	zend_fiber_registry_remove(fiber);
+}
+
+
+static void zend_fiber_object_destroy(zend_object *object)
+{
+	zend_fiber *fiber;
+
+	fiber = (zend_fiber *) object;
+
+	ZEND_FIBER_PROBE(destroy, fiber);
+
+	if (UNEXPECTED(zend_fiber_observer_count > 0)) {
+		zend_fiber_observer_destroy(fiber);
+	}
+
+	/* Fibers are destructed before being freed, only a fiber that has never been started still owns its callable. */
+	if (fiber->status == ZEND_FIBER_STATUS_INIT) {
+		zval_ptr_dtor(&fiber->fci.function_name);
+	}
+
+	zval_ptr_dtor(&fiber->result);
+
+	if (fiber->created_file != NULL) {
+		zend_string_release(fiber->created_file);
+	}
+
+	/* Fibers are not destructed after a fatal error, they must not stay registered, neither here nor with the poller. */
+	zend_fiber_poll_abandon(fiber);
+	zend_fiber_registry_remove(fiber);
+	zend_fiber_locals_destroy(&fiber->locals);
+
+	if (fiber->gc_buffer != NULL) {
+		efree(fiber->gc_buffer);
+	}
+
+	zend_fiber_destroy(fiber->context);
+
+	FIBER_G(fiber_count)[fiber->status]--;
+
+	zend_object_std_dtor(&fiber->std);
+}
+
+
+/* {{{ proto Fiber::__construct(callable $callback) */
+ZEND_METHOD(Fiber, __construct)
+{
+	zend_fiber *fiber;
+	zend_fcall_info fci;
+	zend_fcall_info_cache fci_cache;
+
+	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 1, 1)
+		Z_PARAM_FUNC_EX(fci, fci_cache, 1, 0)
+	ZEND_PARSE_PARAMETERS_END();
+
+	zend_fiber_init(fiber, &fci, &fci_cache);
+}
+/* }}} */
+
+
+/* {{{ proto int Fiber::getStatus() */
+ZEND_METHOD(Fiber, getStatus)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	zend_fiber *fiber = (zend_fiber *) Z_OBJ_P(getThis());
+
+	RETURN_LONG(fiber->status);
+}
+/* }}} */
+
+
+/* {{{ proto mixed Fiber::start($params...) */
+ZEND_METHOD(Fiber, start)
+{
+	zend_fiber *fiber;
+	zval *params;
+	uint32_t param_count;
+
+	ZEND_PARSE_PARAMETERS_START(0, -1)
+		Z_PARAM_VARIADIC('+', params, param_count)
+	ZEND_PARSE_PARAMETERS_END();
+
+	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+
+	if (fiber->status != ZEND_FIBER_STATUS_INIT) {
+		zend_throw_error(zend_ce_fiber_error, "Cannot start Fiber that has already been started");
+		return;
+	}
+
+	if (!zend_fiber_do_start(fiber, params, param_count)) {
+		return;
+	}
+
+	if (fiber->status == ZEND_FIBER_STATUS_SUSPENDED) {
+		ZVAL_COPY(return_value, &fiber->value);
+	}
+}
+/* }}} */
+
+
+/* {{{ proto mixed Fiber::resume($value) */
+ZEND_METHOD(Fiber, resume)
+{
+	zend_fiber *fiber;
+	zval *value;
+
+	value = NULL;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 0, 1)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_ZVAL(value);
+	ZEND_PARSE_PARAMETERS_END();
+
+	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+
+	if (fiber->status != ZEND_FIBER_STATUS_SUSPENDED) {
+		zend_throw_error(zend_ce_fiber_error, "Cannot resume running fiber");
+		return;
+	}
+
+	if (fiber->flags & ZEND_FIBER_FLAG_PARKED) {
+		zend_throw_error(zend_ce_fiber_error, "Cannot resume fiber that is waiting for a native event");
+		return;
+	}
+
+	/* Nothing would receive the value, the fiber did not suspend itself. */
+	if ((fiber->flags & ZEND_FIBER_FLAG_PREEMPTED) && value != NULL && Z_TYPE_P(value) != IS_NULL) {
+		zend_throw_error(zend_ce_fiber_error, "Cannot resume preempted fiber with a value");
+		return;
+	}
+
+	if (!zend_fiber_do_resume(fiber, value)) {
+		return;
+	}
+
+	if (fiber->status == ZEND_FIBER_STATUS_SUSPENDED) {
+		ZVAL_COPY(return_value, &fiber->value);
+	}
+}
+/* }}} */
+
+
+/* {{{ proto mixed Fiber::throw(Throwable $exception) */
+ZEND_METHOD(Fiber, throw)
+{
+	zend_fiber *fiber;
+	zval *exception;
+
+	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 1, 1)
+		Z_PARAM_OBJECT_OF_CLASS(exception, zend_ce_throwable)
+	ZEND_PARSE_PARAMETERS_END();
+
+	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+
+	if (fiber->status != ZEND_FIBER_STATUS_SUSPENDED) {
+		zend_throw_error(zend_ce_fiber_error, "Cannot throw exception into running fiber");
+		return;
+	}
+
+	Z_ADDREF_P(exception);
+
+	FIBER_G(error) = exception;
+
+	zend_fiber_set_status(fiber, ZEND_FIBER_STATUS_RUNNING);
+
+	if (!zend_fiber_switch_to(fiber)) {
+		zend_throw_error(NULL, "Failed switching to fiber");
+		return;
+	}
+	
+	if (fiber->status == ZEND_FIBER_STATUS_SUSPENDED) {
+		ZVAL_COPY(return_value, &fiber->value);
+	}
+}
+/* }}} */
+
+
+/* {{{ proto mixed Fiber::getReturn() */
+ZEND_METHOD(Fiber, getReturn)
+{
+	zend_fiber *fiber;
+	
+	ZEND_PARSE_PARAMETERS_NONE();
+	
+	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+	
+	if (fiber->status != ZEND_FIBER_STATUS_FINISHED) {
+		zend_throw_error(zend_ce_fiber_error, "Cannot get return value of unfinished fiber");
+		return;
+	}
+	
+	ZVAL_COPY(return_value, &fiber->result);
+}
+
+
+/* {{{ proto ?Fiber Fiber::getCurrent() */
+ZEND_METHOD(Fiber, getCurrent)
+{
+	zend_fiber *fiber;
+	
+	ZEND_PARSE_PARAMETERS_NONE();
+	
+	fiber = FIBER_G(current_fiber);
+	
+	if (fiber == NULL) {
+		return;
+	}
+	
+	GC_ADDREF(&fiber->std);
+	RETURN_OBJ(&fiber->std);
+}
+/* }}} */
+
+
+/* {{{ proto void Fiber::setAsyncStreams(?bool $enabled) */
+ZEND_METHOD(Fiber, setAsyncStreams)
+{
+	zend_fiber *fiber;
+	zend_bool enabled;
+	zend_bool enabled_null;
+
+	enabled = 0;
+	enabled_null = 1;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_BOOL_EX(enabled, enabled_null, 1, 0)
+	ZEND_PARSE_PARAMETERS_END();
+
+	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+	fiber->flags &= ~(ZEND_FIBER_FLAG_ASYNC_STREAMS | ZEND_FIBER_FLAG_SYNC_STREAMS);
+
+	if (!enabled_null) {
+		fiber->flags |= enabled ? ZEND_FIBER_FLAG_ASYNC_STREAMS : ZEND_FIBER_FLAG_SYNC_STREAMS;
+	}
+}
+/* }}} */
+
+
+/* {{{ proto void Fiber::setPreemptible(bool $preemptible) */
+ZEND_METHOD(Fiber, setPreemptible)
+{
+	zend_fiber *fiber;
+	zend_bool preemptible;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_BOOL(preemptible)
+	ZEND_PARSE_PARAMETERS_END();
+
+	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+
+	if (preemptible) {
+		fiber->flags &= ~ZEND_FIBER_FLAG_NO_PREEMPT;
+	} else {
+		fiber->flags |= ZEND_FIBER_FLAG_NO_PREEMPT;
+	}
+}
+/* }}} */
+
+
+/* {{{ proto bool Fiber::isPreempted() */
+ZEND_METHOD(Fiber, isPreempted)
+{
+	zend_fiber *fiber;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+
+	RETURN_BOOL(fiber->status == ZEND_FIBER_STATUS_SUSPENDED && (fiber->flags & ZEND_FIBER_FLAG_PREEMPTED));
+}
+/* }}} */
+
+
+/* {{{ proto void Fiber::setSlowSliceHandler(?callable $handler) */
+ZEND_METHOD(Fiber, setSlowSliceHandler)
+{
+	zend_fcall_info fci;
+	zend_fcall_info_cache fci_cache;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_FUNC_EX(fci, fci_cache, 1, 0)
+	ZEND_PARSE_PARAMETERS_END();
+
+	zval_ptr_dtor(&FIBER_G(slow_slice_handler));
+
+	if (ZEND_FCI_INITIALIZED(fci)) {
+		ZVAL_COPY(&FIBER_G(slow_slice_handler), &fci.function_name);
+	} else {
+		ZVAL_UNDEF(&FIBER_G(slow_slice_handler));
+	}
+}
+/* }}} */
+
+
+/* {{{ proto void Fiber::setMemoryBudget(int $bytes) */
+ZEND_METHOD(Fiber, setMemoryBudget)
+{
+	zend_fiber *fiber;
+	zend_long bytes;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_LONG(bytes)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (bytes < 0) {
+		zend_throw_error(zend_ce_fiber_error, "Memory budget must not be negative");
+		return;
+	}
+
+	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+
+	fiber->memory_budget = (size_t) bytes;
+	fiber->flags &= ~ZEND_FIBER_FLAG_OVER_BUDGET;
+}
+/* }}} */
+
+
+/* {{{ proto array Fiber::getStats() */
+ZEND_METHOD(Fiber, getStats)
+{
+	zend_fiber *fiber;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+
+	zend_fiber_stats_get(fiber, return_value);
+}
+/* }}} */
+
+
+/* {{{ proto ?array Fiber::getPerfCounters() */
+ZEND_METHOD(Fiber, getPerfCounters)
+{
+	zend_fiber *fiber;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+
+	zend_fiber_perf_get(fiber, return_value);
+}
+/* }}} */
+
+
+/* {{{ proto array Fiber::getTrace(int $options = DEBUG_BACKTRACE_PROVIDE_OBJECT, int $limit = 0) */
+ZEND_METHOD(Fiber, getTrace)
+{
+	zend_fiber *fiber;
+	zend_long options;
+	zend_long limit;
+
+	options = DEBUG_BACKTRACE_PROVIDE_OBJECT;
+	limit = 0;
+
+	ZEND_PARSE_PARAMETERS_START(0, 2)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(options)
+		Z_PARAM_LONG(limit)
+	ZEND_PARSE_PARAMETERS_END();
+
+	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+
+	zend_fiber_registry_get_trace(fiber, options, limit, return_value);
+}
+/* }}} */
+
+
+/* {{{ proto Fiber[] Fiber::getAll() */
+ZEND_METHOD(Fiber, getAll)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
 
-	// Keep a reference to closures or callable objects as long as the fiber lives.
-	Z_TRY_ADDREF(fiber->fci.function_name);
+	zend_fiber_registry_get_all(return_value);
 }
 /* }}} */
 
 
-/* {{{ proto int Fiber::getStatus() */
-ZEND_METHOD(Fiber, getStatus)
+/* {{{ proto string Fiber::dumpAll() */
+ZEND_METHOD(Fiber, dumpAll)
 {
 	ZEND_PARSE_PARAMETERS_NONE();
 
-	zend_fiber *fiber = (zend_fiber *) Z_OBJ_P(getThis());
-
-	RETURN_LONG(fiber->status);
+	RETURN_STR(zend_fiber_registry_dump());
 }
 /* }}} */
 
 
-/* {{{ proto mixed Fiber::start($params...) */
-ZEND_METHOD(Fiber, start)
+/* {{{ proto ?string Fiber::getLeakReport() */
+ZEND_METHOD(Fiber, getLeakReport)
 {
-	zend_fiber *fiber;
-	zval *params;
-	uint32_t param_count;
+	zend_string *leaks;
 
-	ZEND_PARSE_PARAMETERS_START(0, -1)
-		Z_PARAM_VARIADIC('+', params, param_count)
-	ZEND_PARSE_PARAMETERS_END();
+	ZEND_PARSE_PARAMETERS_NONE();
 
-	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+	leaks = zend_fiber_registry_leaks();
 
-	if (fiber->status != ZEND_FIBER_STATUS_INIT) {
-		zend_throw_error(zend_ce_fiber_error, "Cannot start Fiber that has already been started");
-		return;
+	if (leaks == NULL) {
+		RETURN_NULL();
 	}
 
-	fiber->fci.params = params;
-	fiber->fci.param_count = param_count;
-#if PHP_VERSION_ID < 80000
-	fiber->fci.no_separation = 1;
-#endif
+	RETURN_STR(leaks);
+}
+/* }}} */
 
-	fiber->context = zend_fiber_create_context();
 
-	if (fiber->context == NULL) {
-		zend_throw_error(NULL, "Failed to create native fiber context");
-		return;
-	}
+typedef struct _zend_fiber_batch {
+	/* Value given to every fiber, ignored if values is set. */
+	zval *value;
 
-	if (!zend_fiber_create(fiber->context, zend_fiber_run, fiber->stack_size)) {
-		zend_throw_error(NULL, "Failed to create native fiber");
-		return;
-	}
+	/* Values by key of the fibers, missing keys resume with NULL. */
+	HashTable *values;
 
-	fiber->stack = (zend_vm_stack) emalloc(ZEND_FIBER_VM_STACK_SIZE);
-	fiber->stack->top = ZEND_VM_STACK_ELEMENTS(fiber->stack) + 1;
-	fiber->stack->end = (zval *) ((char *) fiber->stack + ZEND_FIBER_VM_STACK_SIZE);
-	fiber->stack->prev = NULL;
+	/* Suspend values and errors by key of the fibers. */
+	HashTable *results;
+	HashTable *errors;
+} zend_fiber_batch;
 
-	if (!zend_fiber_switch_to(fiber)) {
-		zend_throw_error(NULL, "Failed switching to fiber");
-		return;
-	}
-	
-	if (fiber->status == ZEND_FIBER_STATUS_SUSPENDED) {
-		ZVAL_COPY(return_value, &fiber->value);
-	}
+
+/* Moves the pending exception into the errors of the batch. */
+static void zend_fiber_batch_error(zend_fiber_batch *batch, zval *key)
+{
+	zval error;
+
+	ZVAL_OBJ(&error, EG(exception));
+	GC_ADDREF(EG(exception));
+
+	zend_clear_exception();
+
+	array_set_zval_key(batch->errors, key, &error);
+	zval_ptr_dtor(&error);
 }
-/* }}} */
 
 
-/* {{{ proto mixed Fiber::resume($value) */
-ZEND_METHOD(Fiber, resume)
+/* Returns 0 if the batch has to be aborted, the exception is left pending in that case. */
+static zend_bool zend_fiber_batch_resume(zend_fiber_batch *batch, zval *key, zval *entry)
 {
 	zend_fiber *fiber;
 	zval *value;
+	zval result;
 
-	value = NULL;
+	ZVAL_DEREF(entry);
 
-	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 0, 1)
-		Z_PARAM_OPTIONAL
-		Z_PARAM_ZVAL(value);
-	ZEND_PARSE_PARAMETERS_END();
+	if (Z_TYPE_P(entry) != IS_OBJECT || Z_OBJCE_P(entry) != zend_ce_fiber) {
+		zend_type_error("Only Fiber objects can be resumed, %s given", zend_zval_type_name(entry));
+		return 0;
+	}
 
-	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+	fiber = (zend_fiber *) Z_OBJ_P(entry);
+	value = batch->value;
+
+	if (batch->values != NULL) {
+		if (Z_TYPE_P(key) == IS_LONG) {
+			value = zend_hash_index_find(batch->values, Z_LVAL_P(key));
+		} else if (Z_TYPE_P(key) == IS_STRING) {
+			value = zend_symtable_find(batch->values, Z_STR_P(key));
+		} else {
+			value = NULL;
+		}
+	}
+
+	if (value != NULL) {
+		ZVAL_DEREF(value);
+	}
 
 	if (fiber->status != ZEND_FIBER_STATUS_SUSPENDED) {
 		zend_throw_error(zend_ce_fiber_error, "Cannot resume running fiber");
-		return;
-	}
-	
-	Z_TRY_DELREF(fiber->value);
-	
-	if (value == NULL) {
-		ZVAL_NULL(&fiber->value);
+	} else if (fiber->flags & ZEND_FIBER_FLAG_PARKED) {
+		zend_throw_error(zend_ce_fiber_error, "Cannot resume fiber that is waiting for a native event");
+	} else if (fiber->flags & ZEND_FIBER_FLAG_PREEMPTED) {
+		/* The shared value of resumeAll() is meant for fibers waiting in Fiber::suspend(), a value of resumeEach()
+		 * was addressed to this fiber and is reported like Fiber::resume() would. */
+		if (batch->values != NULL && value != NULL && Z_TYPE_P(value) != IS_NULL) {
+			zend_throw_error(zend_ce_fiber_error, "Cannot resume preempted fiber with a value");
+		} else {
+			zend_fiber_do_resume(fiber, NULL);
+		}
 	} else {
-		ZVAL_COPY(&fiber->value, value);
+		zend_fiber_do_resume(fiber, value);
 	}
 
-	fiber->status = ZEND_FIBER_STATUS_RUNNING;
-	
-	if (!zend_fiber_switch_to(fiber)) {
-		zend_throw_error(NULL, "Failed switching to fiber");
-		return;
+	if (UNEXPECTED(EG(exception))) {
+		zend_fiber_batch_error(batch, key);
+		return 1;
 	}
-	
+
+	/* Preempted again, there is no suspended value that could be told apart from Fiber::suspend(null). */
+	if (fiber->status == ZEND_FIBER_STATUS_SUSPENDED && (fiber->flags & ZEND_FIBER_FLAG_PREEMPTED)) {
+		return 1;
+	}
+
 	if (fiber->status == ZEND_FIBER_STATUS_SUSPENDED) {
-		ZVAL_COPY(return_value, &fiber->value);
+		ZVAL_COPY(&result, &fiber->value);
+	} else {
+		ZVAL_NULL(&result);
 	}
+
+	array_set_zval_key(batch->results, key, &result);
+	zval_ptr_dtor(&result);
+
+	return 1;
 }
-/* }}} */
 
 
-/* {{{ proto mixed Fiber::throw(Throwable $exception) */
-ZEND_METHOD(Fiber, throw)
+static void zend_fiber_batch_run(zend_fiber_batch *batch, zval *fibers, zval *errors, zval *return_value)
 {
-	zend_fiber *fiber;
-	zval *exception;
+	zend_object_iterator *iter;
+	zend_class_entry *ce;
+	zend_string *str;
+	zend_ulong index;
+	zval *entry;
+	zval key;
+	zval tmp;
+
+	if (Z_TYPE_P(fibers) != IS_ARRAY && (Z_TYPE_P(fibers) != IS_OBJECT || !instanceof_function(Z_OBJCE_P(fibers), zend_ce_traversable))) {
+		zend_type_error("Fibers must be an array or Traversable, %s given", zend_zval_type_name(fibers));
+		return;
+	}
 
-	ZEND_PARSE_PARAMETERS_START_EX(ZEND_PARSE_PARAMS_THROW, 1, 1)
-		Z_PARAM_OBJECT_OF_CLASS(exception, zend_ce_throwable)
-	ZEND_PARSE_PARAMETERS_END();
+	batch->results = zend_new_array(0);
+	batch->errors = zend_new_array(0);
+
+	if (Z_TYPE_P(fibers) == IS_ARRAY) {
+		ZEND_HASH_FOREACH_KEY_VAL(Z_ARRVAL_P(fibers), index, str, entry) {
+			if (str != NULL) {
+				ZVAL_STR(&key, str);
+			} else {
+				ZVAL_LONG(&key, (zend_long) index);
+			}
+
+			if (!zend_fiber_batch_resume(batch, &key, entry)) {
+				break;
+			}
+		} ZEND_HASH_FOREACH_END();
+	} else {
+		ce = Z_OBJCE_P(fibers);
+		iter = ce->get_iterator(ce, fibers, 0);
 
-	fiber = (zend_fiber *) Z_OBJ_P(getThis());
+		if (iter != NULL && !EG(exception)) {
+			iter->index = 0;
 
-	if (fiber->status != ZEND_FIBER_STATUS_SUSPENDED) {
-		zend_throw_error(zend_ce_fiber_error, "Cannot throw exception into running fiber");
-		return;
-	}
+			if (iter->funcs->rewind != NULL) {
+				iter->funcs->rewind(iter);
+			}
 
-	Z_ADDREF_P(exception);
+			while (!EG(exception) && iter->funcs->valid(iter) == SUCCESS) {
+				entry = iter->funcs->get_current_data(iter);
 
-	FIBER_G(error) = exception;
+				if (EG(exception)) {
+					break;
+				}
 
-	fiber->status = ZEND_FIBER_STATUS_RUNNING;
+				if (iter->funcs->get_current_key != NULL) {
+					iter->funcs->get_current_key(iter, &key);
 
-	if (!zend_fiber_switch_to(fiber)) {
-		zend_throw_error(NULL, "Failed switching to fiber");
+					if (EG(exception)) {
+						zval_ptr_dtor(&key);
+						break;
+					}
+				} else {
+					ZVAL_LONG(&key, (zend_long) iter->index);
+				}
+
+				if (!zend_fiber_batch_resume(batch, &key, entry)) {
+					zval_ptr_dtor(&key);
+					break;
+				}
+
+				zval_ptr_dtor(&key);
+
+				iter->index++;
+				iter->funcs->move_forward(iter);
+			}
+		}
+
+		if (iter != NULL) {
+			zend_iterator_dtor(iter);
+		}
+	}
+
+	if (UNEXPECTED(EG(exception))) {
+		zend_array_destroy(batch->results);
+		zend_array_destroy(batch->errors);
 		return;
 	}
-	
-	if (fiber->status == ZEND_FIBER_STATUS_SUSPENDED) {
-		ZVAL_COPY(return_value, &fiber->value);
+
+	if (errors != NULL) {
+#if PHP_VERSION_ID >= 70400
+		ZEND_TRY_ASSIGN_REF_ARR(errors, batch->errors);
+#else
+		ZVAL_DEREF(errors);
+		zval_ptr_dtor(errors);
+		ZVAL_ARR(errors, batch->errors);
+#endif
+	} else if (zend_hash_num_elements(batch->errors) > 0) {
+		/* Without an errors array the first error is thrown once all fibers have been resumed. */
+		ZEND_HASH_FOREACH_VAL(batch->errors, entry) {
+			ZVAL_COPY(&tmp, entry);
+			break;
+		} ZEND_HASH_FOREACH_END();
+
+		zend_array_destroy(batch->results);
+		zend_array_destroy(batch->errors);
+
+		zend_throw_exception_object(&tmp);
+		return;
+	} else {
+		zend_array_destroy(batch->errors);
 	}
+
+	RETURN_ARR(batch->results);
 }
-/* }}} */
 
 
-/* {{{ proto mixed Fiber::getReturn() */
-ZEND_METHOD(Fiber, getReturn)
+/* {{{ proto array Fiber::resumeAll(iterable $fibers, mixed $value = null, ?array &$errors = null) */
+ZEND_METHOD(Fiber, resumeAll)
 {
-	zend_fiber *fiber;
-	
-	ZEND_PARSE_PARAMETERS_NONE();
-	
-	fiber = (zend_fiber *) Z_OBJ_P(getThis());
-	
-	if (fiber->status != ZEND_FIBER_STATUS_FINISHED) {
-		zend_throw_error(zend_ce_fiber_error, "Cannot get return value of unfinished fiber");
-		return;
-	}
-	
-	ZVAL_COPY(return_value, &fiber->result);
+	zend_fiber_batch batch;
+	zval *fibers;
+	zval *value;
+	zval *errors;
+
+	value = NULL;
+	errors = NULL;
+
+	ZEND_PARSE_PARAMETERS_START(1, 3)
+		Z_PARAM_ZVAL(fibers)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_ZVAL(value)
+		Z_PARAM_ZVAL(errors)
+	ZEND_PARSE_PARAMETERS_END();
+
+	batch.value = value;
+	batch.values = NULL;
+
+	zend_fiber_batch_run(&batch, fibers, errors, return_value);
 }
+/* }}} */
 
 
-/* {{{ proto ?Fiber Fiber::getCurrent() */
-ZEND_METHOD(Fiber, getCurrent)
+/* {{{ proto array Fiber::resumeEach(iterable $fibers, array $values, ?array &$errors = null) */
+ZEND_METHOD(Fiber, resumeEach)
 {
-	zend_fiber *fiber;
-	
-	ZEND_PARSE_PARAMETERS_NONE();
-	
-	fiber = FIBER_G(current_fiber);
-	
-	if (fiber == NULL) {
-		return;
-	}
-	
-	GC_ADDREF(&fiber->std);
-	RETURN_OBJ(&fiber->std);
+	zend_fiber_batch batch;
+	zval *fibers;
+	HashTable *values;
+	zval *errors;
+
+	errors = NULL;
+
+	ZEND_PARSE_PARAMETERS_START(2, 3)
+		Z_PARAM_ZVAL(fibers)
+		Z_PARAM_ARRAY_HT(values)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_ZVAL(errors)
+	ZEND_PARSE_PARAMETERS_END();
+
+	batch.value = NULL;
+	batch.values = values;
+
+	zend_fiber_batch_run(&batch, fibers, errors, return_value);
 }
 /* }}} */
 
@@ -399,10 +1878,7 @@ ZEND_METHOD(Fiber, getCurrent)
 ZEND_METHOD(Fiber, suspend)
 {
 	zend_fiber *fiber;
-	zend_execute_data *exec;
-	size_t stack_page_size;
 	zval *value;
-	zval *error;
 
 	fiber = FIBER_G(current_fiber);
 
@@ -423,40 +1899,7 @@ ZEND_METHOD(Fiber, suspend)
 		Z_PARAM_ZVAL(value);
 	ZEND_PARSE_PARAMETERS_END();
 
-	Z_TRY_DELREF(fiber->value);
-	
-	if (value == NULL) {
-		ZVAL_NULL(&fiber->value);
-	} else {
-		ZVAL_COPY(&fiber->value, value);
-	}
-
-	fiber->status = ZEND_FIBER_STATUS_SUSPENDED;
-
-	ZEND_FIBER_BACKUP_EG(fiber->stack, stack_page_size, fiber->exec);
-
-	zend_fiber_suspend(fiber->context);
-
-	ZEND_FIBER_RESTORE_EG(fiber->stack, stack_page_size, fiber->exec);
-
-	if (fiber->status == ZEND_FIBER_STATUS_DEAD) {
-		zend_throw_error(NULL, "Fiber has been destroyed");
-		return;
-	}
-
-	error = FIBER_G(error);
-
-	if (error == NULL) {
-		ZVAL_COPY(return_value, &fiber->value);
-		return;
-	}
-	
-	FIBER_G(error) = NULL;
-	exec = EG(current_execute_data);
-
-	exec->opline--;
-	zend_throw_exception_object(error);
-	exec->opline++;
+	zend_fiber_do_suspend(fiber, value, return_value);
 }
 /* }}} */
 
@@ -500,6 +1943,57 @@ ZEND_END_ARG_INFO()
 ZEND_BEGIN_ARG_WITH_RETURN_OBJ_INFO_EX(arginfo_fiber_getCurrent, 0, 0, Fiber, 1)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_setAsyncStreams, 0, 0, 1)
+	ZEND_ARG_TYPE_INFO(0, enabled, _IS_BOOL, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_setPreemptible, 0, 0, 1)
+	ZEND_ARG_TYPE_INFO(0, preemptible, _IS_BOOL, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_isPreempted, 0, 0, _IS_BOOL, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_setSlowSliceHandler, 0, 0, 1)
+	ZEND_ARG_CALLABLE_INFO(0, handler, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_setMemoryBudget, 0, 0, 1)
+	ZEND_ARG_TYPE_INFO(0, bytes, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_getStats, 0, 0, IS_ARRAY, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_getPerfCounters, 0, 0, IS_ARRAY, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_getTrace, 0, 0, IS_ARRAY, 0)
+	ZEND_ARG_TYPE_INFO(0, options, IS_LONG, 0)
+	ZEND_ARG_TYPE_INFO(0, limit, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_getAll, 0, 0, IS_ARRAY, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_dumpAll, 0, 0, IS_STRING, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_getLeakReport, 0, 0, IS_STRING, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_resumeAll, 0, 1, IS_ARRAY, 0)
+	ZEND_ARG_TYPE_INFO(0, fibers, IS_ITERABLE, 0)
+	ZEND_ARG_INFO(0, value)
+	ZEND_ARG_INFO(1, errors)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_resumeEach, 0, 2, IS_ARRAY, 0)
+	ZEND_ARG_TYPE_INFO(0, fibers, IS_ITERABLE, 0)
+	ZEND_ARG_ARRAY_INFO(0, values, 0)
+	ZEND_ARG_INFO(1, errors)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_suspend, 0, 0, 0)
 	ZEND_ARG_INFO(0, value)
 ZEND_END_ARG_INFO()
@@ -511,7 +2005,20 @@ static const zend_function_entry fiber_methods[] = {
 	ZEND_ME(Fiber, resume, arginfo_fiber_resume, ZEND_ACC_PUBLIC)
 	ZEND_ME(Fiber, throw, arginfo_fiber_throw, ZEND_ACC_PUBLIC)
 	ZEND_ME(Fiber, getReturn, arginfo_fiber_void, ZEND_ACC_PUBLIC)
+	ZEND_ME(Fiber, setAsyncStreams, arginfo_fiber_setAsyncStreams, ZEND_ACC_PUBLIC)
+	ZEND_ME(Fiber, setPreemptible, arginfo_fiber_setPreemptible, ZEND_ACC_PUBLIC)
+	ZEND_ME(Fiber, isPreempted, arginfo_fiber_isPreempted, ZEND_ACC_PUBLIC)
+	ZEND_ME(Fiber, setMemoryBudget, arginfo_fiber_setMemoryBudget, ZEND_ACC_PUBLIC)
+	ZEND_ME(Fiber, getStats, arginfo_fiber_getStats, ZEND_ACC_PUBLIC)
+	ZEND_ME(Fiber, getPerfCounters, arginfo_fiber_getPerfCounters, ZEND_ACC_PUBLIC)
+	ZEND_ME(Fiber, getTrace, arginfo_fiber_getTrace, ZEND_ACC_PUBLIC)
 	ZEND_ME(Fiber, getCurrent, arginfo_fiber_getCurrent, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(Fiber, setSlowSliceHandler, arginfo_fiber_setSlowSliceHandler, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(Fiber, getAll, arginfo_fiber_getAll, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(Fiber, dumpAll, arginfo_fiber_dumpAll, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(Fiber, getLeakReport, arginfo_fiber_getLeakReport, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(Fiber, resumeAll, arginfo_fiber_resumeAll, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(Fiber, resumeEach, arginfo_fiber_resumeEach, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
 	ZEND_ME(Fiber, suspend, arginfo_fiber_suspend, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
 	ZEND_ME(Fiber, __wakeup, arginfo_fiber_void, ZEND_ACC_PUBLIC)
 	ZEND_FE_END
@@ -530,43 +2037,26 @@ static const zend_function_entry fiber_error_methods[] = {
 void zend_fiber_ce_register()
 {
 	zend_class_entry ce;
-	zend_uchar opcode = ZEND_VM_LAST_OPCODE + 1;
-
-	/* Create a new user opcode to run fiber. */
-	while (1) {
-		if (opcode == 255) {
-			return;
-		} else if (zend_get_user_opcode_handler(opcode) == NULL) {
-			break;
-		}
-		opcode++;
-	}
-
-	zend_set_user_opcode_handler(opcode, fiber_run_opcode_handler);
-
-	ZEND_SECURE_ZERO(fiber_run_op, sizeof(fiber_run_op));
-	fiber_run_op[0].opcode = opcode;
-	zend_vm_set_opcode_handler_ex(fiber_run_op, 0, 0, 0);
-	fiber_run_op[1].opcode = opcode;
-	zend_vm_set_opcode_handler_ex(fiber_run_op + 1, 0, 0, 0);
 
+	/* Opcache disables the JIT if any user opcode handler is installed, the runner must not need one (the catch handler
+	 * for unwind markers is only installed on versions without a JIT). */
 	ZEND_SECURE_ZERO(&fiber_run_func, sizeof(fiber_run_func));
-	fiber_run_func.type = ZEND_USER_FUNCTION;
+	fiber_run_func.type = ZEND_INTERNAL_FUNCTION;
 	fiber_run_func.function_name = zend_string_init("Fiber::run", sizeof("Fiber::run") - 1, 1);
-	fiber_run_func.filename = ZSTR_EMPTY_ALLOC();
-	fiber_run_func.opcodes = fiber_run_op;
-	fiber_run_func.last_try_catch = 1;
-	fiber_run_func.try_catch_array = &fiber_terminate_try_catch_array;
 
 	INIT_CLASS_ENTRY(ce, "Fiber", fiber_methods);
 	zend_ce_fiber = zend_register_internal_class(&ce);
 	zend_ce_fiber->ce_flags |= ZEND_ACC_FINAL;
 	zend_ce_fiber->create_object = zend_fiber_object_create;
+	zend_ce_fiber->get_iterator = zend_fiber_get_iterator;
 	zend_ce_fiber->serialize = zend_class_serialize_deny;
 	zend_ce_fiber->unserialize = zend_class_unserialize_deny;
+	zend_class_implements(zend_ce_fiber, 1, zend_ce_traversable);
 
 	memcpy(&zend_fiber_handlers, &std_object_handlers, sizeof(zend_object_handlers));
+	zend_fiber_handlers.dtor_obj = zend_fiber_object_dtor;
 	zend_fiber_handlers.free_obj = zend_fiber_object_destroy;
+	zend_fiber_handlers.get_gc = zend_fiber_object_get_gc;
 	zend_fiber_handlers.clone_obj = NULL;
 
 	REGISTER_FIBER_CLASS_CONST_LONG("STATUS_INIT", (zend_long)ZEND_FIBER_STATUS_INIT);
@@ -579,10 +2069,24 @@ void zend_fiber_ce_register()
 	zend_ce_fiber_error = zend_register_internal_class_ex(&ce, zend_ce_error);
 	zend_ce_fiber_error->ce_flags |= ZEND_ACC_FINAL;
 	zend_ce_fiber_error->create_object = zend_ce_error->create_object;
+
+	memcpy(&zend_fiber_unwind_handlers, &std_object_handlers, sizeof(zend_object_handlers));
+	zend_fiber_unwind_handlers.clone_obj = NULL;
+
+#if PHP_VERSION_ID < 80000
+	zend_fiber_prev_catch_handler = zend_get_user_opcode_handler(ZEND_CATCH);
+	zend_set_user_opcode_handler(ZEND_CATCH, zend_fiber_catch_handler);
+#endif
 }
 
 void zend_fiber_ce_unregister()
 {
+#if PHP_VERSION_ID < 80000
+	zend_set_user_opcode_handler(ZEND_CATCH, zend_fiber_prev_catch_handler);
+	zend_fiber_prev_catch_handler = NULL;
+#endif
+
+
 	zend_string_free(fiber_run_func.function_name);
 	fiber_run_func.function_name = NULL;
 }
@@ -595,4 +2099,11 @@ void zend_fiber_shutdown()
 	FIBER_G(root) = NULL;
 
 	zend_fiber_destroy(root);
+
+	if (FIBER_G(unwind) != NULL) {
+		OBJ_RELEASE(FIBER_G(unwind));
+		FIBER_G(unwind) = NULL;
+	}
+
+	FIBER_G(unwinding) = 0;
 }
@@ -0,0 +1,617 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "zend_exceptions.h"
+#include "ext/standard/file.h"
+#include "main/fopen_wrappers.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_thread_pool.h"
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+typedef struct _zend_fiber_blocking_job zend_fiber_blocking_job;
+typedef struct _zend_fiber_blocking_op zend_fiber_blocking_op;
+
+struct _zend_fiber_blocking_op {
+	const char *name;
+	uint32_t min_args;
+	uint32_t max_args;
+
+	/* Copies arguments into the job as plain C data, runs on the PHP thread. */
+	zend_bool (* prepare)(zend_fiber_blocking_job *job, zval *args, uint32_t count);
+
+	/* Performs the blocking call, runs on a worker thread. */
+	void (* run)(zend_fiber_job *job);
+
+	/* Builds the return value, runs on the PHP thread once the fiber has been resumed. */
+	void (* complete)(zend_fiber_blocking_job *job, zval *return_value);
+};
+
+struct _zend_fiber_blocking_job {
+	zend_fiber_job job;
+
+	const zend_fiber_blocking_op *op;
+
+	char *path;
+	char *service;
+	char *data;
+	size_t length;
+
+	zend_long offset;
+	zend_long limit;
+	zend_long flags;
+
+	int fd;
+	int error;
+	ssize_t result;
+
+	struct stat st;
+	struct addrinfo *addresses;
+};
+
+static zend_class_entry *zend_ce_fiber_blocking;
+
+
+static void zend_fiber_blocking_job_free(zend_fiber_job *job)
+{
+	zend_fiber_blocking_job *blocking;
+
+	blocking = (zend_fiber_blocking_job *) job;
+
+	if (blocking->path != NULL) {
+		pefree(blocking->path, 1);
+	}
+
+	if (blocking->service != NULL) {
+		pefree(blocking->service, 1);
+	}
+
+	if (blocking->data != NULL) {
+		pefree(blocking->data, 1);
+	}
+
+	if (blocking->addresses != NULL) {
+		freeaddrinfo(blocking->addresses);
+	}
+
+	if (blocking->fd >= 0) {
+		close(blocking->fd);
+	}
+
+	pefree(blocking, 1);
+}
+
+
+static zend_bool zend_fiber_blocking_arg_string(zval *arg, uint32_t num, char **dest, size_t *length)
+{
+	if (Z_TYPE_P(arg) != IS_STRING) {
+		zend_type_error("Fiber\\Blocking::run(): Argument #%u must be of type string, %s given", num, zend_zval_type_name(arg));
+		return 0;
+	}
+
+	*dest = pestrndup(Z_STRVAL_P(arg), Z_STRLEN_P(arg), 1);
+
+	if (length != NULL) {
+		*length = Z_STRLEN_P(arg);
+	}
+
+	return 1;
+}
+
+
+/* Resolves the path against the current working directory and applies open_basedir on the PHP thread. */
+static zend_bool zend_fiber_blocking_arg_path(zval *arg, uint32_t num, char **dest)
+{
+	char *resolved;
+
+	if (Z_TYPE_P(arg) != IS_STRING) {
+		zend_type_error("Fiber\\Blocking::run(): Argument #%u must be of type string, %s given", num, zend_zval_type_name(arg));
+		return 0;
+	}
+
+	if (CHECK_NULL_PATH(Z_STRVAL_P(arg), Z_STRLEN_P(arg))) {
+		zend_throw_error(NULL, "Fiber\\Blocking::run(): Argument #%u must not contain any null bytes", num);
+		return 0;
+	}
+
+	resolved = expand_filepath(Z_STRVAL_P(arg), NULL);
+
+	if (resolved == NULL) {
+		php_error_docref(NULL, E_WARNING, "Unable to resolve path '%s'", Z_STRVAL_P(arg));
+		return 0;
+	}
+
+	if (php_check_open_basedir(resolved)) {
+		efree(resolved);
+		return 0;
+	}
+
+	*dest = pestrdup(resolved, 1);
+	efree(resolved);
+
+	return 1;
+}
+
+
+static zend_bool zend_fiber_blocking_arg_fd(zval *arg, uint32_t num, int *fd)
+{
+	php_stream *stream;
+	php_socket_t handle;
+
+	if (Z_TYPE_P(arg) != IS_RESOURCE) {
+		zend_type_error("Fiber\\Blocking::run(): Argument #%u must be of type resource, %s given", num, zend_zval_type_name(arg));
+		return 0;
+	}
+
+	php_stream_from_zval_no_verify(stream, arg);
+
+	if (stream == NULL) {
+		zend_type_error("Fiber\\Blocking::run(): Argument #%u must be a valid stream resource", num);
+		return 0;
+	}
+
+	php_stream_flush(stream);
+
+	if (php_stream_cast(stream, PHP_STREAM_AS_FD, (void *) &handle, REPORT_ERRORS) == FAILURE) {
+		return 0;
+	}
+
+	/* The stream may be closed while the worker is still using the descriptor. */
+	*fd = dup((int) handle);
+
+	if (*fd < 0) {
+		php_error_docref(NULL, E_WARNING, "Unable to duplicate file descriptor: %s", strerror(errno));
+		return 0;
+	}
+
+	return 1;
+}
+
+
+static void zend_fiber_blocking_complete_bool(zend_fiber_blocking_job *job, zval *return_value)
+{
+	if (job->error) {
+		php_error_docref(NULL, E_WARNING, "%s(): %s", job->op->name, strerror(job->error));
+		RETURN_FALSE;
+	}
+
+	RETURN_TRUE;
+}
+
+
+/* {{{ getaddrinfo(string $host, ?string $service = null): array */
+static zend_bool zend_fiber_blocking_prepare_getaddrinfo(zend_fiber_blocking_job *job, zval *args, uint32_t count)
+{
+	if (!zend_fiber_blocking_arg_string(&args[0], 2, &job->path, NULL)) {
+		return 0;
+	}
+
+	if (count > 1 && Z_TYPE(args[1]) != IS_NULL) {
+		return zend_fiber_blocking_arg_string(&args[1], 3, &job->service, NULL);
+	}
+
+	return 1;
+}
+
+static void zend_fiber_blocking_run_getaddrinfo(zend_fiber_job *job)
+{
+	zend_fiber_blocking_job *blocking;
+	struct addrinfo hints;
+
+	blocking = (zend_fiber_blocking_job *) job;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	blocking->error = getaddrinfo(blocking->path, blocking->service, &hints, &blocking->addresses);
+}
+
+static void zend_fiber_blocking_complete_getaddrinfo(zend_fiber_blocking_job *job, zval *return_value)
+{
+	struct addrinfo *info;
+	char address[INET6_ADDRSTRLEN];
+	const void *source;
+
+	if (job->error) {
+		php_error_docref(NULL, E_WARNING, "getaddrinfo(%s): %s", job->path, gai_strerror(job->error));
+		RETURN_FALSE;
+	}
+
+	array_init(return_value);
+
+	for (info = job->addresses; info != NULL; info = info->ai_next) {
+		if (info->ai_family == AF_INET) {
+			source = &((struct sockaddr_in *) info->ai_addr)->sin_addr;
+		} else if (info->ai_family == AF_INET6) {
+			source = &((struct sockaddr_in6 *) info->ai_addr)->sin6_addr;
+		} else {
+			continue;
+		}
+
+		if (inet_ntop(info->ai_family, source, address, sizeof(address)) != NULL) {
+			add_next_index_string(return_value, address);
+		}
+	}
+}
+/* }}} */
+
+
+/* {{{ read(string $path, int $offset = 0, int $length = -1): string */
+static zend_bool zend_fiber_blocking_prepare_read(zend_fiber_blocking_job *job, zval *args, uint32_t count)
+{
+	job->offset = (count > 1) ? zval_get_long(&args[1]) : 0;
+	job->limit = (count > 2) ? zval_get_long(&args[2]) : -1;
+
+	if (job->offset < 0) {
+		zend_throw_error(NULL, "Fiber\\Blocking::run(): Argument #3 must be greater than or equal to 0");
+		return 0;
+	}
+
+	return zend_fiber_blocking_arg_path(&args[0], 2, &job->path);
+}
+
+static void zend_fiber_blocking_run_read(zend_fiber_job *job)
+{
+	zend_fiber_blocking_job *blocking;
+	size_t capacity;
+	ssize_t count;
+	int fd;
+
+	blocking = (zend_fiber_blocking_job *) job;
+	fd = open(blocking->path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		blocking->error = errno;
+		return;
+	}
+
+	if (fstat(fd, &blocking->st) == 0 && blocking->st.st_size > blocking->offset) {
+		capacity = (size_t) (blocking->st.st_size - blocking->offset);
+	} else {
+		capacity = 8192;
+	}
+
+	if (blocking->limit >= 0 && (size_t) blocking->limit < capacity) {
+		capacity = (size_t) blocking->limit;
+	}
+
+	blocking->data = pemalloc(capacity + 1, 1);
+	blocking->length = 0;
+
+	while (blocking->limit < 0 || blocking->length < (size_t) blocking->limit) {
+		if (blocking->length == capacity) {
+			if (blocking->limit >= 0) {
+				break;
+			}
+
+			capacity *= 2;
+			blocking->data = perealloc(blocking->data, capacity + 1, 1);
+		}
+
+		count = pread(fd, blocking->data + blocking->length, capacity - blocking->length, blocking->offset + blocking->length);
+
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			blocking->error = errno;
+			break;
+		}
+
+		if (count == 0) {
+			break;
+		}
+
+		blocking->length += count;
+	}
+
+	close(fd);
+}
+
+static void zend_fiber_blocking_complete_read(zend_fiber_blocking_job *job, zval *return_value)
+{
+	if (job->error) {
+		php_error_docref(NULL, E_WARNING, "read(%s): %s", job->path, strerror(job->error));
+		RETURN_FALSE;
+	}
+
+	RETURN_STRINGL(job->data, job->length);
+}
+/* }}} */
+
+
+/* {{{ write(string $path, string $data, int $flags = 0): int */
+static zend_bool zend_fiber_blocking_prepare_write(zend_fiber_blocking_job *job, zval *args, uint32_t count)
+{
+	job->flags = (count > 2) ? zval_get_long(&args[2]) : 0;
+
+	if (!zend_fiber_blocking_arg_string(&args[1], 3, &job->data, &job->length)) {
+		return 0;
+	}
+
+	return zend_fiber_blocking_arg_path(&args[0], 2, &job->path);
+}
+
+static void zend_fiber_blocking_run_write(zend_fiber_job *job)
+{
+	zend_fiber_blocking_job *blocking;
+	ssize_t count;
+	size_t written;
+	int fd;
+
+	blocking = (zend_fiber_blocking_job *) job;
+	fd = open(blocking->path, O_WRONLY | O_CREAT | O_CLOEXEC | ((blocking->flags & PHP_FILE_APPEND) ? O_APPEND : O_TRUNC), 0666);
+
+	if (fd < 0) {
+		blocking->error = errno;
+		return;
+	}
+
+	written = 0;
+
+	while (written < blocking->length) {
+		count = write(fd, blocking->data + written, blocking->length - written);
+
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			blocking->error = errno;
+			break;
+		}
+
+		written += count;
+	}
+
+	blocking->result = (ssize_t) written;
+
+	close(fd);
+}
+
+static void zend_fiber_blocking_complete_write(zend_fiber_blocking_job *job, zval *return_value)
+{
+	if (job->error) {
+		php_error_docref(NULL, E_WARNING, "write(%s): %s", job->path, strerror(job->error));
+		RETURN_FALSE;
+	}
+
+	RETURN_LONG(job->result);
+}
+/* }}} */
+
+
+/* {{{ stat(string $path): array */
+static zend_bool zend_fiber_blocking_prepare_stat(zend_fiber_blocking_job *job, zval *args, uint32_t count)
+{
+	return zend_fiber_blocking_arg_path(&args[0], 2, &job->path);
+}
+
+static void zend_fiber_blocking_run_stat(zend_fiber_job *job)
+{
+	zend_fiber_blocking_job *blocking;
+
+	blocking = (zend_fiber_blocking_job *) job;
+
+	if (stat(blocking->path, &blocking->st) < 0) {
+		blocking->error = errno;
+	}
+}
+
+static void zend_fiber_blocking_complete_stat(zend_fiber_blocking_job *job, zval *return_value)
+{
+	if (job->error) {
+		php_error_docref(NULL, E_WARNING, "stat(%s): %s", job->path, strerror(job->error));
+		RETURN_FALSE;
+	}
+
+	array_init(return_value);
+
+	add_assoc_long(return_value, "dev", job->st.st_dev);
+	add_assoc_long(return_value, "ino", job->st.st_ino);
+	add_assoc_long(return_value, "mode", job->st.st_mode);
+	add_assoc_long(return_value, "nlink", job->st.st_nlink);
+	add_assoc_long(return_value, "uid", job->st.st_uid);
+	add_assoc_long(return_value, "gid", job->st.st_gid);
+	add_assoc_long(return_value, "rdev", job->st.st_rdev);
+	add_assoc_long(return_value, "size", job->st.st_size);
+	add_assoc_long(return_value, "atime", job->st.st_atime);
+	add_assoc_long(return_value, "mtime", job->st.st_mtime);
+	add_assoc_long(return_value, "ctime", job->st.st_ctime);
+	add_assoc_long(return_value, "blksize", job->st.st_blksize);
+	add_assoc_long(return_value, "blocks", job->st.st_blocks);
+}
+/* }}} */
+
+
+/* {{{ fsync(string|resource $file): bool */
+static zend_bool zend_fiber_blocking_prepare_fsync(zend_fiber_blocking_job *job, zval *args, uint32_t count)
+{
+	if (Z_TYPE(args[0]) == IS_RESOURCE) {
+		return zend_fiber_blocking_arg_fd(&args[0], 2, &job->fd);
+	}
+
+	return zend_fiber_blocking_arg_path(&args[0], 2, &job->path);
+}
+
+static void zend_fiber_blocking_run_fsync(zend_fiber_job *job)
+{
+	zend_fiber_blocking_job *blocking;
+	int fd;
+
+	blocking = (zend_fiber_blocking_job *) job;
+	fd = blocking->fd;
+
+	if (fd < 0) {
+		fd = open(blocking->path, O_RDONLY | O_CLOEXEC);
+
+		if (fd < 0) {
+			blocking->error = errno;
+			return;
+		}
+	}
+
+	if (fsync(fd) < 0) {
+		blocking->error = errno;
+	}
+
+	if (fd != blocking->fd) {
+		close(fd);
+	}
+}
+/* }}} */
+
+
+/* {{{ flock(resource $stream, int $operation): bool */
+static zend_bool zend_fiber_blocking_prepare_flock(zend_fiber_blocking_job *job, zval *args, uint32_t count)
+{
+	static const int operations[] = { LOCK_SH, LOCK_EX, LOCK_UN };
+	zend_long operation;
+
+	operation = zval_get_long(&args[1]);
+
+	if ((operation & 3) < 1 || (operation & 3) > 3) {
+		zend_throw_error(NULL, "Fiber\\Blocking::run(): Argument #3 must be one of LOCK_SH, LOCK_EX, or LOCK_UN");
+		return 0;
+	}
+
+	job->flags = operations[(operation & 3) - 1] | ((operation & 4) ? LOCK_NB : 0);
+
+	return zend_fiber_blocking_arg_fd(&args[0], 2, &job->fd);
+}
+
+static void zend_fiber_blocking_run_flock(zend_fiber_job *job)
+{
+	zend_fiber_blocking_job *blocking;
+
+	blocking = (zend_fiber_blocking_job *) job;
+
+	while (flock(blocking->fd, (int) blocking->flags) < 0) {
+		if (errno != EINTR) {
+			blocking->error = errno;
+			break;
+		}
+	}
+}
+/* }}} */
+
+
+static const zend_fiber_blocking_op zend_fiber_blocking_ops[] = {
+	{ "getaddrinfo", 1, 2, zend_fiber_blocking_prepare_getaddrinfo, zend_fiber_blocking_run_getaddrinfo, zend_fiber_blocking_complete_getaddrinfo },
+	{ "read", 1, 3, zend_fiber_blocking_prepare_read, zend_fiber_blocking_run_read, zend_fiber_blocking_complete_read },
+	{ "write", 2, 3, zend_fiber_blocking_prepare_write, zend_fiber_blocking_run_write, zend_fiber_blocking_complete_write },
+	{ "stat", 1, 1, zend_fiber_blocking_prepare_stat, zend_fiber_blocking_run_stat, zend_fiber_blocking_complete_stat },
+	{ "fsync", 1, 1, zend_fiber_blocking_prepare_fsync, zend_fiber_blocking_run_fsync, zend_fiber_blocking_complete_bool },
+	{ "flock", 2, 2, zend_fiber_blocking_prepare_flock, zend_fiber_blocking_run_flock, zend_fiber_blocking_complete_bool },
+	{ NULL }
+};
+
+
+/* {{{ proto mixed Fiber\Blocking::run(string $operation, mixed ...$args) */
+ZEND_METHOD(FiberBlocking, run)
+{
+	const zend_fiber_blocking_op *op;
+	zend_fiber_blocking_job *job;
+	zend_string *name;
+	zval *args;
+	uint32_t count;
+
+	ZEND_PARSE_PARAMETERS_START(1, -1)
+		Z_PARAM_STR(name)
+		Z_PARAM_VARIADIC('*', args, count)
+	ZEND_PARSE_PARAMETERS_END();
+
+	for (op = zend_fiber_blocking_ops; op->name != NULL; op++) {
+		if (zend_binary_strcasecmp(op->name, strlen(op->name), ZSTR_VAL(name), ZSTR_LEN(name)) == 0) {
+			break;
+		}
+	}
+
+	if (op->name == NULL) {
+		zend_throw_error(zend_ce_fiber_error, "Unsupported blocking operation '%s'", ZSTR_VAL(name));
+		return;
+	}
+
+	if (count < op->min_args || count > op->max_args) {
+		zend_throw_error(zend_ce_argument_count_error, "Fiber\\Blocking::run('%s') expects %u to %u arguments, %u given",
+			op->name, op->min_args, op->max_args, count);
+		return;
+	}
+
+	job = pecalloc(1, sizeof(zend_fiber_blocking_job), 1);
+	job->job.run = op->run;
+	job->job.free = zend_fiber_blocking_job_free;
+	job->op = op;
+	job->fd = -1;
+
+	if (!op->prepare(job, args, count)) {
+		zend_fiber_blocking_job_free(&job->job);
+
+		if (!EG(exception)) {
+			RETURN_FALSE;
+		}
+
+		return;
+	}
+
+	if (!zend_fiber_thread_pool_await(&job->job)) {
+		/* Fiber is being destroyed, the pool releases the job once the worker is done. */
+		return;
+	}
+
+	op->complete(job, return_value);
+
+	zend_fiber_blocking_job_free(&job->job);
+}
+/* }}} */
+
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_blocking_run, 0, 0, 1)
+	ZEND_ARG_TYPE_INFO(0, operation, IS_STRING, 0)
+	ZEND_ARG_VARIADIC_INFO(0, arguments)
+ZEND_END_ARG_INFO()
+
+static const zend_function_entry fiber_blocking_methods[] = {
+	ZEND_ME(FiberBlocking, run, arginfo_fiber_blocking_run, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_FE_END
+};
+
+
+void zend_fiber_blocking_ce_register()
+{
+	zend_class_entry ce;
+
+	INIT_NS_CLASS_ENTRY(ce, "Fiber", "Blocking", fiber_blocking_methods);
+	zend_ce_fiber_blocking = zend_register_internal_class(&ce);
+	zend_ce_fiber_blocking->ce_flags |= ZEND_ACC_FINAL;
+}
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,397 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "zend_interfaces.h"
+#include "zend_exceptions.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_group.h"
+#include "fiber_poll.h"
+
+#ifndef ZEND_PARSE_PARAMETERS_NONE
+#define ZEND_PARSE_PARAMETERS_NONE() zend_parse_parameters_none()
+#endif
+
+static zend_class_entry *zend_ce_fiber_group;
+static zend_object_handlers zend_fiber_group_handlers;
+
+
+/* Takes a reference to every child so that children may finish (and leave the group) while being iterated. */
+static zend_fiber **zend_fiber_group_snapshot(zend_fiber_group *group, uint32_t *count)
+{
+	zend_fiber **fibers;
+	zval *child;
+	uint32_t i;
+
+	*count = zend_hash_num_elements(&group->children);
+
+	if (*count == 0) {
+		return NULL;
+	}
+
+	fibers = safe_emalloc(*count, sizeof(zend_fiber *), 0);
+	i = 0;
+
+	ZEND_HASH_FOREACH_VAL(&group->children, child) {
+		fibers[i] = (zend_fiber *) Z_OBJ_P(child);
+		GC_ADDREF(&fibers[i]->std);
+		i++;
+	} ZEND_HASH_FOREACH_END();
+
+	return fibers;
+}
+
+
+static void zend_fiber_group_release(zend_fiber **fibers, uint32_t count)
+{
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		OBJ_RELEASE(&fibers[i]->std);
+	}
+
+	if (fibers != NULL) {
+		efree(fibers);
+	}
+}
+
+
+static void zend_fiber_group_record_error(zend_fiber_group *group, zend_object *error)
+{
+	if (Z_ISUNDEF(group->error)) {
+		ZVAL_OBJ(&group->error, error);
+		GC_ADDREF(error);
+	}
+}
+
+
+/* Unwinds all suspended children in a single pass. */
+static void zend_fiber_group_cancel(zend_fiber_group *group)
+{
+	zend_fiber **fibers;
+	uint32_t count;
+	uint32_t i;
+
+	fibers = zend_fiber_group_snapshot(group, &count);
+
+	for (i = 0; i < count; i++) {
+		zend_fiber_do_cancel(fibers[i]);
+	}
+
+	zend_fiber_group_release(fibers, count);
+}
+
+
+/* Resumes suspended children round-robin until all of them have finished or one of them failed, the native
+ * poller is run whenever all remaining children are parked. */
+static void zend_fiber_group_drive(zend_fiber_group *group)
+{
+	zend_fiber **fibers;
+	uint32_t resumed;
+	uint32_t count;
+	uint32_t i;
+
+	while (group->pending > 0 && Z_ISUNDEF(group->error)) {
+		fibers = zend_fiber_group_snapshot(group, &count);
+		resumed = 0;
+
+		for (i = 0; i < count; i++) {
+			if (fibers[i]->status != ZEND_FIBER_STATUS_SUSPENDED || (fibers[i]->flags & ZEND_FIBER_FLAG_PARKED)) {
+				continue;
+			}
+
+			/* Suspended and preempted children are resumed alike, joinAll() only waits for them to finish. */
+			group->resuming = fibers[i];
+			zend_fiber_do_resume(fibers[i], NULL);
+			group->resuming = NULL;
+			resumed++;
+
+			if (UNEXPECTED(EG(exception))) {
+				break;
+			}
+		}
+
+		zend_fiber_group_release(fibers, count);
+
+		if (resumed == 0 && !EG(exception) && zend_fiber_poll_dispatch(-1) == 0 && FIBER_G(poll_pending) == 0) {
+			zend_throw_error(zend_ce_fiber_error, "Fiber group cannot make progress, no child can be resumed");
+		}
+
+		if (UNEXPECTED(EG(exception))) {
+			zend_fiber_group_record_error(group, EG(exception));
+			zend_clear_exception();
+		}
+	}
+}
+
+
+void zend_fiber_group_child_done(zend_fiber *fiber)
+{
+	zend_fiber_group *group;
+	zend_fiber *waiter;
+
+	group = fiber->group;
+	fiber->group = NULL;
+
+	ZEND_ASSERT(group->pending > 0);
+	group->pending--;
+
+	/* Any other resumer receives the error itself, recording it would make joinAll() throw it a second time. */
+	if (EG(exception) && group->resuming == fiber) {
+		zend_fiber_group_record_error(group, EG(exception));
+	}
+
+	GC_ADDREF(&group->std);
+
+	zend_hash_index_del(&group->children, fiber->std.handle);
+
+	waiter = group->waiter;
+
+	if (waiter != NULL && (group->pending == 0 || !Z_ISUNDEF(group->error))) {
+		group->waiter = NULL;
+
+		/* The finishing child has not switched back to its resumer yet, the poller resumes the waiter later. */
+		zend_fiber_poll_defer(waiter);
+	}
+
+	OBJ_RELEASE(&group->std);
+}
+
+
+static void zend_fiber_group_unpark(zend_fiber *fiber, void *data)
+{
+	zend_fiber_group *group;
+
+	group = (zend_fiber_group *) data;
+
+	if (group->waiter == fiber) {
+		group->waiter = NULL;
+	}
+}
+
+
+static zend_object *zend_fiber_group_object_create(zend_class_entry *ce)
+{
+	zend_fiber_group *group;
+
+	group = emalloc(sizeof(zend_fiber_group));
+	memset(group, 0, sizeof(zend_fiber_group));
+
+	zend_object_std_init(&group->std, ce);
+	group->std.handlers = &zend_fiber_group_handlers;
+
+	zend_hash_init(&group->children, 8, NULL, ZVAL_PTR_DTOR, 0);
+	ZVAL_UNDEF(&group->error);
+
+	return &group->std;
+}
+
+
+static void zend_fiber_group_detach(zend_fiber_group *group)
+{
+	zval *child;
+
+	ZEND_HASH_FOREACH_VAL(&group->children, child) {
+		((zend_fiber *) Z_OBJ_P(child))->group = NULL;
+	} ZEND_HASH_FOREACH_END();
+}
+
+
+/* Unwinds suspended children, runs as destructor so that no user code runs while the group is being freed. Children
+ * still report back, the group is alive until the destructor returns. */
+static void zend_fiber_group_object_dtor(zend_object *object)
+{
+	zend_fiber_group_cancel((zend_fiber_group *) object);
+}
+
+
+static void zend_fiber_group_object_destroy(zend_object *object)
+{
+	zend_fiber_group *group;
+
+	group = (zend_fiber_group *) object;
+
+	/* Children must not report back into a group that is being freed (spawned after the destructor or left over
+	 * after a fatal error). */
+	zend_fiber_group_detach(group);
+
+	zend_hash_destroy(&group->children);
+	zval_ptr_dtor(&group->error);
+
+	zend_object_std_dtor(&group->std);
+}
+
+
+#if PHP_VERSION_ID >= 80000
+static HashTable *zend_fiber_group_get_gc(zend_object *object, zval **table, int *n)
+{
+	zend_fiber_group *group = (zend_fiber_group *) object;
+#else
+static HashTable *zend_fiber_group_get_gc(zval *object, zval **table, int *n)
+{
+	zend_fiber_group *group = (zend_fiber_group *) Z_OBJ_P(object);
+#endif
+
+	*table = &group->error;
+	*n = Z_ISUNDEF(group->error) ? 0 : 1;
+
+	return &group->children;
+}
+
+
+/* {{{ proto Fiber Fiber\Group::spawn(callable $callback, mixed ...$args) */
+ZEND_METHOD(FiberGroup, spawn)
+{
+	zend_fiber_group *group;
+	zend_fiber *fiber;
+	zend_fcall_info fci;
+	zend_fcall_info_cache fci_cache;
+	zval *params;
+	uint32_t param_count;
+
+	ZEND_PARSE_PARAMETERS_START(1, -1)
+		Z_PARAM_FUNC(fci, fci_cache)
+		Z_PARAM_VARIADIC('*', params, param_count)
+	ZEND_PARSE_PARAMETERS_END();
+
+	group = (zend_fiber_group *) Z_OBJ_P(getThis());
+
+	object_init_ex(return_value, zend_ce_fiber);
+	fiber = (zend_fiber *) Z_OBJ_P(return_value);
+
+	zend_fiber_init(fiber, &fci, &fci_cache);
+
+	fiber->group = group;
+	group->pending++;
+
+	Z_ADDREF_P(return_value);
+	zend_hash_index_add_new(&group->children, fiber->std.handle, return_value);
+
+	if (!zend_fiber_do_start(fiber, params, param_count) && fiber->status == ZEND_FIBER_STATUS_INIT) {
+		fiber->group = NULL;
+		group->pending--;
+
+		zend_hash_index_del(&group->children, fiber->std.handle);
+	}
+}
+/* }}} */
+
+
+/* {{{ proto void Fiber\Group::joinAll() */
+ZEND_METHOD(FiberGroup, joinAll)
+{
+	zend_fiber_group *group;
+	zend_fiber *fiber;
+	zval error;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	group = (zend_fiber_group *) Z_OBJ_P(getThis());
+	fiber = FIBER_G(current_fiber);
+
+	if (fiber == NULL) {
+		zend_fiber_group_drive(group);
+	} else {
+		if (fiber->group == group) {
+			zend_throw_error(zend_ce_fiber_error, "Cannot join a group from within one of its own fibers");
+			return;
+		}
+
+		if (group->waiter != NULL) {
+			zend_throw_error(zend_ce_fiber_error, "Cannot join a group that is already being joined");
+			return;
+		}
+
+		while (group->pending > 0 && Z_ISUNDEF(group->error)) {
+			group->waiter = fiber;
+			zend_fiber_park(fiber, zend_fiber_group_unpark, group);
+
+			zend_fiber_do_suspend(fiber, NULL, NULL);
+
+			zend_fiber_unpark(fiber);
+			group->waiter = NULL;
+
+			if (UNEXPECTED(EG(exception))) {
+				return;
+			}
+		}
+	}
+
+	if (!Z_ISUNDEF(group->error)) {
+		zend_fiber_group_cancel(group);
+
+		ZVAL_COPY_VALUE(&error, &group->error);
+		ZVAL_UNDEF(&group->error);
+
+		zend_throw_exception_object(&error);
+	}
+}
+/* }}} */
+
+
+/* {{{ proto void Fiber\Group::cancel() */
+ZEND_METHOD(FiberGroup, cancel)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	zend_fiber_group_cancel((zend_fiber_group *) Z_OBJ_P(getThis()));
+}
+/* }}} */
+
+
+ZEND_BEGIN_ARG_WITH_RETURN_OBJ_INFO_EX(arginfo_fiber_group_spawn, 0, 1, Fiber, 0)
+	ZEND_ARG_CALLABLE_INFO(0, callable, 0)
+	ZEND_ARG_VARIADIC_INFO(0, arguments)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_fiber_group_void, 0)
+ZEND_END_ARG_INFO()
+
+static const zend_function_entry fiber_group_methods[] = {
+	ZEND_ME(FiberGroup, spawn, arginfo_fiber_group_spawn, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberGroup, joinAll, arginfo_fiber_group_void, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberGroup, cancel, arginfo_fiber_group_void, ZEND_ACC_PUBLIC)
+	ZEND_FE_END
+};
+
+
+void zend_fiber_group_ce_register()
+{
+	zend_class_entry ce;
+
+	INIT_NS_CLASS_ENTRY(ce, "Fiber", "Group", fiber_group_methods);
+	zend_ce_fiber_group = zend_register_internal_class(&ce);
+	zend_ce_fiber_group->ce_flags |= ZEND_ACC_FINAL;
+	zend_ce_fiber_group->create_object = zend_fiber_group_object_create;
+	zend_ce_fiber_group->serialize = zend_class_serialize_deny;
+	zend_ce_fiber_group->unserialize = zend_class_unserialize_deny;
+
+	memcpy(&zend_fiber_group_handlers, &std_object_handlers, sizeof(zend_object_handlers));
+	zend_fiber_group_handlers.dtor_obj = zend_fiber_group_object_dtor;
+	zend_fiber_group_handlers.free_obj = zend_fiber_group_object_destroy;
+	zend_fiber_group_handlers.get_gc = zend_fiber_group_get_gc;
+	zend_fiber_group_handlers.clone_obj = NULL;
+}
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
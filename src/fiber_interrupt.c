@@ -0,0 +1,296 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "zend.h"
+#include "zend_gc.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_interrupt.h"
+#include "fiber_profiler.h"
+
+#ifdef ZEND_FIBER_TICKER
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+static void (* zend_fiber_prev_interrupt_function)(zend_execute_data *execute_data);
+
+
+void zend_fiber_interrupt_raise(uint32_t *pending, zend_fiber_vm_interrupt *vm_interrupt, uint32_t bits)
+{
+#ifdef PHP_WIN32
+	InterlockedOr((volatile LONG *) pending, (LONG) bits);
+#else
+	__atomic_fetch_or(pending, bits, __ATOMIC_SEQ_CST);
+#endif
+
+#if PHP_VERSION_ID >= 80200
+	zend_atomic_bool_store(vm_interrupt, 1);
+#else
+	*vm_interrupt = 1;
+#endif
+}
+
+
+static void zend_fiber_preempt()
+{
+	zend_fiber *fiber;
+
+	fiber = FIBER_G(current_fiber);
+
+	if (fiber == NULL || fiber->status != ZEND_FIBER_STATUS_RUNNING) {
+		return;
+	}
+
+	if (fiber->flags & (ZEND_FIBER_FLAG_NO_PREEMPT | ZEND_FIBER_FLAG_PARKED)) {
+		return;
+	}
+
+	/* Destructors run by the cycle collector must not be interleaved with other fibers. */
+	if (gc_protected()) {
+		return;
+	}
+
+	fiber->flags |= ZEND_FIBER_FLAG_PREEMPTED;
+
+	zend_fiber_do_suspend(fiber, NULL, NULL);
+
+	fiber->flags &= ~ZEND_FIBER_FLAG_PREEMPTED;
+}
+
+
+static void zend_fiber_interrupt_function(zend_execute_data *execute_data)
+{
+	uint32_t pending;
+
+	if (zend_fiber_prev_interrupt_function != NULL) {
+		zend_fiber_prev_interrupt_function(execute_data);
+	}
+
+	if (EXPECTED(FIBER_G(interrupt_pending) == 0)) {
+		return;
+	}
+
+#ifdef PHP_WIN32
+	pending = (uint32_t) InterlockedExchange((volatile LONG *) &FIBER_G(interrupt_pending), 0);
+#else
+	pending = __atomic_exchange_n(&FIBER_G(interrupt_pending), 0, __ATOMIC_SEQ_CST);
+#endif
+
+	/* Sample before preempting, the stack of the running fiber is the one to be attributed. */
+	if (pending & ZEND_FIBER_INTERRUPT_SAMPLE) {
+		zend_fiber_profiler_sample(execute_data);
+	}
+
+	if ((pending & ZEND_FIBER_INTERRUPT_PREEMPT) && !EG(exception)) {
+		zend_fiber_preempt();
+	}
+
+#if PHP_VERSION_ID >= 80000
+	if (pending & ZEND_FIBER_INTERRUPT_UNWIND) {
+		zend_fiber_unwind_interrupt(execute_data);
+	}
+#endif
+}
+
+
+void zend_fiber_interrupt_startup()
+{
+	zend_fiber_prev_interrupt_function = zend_interrupt_function;
+	zend_interrupt_function = zend_fiber_interrupt_function;
+}
+
+
+void zend_fiber_interrupt_shutdown()
+{
+	zend_interrupt_function = zend_fiber_prev_interrupt_function;
+	zend_fiber_prev_interrupt_function = NULL;
+}
+
+
+#ifdef ZEND_FIBER_TICKER
+
+struct _zend_fiber_ticker {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	zend_bool running;
+	zend_bool stopping;
+
+	/* Globals of the owning PHP thread, only ever read by the ticker. */
+	zend_fiber **current;
+	uint32_t *slice;
+	zend_long *quantum;
+
+	/* Raised by the ticker to preempt the running fiber. */
+	uint32_t *pending;
+	zend_fiber_vm_interrupt *vm_interrupt;
+};
+
+
+static void *zend_fiber_ticker_run(void *arg)
+{
+	zend_fiber_ticker *ticker;
+	struct timeval now;
+	struct timespec deadline;
+	zend_long quantum;
+	uint32_t last;
+	uint32_t slice;
+
+	ticker = (zend_fiber_ticker *) arg;
+	last = __atomic_load_n(ticker->slice, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&ticker->mutex);
+
+	while (!ticker->stopping) {
+		quantum = __atomic_load_n(ticker->quantum, __ATOMIC_RELAXED);
+
+		gettimeofday(&now, NULL);
+
+		/* Keep polling the setting at a low rate while time slicing is switched off at runtime. */
+		deadline.tv_sec = now.tv_sec + ((quantum > 0) ? quantum : 100) / 1000;
+		deadline.tv_nsec = now.tv_usec * 1000 + (((quantum > 0) ? quantum : 100) % 1000) * 1000000;
+
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+
+		pthread_cond_timedwait(&ticker->cond, &ticker->mutex, &deadline);
+
+		if (ticker->stopping) {
+			break;
+		}
+
+		slice = __atomic_load_n(ticker->slice, __ATOMIC_RELAXED);
+
+		/* No switch happened during a whole quantum, the fiber has used up its slice. */
+		if (quantum > 0 && slice == last && __atomic_load_n(ticker->current, __ATOMIC_RELAXED) != NULL) {
+			zend_fiber_interrupt_raise(ticker->pending, ticker->vm_interrupt, ZEND_FIBER_INTERRUPT_PREEMPT);
+		}
+
+		last = slice;
+	}
+
+	pthread_mutex_unlock(&ticker->mutex);
+
+	return NULL;
+}
+
+
+void zend_fiber_ticker_start()
+{
+	zend_fiber_ticker *ticker;
+	sigset_t mask;
+	sigset_t prev;
+
+	if (FIBER_G(ticker) != NULL || FIBER_G(time_slice) <= 0) {
+		return;
+	}
+
+	ticker = pecalloc(1, sizeof(zend_fiber_ticker), 1);
+
+	ticker->current = &FIBER_G(current_fiber);
+	ticker->slice = &FIBER_G(slice);
+	ticker->quantum = &FIBER_G(time_slice);
+	ticker->pending = &FIBER_G(interrupt_pending);
+	ticker->vm_interrupt = &EG(vm_interrupt);
+
+	pthread_mutex_init(&ticker->mutex, NULL);
+	pthread_cond_init(&ticker->cond, NULL);
+
+	/* Signals (timeouts, pcntl) must keep being delivered to the PHP thread. */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &prev);
+
+	/* A ticker that failed to start is kept around so that it is not retried on every switch. */
+	ticker->running = (pthread_create(&ticker->thread, NULL, zend_fiber_ticker_run, ticker) == 0);
+
+	pthread_sigmask(SIG_SETMASK, &prev, NULL);
+
+	FIBER_G(ticker) = ticker;
+}
+
+
+void zend_fiber_ticker_stop()
+{
+	zend_fiber_ticker *ticker;
+
+	ticker = FIBER_G(ticker);
+
+	if (ticker == NULL) {
+		return;
+	}
+
+	if (ticker->running) {
+		pthread_mutex_lock(&ticker->mutex);
+		ticker->stopping = 1;
+		pthread_cond_signal(&ticker->cond);
+		pthread_mutex_unlock(&ticker->mutex);
+
+		pthread_join(ticker->thread, NULL);
+	}
+
+	pthread_cond_destroy(&ticker->cond);
+	pthread_mutex_destroy(&ticker->mutex);
+
+	pefree(ticker, 1);
+
+	FIBER_G(ticker) = NULL;
+}
+
+
+void zend_fiber_ticker_fork()
+{
+	zend_fiber_ticker *ticker;
+
+	ticker = FIBER_G(ticker);
+
+	if (ticker == NULL) {
+		return;
+	}
+
+	/* The thread has not been forked and may have held the mutex, a new ticker is started on the next switch. */
+	pefree(ticker, 1);
+
+	FIBER_G(ticker) = NULL;
+}
+
+#else
+
+void zend_fiber_ticker_start()
+{
+}
+
+void zend_fiber_ticker_stop()
+{
+}
+
+void zend_fiber_ticker_fork()
+{
+}
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,752 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "zend_exceptions.h"
+#include "zend_interfaces.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_ipc.h"
+#include "fiber_poll.h"
+
+#ifndef ZEND_PARSE_PARAMETERS_NONE
+#define ZEND_PARSE_PARAMETERS_NONE() zend_parse_parameters_none()
+#endif
+
+#ifdef ZEND_FIBER_POLL
+
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+/* Every message is prefixed with its length. */
+#define ZEND_FIBER_IPC_PREFIX sizeof(uint32_t)
+
+typedef struct _zend_fiber_ipc_ring zend_fiber_ipc_ring;
+typedef struct _zend_fiber_ipc_wait zend_fiber_ipc_wait;
+typedef struct _zend_fiber_ipc_event zend_fiber_ipc_event;
+typedef struct _zend_fiber_ipc_channel zend_fiber_ipc_channel;
+
+/* Shared by all processes that inherited the channel, must not contain pointers. */
+struct _zend_fiber_ipc_ring {
+	/* Robust process-shared mutex guarding all fields, held only while copying a single message. */
+	pthread_mutex_t lock;
+
+	/* Receivers waiting for a message and senders waiting for space, in all processes. */
+	uint32_t readers;
+	uint32_t writers;
+
+	uint32_t closed;
+
+	/* Size of the data area, read and write positions grow monotonically. */
+	uint64_t capacity;
+	uint64_t head;
+	uint64_t tail;
+
+	char data[1];
+};
+
+struct _zend_fiber_ipc_wait {
+	/* Fiber waiting on the event, NULL when awaited from main thread. */
+	zend_fiber *fiber;
+
+	zend_fiber_ipc_event *event;
+
+	/* Shared counter of waiters (readers or writers) the caller has incremented, see zend_fiber_ipc_unpark(). */
+	zend_fiber_ipc_ring *ring;
+	uint32_t *waiting;
+
+	zend_bool done;
+
+	zend_fiber_ipc_wait *prev;
+	zend_fiber_ipc_wait *next;
+};
+
+/* Eventfd (semaphore mode) registered with the native poller while fibers of this process wait on it. */
+struct _zend_fiber_ipc_event {
+	zend_fiber_poll_waiter waiter;
+
+	uint32_t count;
+	zend_fiber_ipc_wait *head;
+	zend_fiber_ipc_wait *tail;
+};
+
+struct _zend_fiber_ipc_channel {
+	/* Shared mapping of the memfd, it stays valid across fork(). */
+	zend_fiber_ipc_ring *ring;
+	size_t size;
+
+	/* Signaled by senders for waiting receivers (data) and the other way round (space). */
+	zend_fiber_ipc_event data;
+	zend_fiber_ipc_event space;
+
+	/* Process the waiter lists belong to, a forked child starts over with empty lists. */
+	pid_t pid;
+
+	/* Fiber\IpcChannel PHP object handle. */
+	zend_object std;
+};
+
+#define ZEND_FIBER_IPC_CHANNEL(obj) ((zend_fiber_ipc_channel *) ((char *) (obj) - XtOffsetOf(zend_fiber_ipc_channel, std)))
+
+static zend_class_entry *zend_ce_fiber_ipc_channel;
+static zend_object_handlers zend_fiber_ipc_channel_handlers;
+
+
+static zend_always_inline void zend_fiber_ipc_lock(zend_fiber_ipc_ring *ring)
+{
+	/* Positions are only moved once a copy is complete, a holder that died while copying left the ring consistent. */
+	if (UNEXPECTED(pthread_mutex_lock(&ring->lock) == EOWNERDEAD)) {
+		pthread_mutex_consistent(&ring->lock);
+	}
+}
+
+
+static zend_always_inline void zend_fiber_ipc_unlock(zend_fiber_ipc_ring *ring)
+{
+	pthread_mutex_unlock(&ring->lock);
+}
+
+
+static void zend_fiber_ipc_copy_in(zend_fiber_ipc_ring *ring, uint64_t pos, const char *buf, size_t len)
+{
+	size_t offset;
+	size_t first;
+
+	offset = (size_t) (pos % ring->capacity);
+	first = MIN(len, (size_t) ring->capacity - offset);
+
+	memcpy(ring->data + offset, buf, first);
+	memcpy(ring->data, buf + first, len - first);
+}
+
+
+static void zend_fiber_ipc_copy_out(zend_fiber_ipc_ring *ring, uint64_t pos, char *buf, size_t len)
+{
+	size_t offset;
+	size_t first;
+
+	offset = (size_t) (pos % ring->capacity);
+	first = MIN(len, (size_t) ring->capacity - offset);
+
+	memcpy(buf, ring->data + offset, first);
+	memcpy(buf + first, ring->data, len - first);
+}
+
+
+/* Adds a token for one waiter, a full counter means there are plenty of tokens left anyway. */
+static void zend_fiber_ipc_notify(zend_fiber_ipc_event *event, uint64_t tokens)
+{
+	ssize_t ret;
+
+	do {
+		ret = write(event->waiter.fd, &tokens, sizeof(tokens));
+	} while (ret < 0 && errno == EINTR);
+}
+
+
+/* Every token read wakes one waiting fiber of this process, the others keep waiting for their own token. */
+static void zend_fiber_ipc_dispatch(zend_fiber_poll_waiter *waiter)
+{
+	zend_fiber_ipc_event *event;
+	zend_fiber_ipc_wait *entry;
+	zend_fiber **fibers;
+	uint64_t token;
+	uint32_t count;
+	uint32_t i;
+
+	event = (zend_fiber_ipc_event *) waiter;
+	fibers = NULL;
+	count = 0;
+
+	for (entry = event->head; entry != NULL; entry = entry->next) {
+		if (entry->done) {
+			continue;
+		}
+
+		if (read(waiter->fd, &token, sizeof(token)) != sizeof(token)) {
+			break;
+		}
+
+		entry->done = 1;
+
+		if (entry->fiber != NULL) {
+			if (fibers == NULL) {
+				fibers = safe_emalloc(event->count, sizeof(zend_fiber *), 0);
+			}
+
+			fibers[count++] = entry->fiber;
+			GC_ADDREF(&entry->fiber->std);
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		zend_fiber_poll_wake(fibers[i]);
+		OBJ_RELEASE(&fibers[i]->std);
+	}
+
+	if (fibers != NULL) {
+		efree(fibers);
+	}
+}
+
+
+static void zend_fiber_ipc_leave(zend_fiber_ipc_wait *wait)
+{
+	zend_fiber_ipc_event *event;
+
+	event = wait->event;
+
+	if (wait->prev != NULL) {
+		wait->prev->next = wait->next;
+	} else {
+		event->head = wait->next;
+	}
+
+	if (wait->next != NULL) {
+		wait->next->prev = wait->prev;
+	} else {
+		event->tail = wait->prev;
+	}
+
+	if (--event->count == 0) {
+		zend_fiber_poll_remove_handler(&event->waiter);
+		zend_fiber_poll_unref();
+	}
+}
+
+
+/* The fiber never returns to its caller, which would otherwise drop the shared waiter count and pass on a token. */
+static void zend_fiber_ipc_unpark(zend_fiber *fiber, void *data)
+{
+	zend_fiber_ipc_wait *wait;
+
+	wait = (zend_fiber_ipc_wait *) data;
+
+	zend_fiber_ipc_leave(wait);
+
+	zend_fiber_ipc_lock(wait->ring);
+	(*wait->waiting)--;
+	zend_fiber_ipc_unlock(wait->ring);
+
+	if (wait->done) {
+		zend_fiber_ipc_notify(wait->event, 1);
+	}
+}
+
+
+/* Parks the current fiber (or runs the poller in main thread) until a token has been taken from the event. */
+static zend_bool zend_fiber_ipc_wait(zend_fiber_ipc_channel *channel, zend_fiber_ipc_event *event, uint32_t *waiting)
+{
+	zend_fiber_ipc_wait wait;
+	pid_t pid;
+
+	pid = getpid();
+
+	/* Waiters inherited from the parent are orphaned fibers registered with the poller of the parent. */
+	if (UNEXPECTED(channel->pid != pid)) {
+		channel->data.count = 0;
+		channel->data.head = NULL;
+		channel->data.tail = NULL;
+
+		channel->space.count = 0;
+		channel->space.head = NULL;
+		channel->space.tail = NULL;
+
+		channel->pid = pid;
+	}
+
+	if (event->count == 0) {
+		if (!zend_fiber_poll_add_handler(&event->waiter)) {
+			return 0;
+		}
+
+		zend_fiber_poll_ref();
+	}
+
+	event->count++;
+
+	/* Waiters are woken in FIFO order. */
+	wait.fiber = FIBER_G(current_fiber);
+	wait.event = event;
+	wait.ring = channel->ring;
+	wait.waiting = waiting;
+	wait.done = 0;
+	wait.prev = event->tail;
+	wait.next = NULL;
+
+	if (event->tail != NULL) {
+		event->tail->next = &wait;
+	} else {
+		event->head = &wait;
+	}
+
+	event->tail = &wait;
+
+	if (wait.fiber == NULL) {
+		while (!wait.done && !EG(exception)) {
+			if (zend_fiber_poll_dispatch(-1) < 0) {
+				break;
+			}
+		}
+	} else {
+		zend_fiber_park(wait.fiber, zend_fiber_ipc_unpark, &wait);
+
+		while (!wait.done && !EG(exception)) {
+			zend_fiber_do_suspend(wait.fiber, NULL, NULL);
+		}
+
+		zend_fiber_unpark(wait.fiber);
+	}
+
+	zend_fiber_ipc_leave(&wait);
+
+	/* Pass the token on if the wait has been aborted after it has been taken. */
+	if (wait.done && EG(exception)) {
+		zend_fiber_ipc_notify(event, 1);
+		return 0;
+	}
+
+	return wait.done;
+}
+
+
+static int zend_fiber_memfd_create(const char *name)
+{
+#ifdef SYS_memfd_create
+	return (int) syscall(SYS_memfd_create, name, MFD_CLOEXEC);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+static zend_object *zend_fiber_ipc_channel_object_create(zend_class_entry *ce)
+{
+	zend_fiber_ipc_channel *channel;
+
+	channel = emalloc(sizeof(zend_fiber_ipc_channel) + zend_object_properties_size(ce));
+	memset(channel, 0, sizeof(zend_fiber_ipc_channel));
+
+	zend_object_std_init(&channel->std, ce);
+	channel->std.handlers = &zend_fiber_ipc_channel_handlers;
+
+	channel->data.waiter.fd = -1;
+	channel->data.waiter.events = EPOLLIN;
+	channel->data.waiter.handler = zend_fiber_ipc_dispatch;
+
+	channel->space.waiter.fd = -1;
+	channel->space.waiter.events = EPOLLIN;
+	channel->space.waiter.handler = zend_fiber_ipc_dispatch;
+
+	return &channel->std;
+}
+
+
+static void zend_fiber_ipc_channel_object_destroy(zend_object *object)
+{
+	zend_fiber_ipc_channel *channel;
+
+	channel = ZEND_FIBER_IPC_CHANNEL(object);
+
+	if (channel->ring != NULL) {
+		munmap(channel->ring, channel->size);
+	}
+
+	if (channel->data.waiter.fd >= 0) {
+		close(channel->data.waiter.fd);
+	}
+
+	if (channel->space.waiter.fd >= 0) {
+		close(channel->space.waiter.fd);
+	}
+
+	zend_object_std_dtor(&channel->std);
+}
+
+
+static zend_fiber_ipc_channel *zend_fiber_ipc_channel_get(zval *obj)
+{
+	zend_fiber_ipc_channel *channel;
+
+	channel = ZEND_FIBER_IPC_CHANNEL(Z_OBJ_P(obj));
+
+	if (UNEXPECTED(channel->ring == NULL)) {
+		zend_throw_error(zend_ce_fiber_error, "Channel has not been initialized");
+		return NULL;
+	}
+
+	return channel;
+}
+
+
+/* {{{ proto Fiber\IpcChannel::__construct(int $capacity = 1048576) */
+ZEND_METHOD(FiberIpcChannel, __construct)
+{
+	zend_fiber_ipc_channel *channel;
+	pthread_mutexattr_t attr;
+	zend_long capacity;
+	size_t size;
+	void *map;
+	int fd;
+
+	capacity = ZEND_FIBER_IPC_CAPACITY;
+
+	ZEND_PARSE_PARAMETERS_START(0, 1)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(capacity)
+	ZEND_PARSE_PARAMETERS_END();
+
+	channel = ZEND_FIBER_IPC_CHANNEL(Z_OBJ_P(getThis()));
+
+	if (channel->ring != NULL) {
+		zend_throw_error(zend_ce_fiber_error, "Channel has already been initialized");
+		return;
+	}
+
+	if (capacity < 64 || (zend_ulong) capacity > UINT32_MAX) {
+		zend_throw_error(NULL, "Fiber\\IpcChannel::__construct(): Argument #1 ($capacity) must be between 64 and %u", UINT32_MAX);
+		return;
+	}
+
+	size = ZEND_MM_ALIGNED_SIZE_EX(XtOffsetOf(zend_fiber_ipc_ring, data) + (size_t) capacity, (size_t) sysconf(_SC_PAGESIZE));
+
+	fd = zend_fiber_memfd_create("fiber-ipc");
+
+	if (fd < 0) {
+		zend_throw_error(NULL, "Failed to create shared memory: %s", strerror(errno));
+		return;
+	}
+
+	if (ftruncate(fd, (off_t) size) != 0) {
+		zend_throw_error(NULL, "Failed to size shared memory: %s", strerror(errno));
+		close(fd);
+		return;
+	}
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	/* The mapping keeps the memory alive, forked processes inherit it. */
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		zend_throw_error(NULL, "Failed to map shared memory: %s", strerror(errno));
+		return;
+	}
+
+	channel->data.waiter.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC | EFD_SEMAPHORE);
+	channel->space.waiter.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC | EFD_SEMAPHORE);
+
+	if (channel->data.waiter.fd < 0 || channel->space.waiter.fd < 0) {
+		zend_throw_error(NULL, "Failed to create eventfd: %s", strerror(errno));
+		munmap(map, size);
+		return;
+	}
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+
+	/* A process dying while holding the lock must not block all others forever. */
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+
+	channel->ring = (zend_fiber_ipc_ring *) map;
+	channel->ring->capacity = (uint64_t) capacity;
+	channel->size = size;
+	channel->pid = getpid();
+
+	pthread_mutex_init(&channel->ring->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+/* }}} */
+
+
+/* {{{ proto void Fiber\IpcChannel::send(string $message) */
+ZEND_METHOD(FiberIpcChannel, send)
+{
+	zend_fiber_ipc_channel *channel;
+	zend_fiber_ipc_ring *ring;
+	zend_string *message;
+	zend_bool waiting;
+	zend_bool notify;
+	uint32_t len;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_STR(message)
+	ZEND_PARSE_PARAMETERS_END();
+
+	channel = zend_fiber_ipc_channel_get(getThis());
+
+	if (channel == NULL) {
+		return;
+	}
+
+	ring = channel->ring;
+
+	if (ZSTR_LEN(message) > ring->capacity - ZEND_FIBER_IPC_PREFIX) {
+		zend_throw_error(zend_ce_fiber_error, "Message of %zu bytes exceeds the channel capacity of %" PRIu64 " bytes",
+			ZSTR_LEN(message), ring->capacity);
+		return;
+	}
+
+	len = (uint32_t) ZSTR_LEN(message);
+	waiting = 0;
+
+	while (1) {
+		zend_fiber_ipc_lock(ring);
+
+		if (waiting) {
+			ring->writers--;
+			waiting = 0;
+		}
+
+		if (ring->closed) {
+			zend_fiber_ipc_unlock(ring);
+			zend_throw_error(zend_ce_fiber_error, "Channel has been closed");
+			return;
+		}
+
+		if (ring->capacity - (ring->tail - ring->head) >= ZEND_FIBER_IPC_PREFIX + len) {
+			break;
+		}
+
+		ring->writers++;
+		waiting = 1;
+
+		zend_fiber_ipc_unlock(ring);
+
+		if (!zend_fiber_ipc_wait(channel, &channel->space, &ring->writers)) {
+			zend_fiber_ipc_lock(ring);
+			ring->writers--;
+			zend_fiber_ipc_unlock(ring);
+			return;
+		}
+	}
+
+	zend_fiber_ipc_copy_in(ring, ring->tail, (const char *) &len, ZEND_FIBER_IPC_PREFIX);
+	zend_fiber_ipc_copy_in(ring, ring->tail + ZEND_FIBER_IPC_PREFIX, ZSTR_VAL(message), len);
+
+	ring->tail += ZEND_FIBER_IPC_PREFIX + len;
+	notify = (ring->readers > 0);
+
+	zend_fiber_ipc_unlock(ring);
+
+	/* No syscall unless a receiver is parked. */
+	if (notify) {
+		zend_fiber_ipc_notify(&channel->data, 1);
+	}
+}
+/* }}} */
+
+
+/* {{{ proto ?string Fiber\IpcChannel::receive() */
+ZEND_METHOD(FiberIpcChannel, receive)
+{
+	zend_fiber_ipc_channel *channel;
+	zend_fiber_ipc_ring *ring;
+	zend_string *message;
+	zend_bool waiting;
+	zend_bool notify;
+	uint32_t len;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	channel = zend_fiber_ipc_channel_get(getThis());
+
+	if (channel == NULL) {
+		return;
+	}
+
+	ring = channel->ring;
+	waiting = 0;
+
+	while (1) {
+		zend_fiber_ipc_lock(ring);
+
+		if (waiting) {
+			ring->readers--;
+			waiting = 0;
+		}
+
+		if (ring->tail != ring->head) {
+			break;
+		}
+
+		/* Messages sent before the channel was closed are still delivered. */
+		if (ring->closed) {
+			zend_fiber_ipc_unlock(ring);
+			RETURN_NULL();
+		}
+
+		ring->readers++;
+		waiting = 1;
+
+		zend_fiber_ipc_unlock(ring);
+
+		if (!zend_fiber_ipc_wait(channel, &channel->data, &ring->readers)) {
+			zend_fiber_ipc_lock(ring);
+			ring->readers--;
+			zend_fiber_ipc_unlock(ring);
+			return;
+		}
+	}
+
+	zend_fiber_ipc_copy_out(ring, ring->head, (char *) &len, ZEND_FIBER_IPC_PREFIX);
+
+	message = zend_string_alloc(len, 0);
+	zend_fiber_ipc_copy_out(ring, ring->head + ZEND_FIBER_IPC_PREFIX, ZSTR_VAL(message), len);
+	ZSTR_VAL(message)[len] = '\0';
+
+	ring->head += ZEND_FIBER_IPC_PREFIX + len;
+	notify = (ring->writers > 0);
+
+	zend_fiber_ipc_unlock(ring);
+
+	if (notify) {
+		zend_fiber_ipc_notify(&channel->space, 1);
+	}
+
+	RETURN_NEW_STR(message);
+}
+/* }}} */
+
+
+/* {{{ proto void Fiber\IpcChannel::close() */
+ZEND_METHOD(FiberIpcChannel, close)
+{
+	zend_fiber_ipc_channel *channel;
+	zend_fiber_ipc_ring *ring;
+	uint32_t readers;
+	uint32_t writers;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	channel = zend_fiber_ipc_channel_get(getThis());
+
+	if (channel == NULL) {
+		return;
+	}
+
+	ring = channel->ring;
+
+	zend_fiber_ipc_lock(ring);
+
+	if (ring->closed) {
+		zend_fiber_ipc_unlock(ring);
+		return;
+	}
+
+	ring->closed = 1;
+	readers = ring->readers;
+	writers = ring->writers;
+
+	zend_fiber_ipc_unlock(ring);
+
+	/* Every parked receiver and sender in every process re-checks the ring and sees the closed flag. */
+	if (readers > 0) {
+		zend_fiber_ipc_notify(&channel->data, readers);
+	}
+
+	if (writers > 0) {
+		zend_fiber_ipc_notify(&channel->space, writers);
+	}
+}
+/* }}} */
+
+
+/* {{{ proto bool Fiber\IpcChannel::isClosed() */
+ZEND_METHOD(FiberIpcChannel, isClosed)
+{
+	zend_fiber_ipc_channel *channel;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	channel = zend_fiber_ipc_channel_get(getThis());
+
+	if (channel == NULL) {
+		return;
+	}
+
+	RETURN_BOOL(__atomic_load_n(&channel->ring->closed, __ATOMIC_ACQUIRE));
+}
+/* }}} */
+
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_ipc_channel_construct, 0, 0, 0)
+	ZEND_ARG_TYPE_INFO(0, capacity, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_ipc_channel_send, 0, 0, 1)
+	ZEND_ARG_TYPE_INFO(0, message, IS_STRING, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_ipc_channel_receive, 0, 0, IS_STRING, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_fiber_ipc_channel_close, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_ipc_channel_is_closed, 0, 0, _IS_BOOL, 0)
+ZEND_END_ARG_INFO()
+
+static const zend_function_entry fiber_ipc_channel_methods[] = {
+	ZEND_ME(FiberIpcChannel, __construct, arginfo_fiber_ipc_channel_construct, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberIpcChannel, send, arginfo_fiber_ipc_channel_send, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberIpcChannel, receive, arginfo_fiber_ipc_channel_receive, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberIpcChannel, close, arginfo_fiber_ipc_channel_close, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberIpcChannel, isClosed, arginfo_fiber_ipc_channel_is_closed, ZEND_ACC_PUBLIC)
+	ZEND_FE_END
+};
+
+
+void zend_fiber_ipc_ce_register()
+{
+	zend_class_entry ce;
+
+	INIT_NS_CLASS_ENTRY(ce, "Fiber", "IpcChannel", fiber_ipc_channel_methods);
+	zend_ce_fiber_ipc_channel = zend_register_internal_class(&ce);
+	zend_ce_fiber_ipc_channel->ce_flags |= ZEND_ACC_FINAL;
+	zend_ce_fiber_ipc_channel->create_object = zend_fiber_ipc_channel_object_create;
+	zend_ce_fiber_ipc_channel->serialize = zend_class_serialize_deny;
+	zend_ce_fiber_ipc_channel->unserialize = zend_class_unserialize_deny;
+
+	memcpy(&zend_fiber_ipc_channel_handlers, &std_object_handlers, sizeof(zend_object_handlers));
+	zend_fiber_ipc_channel_handlers.offset = XtOffsetOf(zend_fiber_ipc_channel, std);
+	zend_fiber_ipc_channel_handlers.free_obj = zend_fiber_ipc_channel_object_destroy;
+	zend_fiber_ipc_channel_handlers.clone_obj = NULL;
+}
+
+#else
+
+void zend_fiber_ipc_ce_register()
+{
+}
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
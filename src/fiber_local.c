@@ -0,0 +1,295 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "zend.h"
+#include "zend_API.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_local.h"
+#include "fiber_registry.h"
+
+#ifndef ZEND_PARSE_PARAMETERS_NONE
+#define ZEND_PARSE_PARAMETERS_NONE() zend_parse_parameters_none()
+#endif
+
+static zend_class_entry *zend_ce_fiber_local;
+static zend_object_handlers zend_fiber_local_handlers;
+
+typedef struct _zend_fiber_local {
+	/* Index of the value in every zend_fiber_locals. */
+	uint32_t index;
+
+	/* Fiber\Local PHP object handle. */
+	zend_object std;
+} zend_fiber_local;
+
+#define ZEND_FIBER_LOCAL(obj) ((zend_fiber_local *) ((char *) (obj) - XtOffsetOf(zend_fiber_local, std)))
+
+
+static zend_always_inline zend_fiber_locals *zend_fiber_locals_current()
+{
+	zend_fiber *fiber;
+
+	fiber = FIBER_G(current_fiber);
+
+	return (fiber == NULL) ? &FIBER_G(locals) : &fiber->locals;
+}
+
+
+static zval *zend_fiber_locals_find(zend_fiber_locals *locals, uint32_t index, zend_bool create)
+{
+	uint32_t size;
+	uint32_t i;
+
+	if (EXPECTED(index < ZEND_FIBER_LOCAL_SLOTS)) {
+		return &locals->slots[index];
+	}
+
+	index -= ZEND_FIBER_LOCAL_SLOTS;
+
+	if (index >= locals->overflow_size) {
+		if (!create) {
+			return NULL;
+		}
+
+		size = MAX(index + 1, locals->overflow_size * 2);
+		locals->overflow = (zval *) safe_erealloc(locals->overflow, size, sizeof(zval), 0);
+
+		for (i = locals->overflow_size; i < size; i++) {
+			ZVAL_UNDEF(&locals->overflow[i]);
+		}
+
+		locals->overflow_size = size;
+	}
+
+	return &locals->overflow[index];
+}
+
+
+static void zend_fiber_locals_clear(zend_fiber_locals *locals, uint32_t index)
+{
+	zval *value;
+	zval tmp;
+
+	value = zend_fiber_locals_find(locals, index, 0);
+
+	if (value == NULL || Z_ISUNDEF_P(value)) {
+		return;
+	}
+
+	/* The destructor of the value may access the same local. */
+	ZVAL_COPY_VALUE(&tmp, value);
+	ZVAL_UNDEF(value);
+
+	zval_ptr_dtor(&tmp);
+}
+
+
+void zend_fiber_locals_destroy(zend_fiber_locals *locals)
+{
+	zval *overflow;
+	uint32_t size;
+	uint32_t i;
+
+	for (i = 0; i < ZEND_FIBER_LOCAL_SLOTS; i++) {
+		zend_fiber_locals_clear(locals, i);
+	}
+
+	overflow = locals->overflow;
+	size = locals->overflow_size;
+
+	if (overflow == NULL) {
+		return;
+	}
+
+	locals->overflow = NULL;
+	locals->overflow_size = 0;
+
+	for (i = 0; i < size; i++) {
+		zval_ptr_dtor(&overflow[i]);
+	}
+
+	efree(overflow);
+}
+
+
+static zend_object *zend_fiber_local_object_create(zend_class_entry *ce)
+{
+	zend_fiber_local *local;
+
+	local = emalloc(sizeof(zend_fiber_local) + zend_object_properties_size(ce));
+	memset(local, 0, sizeof(zend_fiber_local));
+
+	zend_object_std_init(&local->std, ce);
+	local->std.handlers = &zend_fiber_local_handlers;
+
+	/* Indexes are reused, values of a destroyed local have been cleared in every fiber. */
+	if (FIBER_G(local_free_count) > 0) {
+		local->index = FIBER_G(local_free)[--FIBER_G(local_free_count)];
+	} else {
+		local->index = FIBER_G(local_next)++;
+	}
+
+	return &local->std;
+}
+
+
+static void zend_fiber_local_object_destroy(zend_object *object)
+{
+	zend_fiber_local *local;
+	zend_fiber *fiber;
+
+	local = ZEND_FIBER_LOCAL(object);
+
+	/* Only the main thread and started, unfinished fibers can hold values. */
+	zend_fiber_locals_clear(&FIBER_G(locals), local->index);
+
+	for (fiber = FIBER_G(fibers); fiber != NULL; fiber = fiber->registry_next) {
+		zend_fiber_locals_clear(&fiber->locals, local->index);
+	}
+
+	if (FIBER_G(local_free_count) == FIBER_G(local_free_size)) {
+		FIBER_G(local_free_size) = (FIBER_G(local_free_size) == 0) ? 16 : FIBER_G(local_free_size) * 2;
+		FIBER_G(local_free) = (uint32_t *) safe_perealloc(FIBER_G(local_free), FIBER_G(local_free_size), sizeof(uint32_t), 0, 1);
+	}
+
+	FIBER_G(local_free)[FIBER_G(local_free_count)++] = local->index;
+
+	zend_object_std_dtor(&local->std);
+}
+
+
+void zend_fiber_local_gshutdown()
+{
+	if (FIBER_G(local_free) != NULL) {
+		pefree(FIBER_G(local_free), 1);
+		FIBER_G(local_free) = NULL;
+	}
+
+	FIBER_G(local_free_count) = 0;
+	FIBER_G(local_free_size) = 0;
+}
+
+
+/* {{{ proto mixed Fiber\Local::get() */
+ZEND_METHOD(FiberLocal, get)
+{
+	zval *value;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	value = zend_fiber_locals_find(zend_fiber_locals_current(), ZEND_FIBER_LOCAL(Z_OBJ_P(getThis()))->index, 0);
+
+	if (value == NULL || Z_ISUNDEF_P(value)) {
+		RETURN_NULL();
+	}
+
+	ZVAL_COPY(return_value, value);
+}
+/* }}} */
+
+
+/* {{{ proto void Fiber\Local::set(mixed $value) */
+ZEND_METHOD(FiberLocal, set)
+{
+	zval *value;
+	zval *slot;
+	zval tmp;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_ZVAL(value)
+	ZEND_PARSE_PARAMETERS_END();
+
+	slot = zend_fiber_locals_find(zend_fiber_locals_current(), ZEND_FIBER_LOCAL(Z_OBJ_P(getThis()))->index, 1);
+
+	ZVAL_COPY_VALUE(&tmp, slot);
+	ZVAL_COPY(slot, value);
+
+	zval_ptr_dtor(&tmp);
+}
+/* }}} */
+
+
+/* {{{ proto bool Fiber\Local::has() */
+ZEND_METHOD(FiberLocal, has)
+{
+	zval *value;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	value = zend_fiber_locals_find(zend_fiber_locals_current(), ZEND_FIBER_LOCAL(Z_OBJ_P(getThis()))->index, 0);
+
+	RETURN_BOOL(value != NULL && !Z_ISUNDEF_P(value));
+}
+/* }}} */
+
+
+/* {{{ proto void Fiber\Local::delete() */
+ZEND_METHOD(FiberLocal, delete)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	zend_fiber_locals_clear(zend_fiber_locals_current(), ZEND_FIBER_LOCAL(Z_OBJ_P(getThis()))->index);
+}
+/* }}} */
+
+
+ZEND_BEGIN_ARG_INFO(arginfo_fiber_local_get, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_local_set, 0, 0, 1)
+	ZEND_ARG_INFO(0, value)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_local_has, 0, 0, _IS_BOOL, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_fiber_local_delete, 0)
+ZEND_END_ARG_INFO()
+
+static const zend_function_entry fiber_local_methods[] = {
+	ZEND_ME(FiberLocal, get, arginfo_fiber_local_get, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberLocal, set, arginfo_fiber_local_set, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberLocal, has, arginfo_fiber_local_has, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberLocal, delete, arginfo_fiber_local_delete, ZEND_ACC_PUBLIC)
+	ZEND_FE_END
+};
+
+
+void zend_fiber_local_ce_register()
+{
+	zend_class_entry ce;
+
+	INIT_NS_CLASS_ENTRY(ce, "Fiber", "Local", fiber_local_methods);
+	zend_ce_fiber_local = zend_register_internal_class(&ce);
+	zend_ce_fiber_local->ce_flags |= ZEND_ACC_FINAL;
+	zend_ce_fiber_local->create_object = zend_fiber_local_object_create;
+	zend_ce_fiber_local->serialize = zend_class_serialize_deny;
+	zend_ce_fiber_local->unserialize = zend_class_unserialize_deny;
+
+	memcpy(&zend_fiber_local_handlers, &std_object_handlers, sizeof(zend_object_handlers));
+	zend_fiber_local_handlers.offset = XtOffsetOf(zend_fiber_local, std);
+	zend_fiber_local_handlers.free_obj = zend_fiber_local_object_destroy;
+	zend_fiber_local_handlers.clone_obj = NULL;
+}
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,110 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "zend.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_observer.h"
+
+/* Filled during MINIT only, read-only afterwards and thus shared by all threads. */
+static zend_fiber_observer zend_fiber_observers[ZEND_FIBER_MAX_OBSERVERS];
+
+uint32_t zend_fiber_observer_count = 0;
+
+
+PHP_FIBER_API int zend_fiber_observer_register(const zend_fiber_observer *observer)
+{
+	if (zend_fiber_observer_count >= ZEND_FIBER_MAX_OBSERVERS) {
+		return -1;
+	}
+
+	zend_fiber_observers[zend_fiber_observer_count] = *observer;
+
+	return (int) zend_fiber_observer_count++;
+}
+
+
+PHP_FIBER_API void **zend_fiber_observer_slot(int handle)
+{
+	zend_fiber *fiber;
+
+	ZEND_ASSERT(handle >= 0 && handle < (int) zend_fiber_observer_count);
+
+	fiber = FIBER_G(current_fiber);
+
+	return (fiber == NULL) ? &FIBER_G(observer_slots)[handle] : &fiber->observer_slots[handle];
+}
+
+
+static zend_always_inline void **zend_fiber_observer_slots(zend_fiber *fiber)
+{
+	return (fiber == NULL) ? FIBER_G(observer_slots) : fiber->observer_slots;
+}
+
+
+void zend_fiber_observer_create(zend_fiber *fiber)
+{
+	uint32_t i;
+
+	for (i = 0; i < zend_fiber_observer_count; i++) {
+		if (zend_fiber_observers[i].create != NULL) {
+			zend_fiber_observers[i].create(fiber, &fiber->observer_slots[i]);
+		}
+	}
+}
+
+
+void zend_fiber_observer_switch(zend_fiber *from, zend_fiber *to)
+{
+	void **slots;
+	uint32_t i;
+
+	slots = zend_fiber_observer_slots(from);
+
+	for (i = 0; i < zend_fiber_observer_count; i++) {
+		if (zend_fiber_observers[i].switch_out != NULL) {
+			zend_fiber_observers[i].switch_out(from, &slots[i]);
+		}
+	}
+
+	slots = zend_fiber_observer_slots(to);
+
+	for (i = 0; i < zend_fiber_observer_count; i++) {
+		if (zend_fiber_observers[i].switch_in != NULL) {
+			zend_fiber_observers[i].switch_in(to, &slots[i]);
+		}
+	}
+}
+
+
+void zend_fiber_observer_destroy(zend_fiber *fiber)
+{
+	uint32_t i;
+
+	for (i = 0; i < zend_fiber_observer_count; i++) {
+		if (zend_fiber_observers[i].destroy != NULL) {
+			zend_fiber_observers[i].destroy(fiber, &fiber->observer_slots[i]);
+		}
+	}
+}
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
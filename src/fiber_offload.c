@@ -0,0 +1,468 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "zend_exceptions.h"
+#include "ext/hash/php_hash.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_thread_pool.h"
+
+#ifdef HAVE_FIBER_ZLIB
+#include <zlib.h>
+#endif
+
+/* Largest length passed to APIs taking unsigned int lengths (zlib, hash_update() before PHP 8.0), longer inputs are
+ * processed in chunks. */
+#define ZEND_FIBER_OFFLOAD_CHUNK ((size_t) UINT_MAX)
+
+typedef struct _zend_fiber_offload_job zend_fiber_offload_job;
+
+struct _zend_fiber_offload_job {
+	zend_fiber_job job;
+
+	/* Private copy of the input, owned by the job. */
+	char *input;
+	size_t input_len;
+
+	/* Output produced by the worker. */
+	char *output;
+	size_t output_len;
+
+	zend_long level;
+	zend_long encoding;
+	zend_long max_length;
+	int error;
+
+	const php_hash_ops *hash;
+};
+
+static zend_class_entry *zend_ce_fiber_offload;
+
+
+static void zend_fiber_offload_job_free(zend_fiber_job *job)
+{
+	zend_fiber_offload_job *offload;
+
+	offload = (zend_fiber_offload_job *) job;
+
+	if (offload->input != NULL) {
+		pefree(offload->input, 1);
+	}
+
+	if (offload->output != NULL) {
+		pefree(offload->output, 1);
+	}
+
+	pefree(offload, 1);
+}
+
+
+static zend_fiber_offload_job *zend_fiber_offload_job_create(void (* run)(zend_fiber_job *job), zend_string *input)
+{
+	zend_fiber_offload_job *job;
+
+	job = pecalloc(1, sizeof(zend_fiber_offload_job), 1);
+	job->job.run = run;
+	job->job.free = zend_fiber_offload_job_free;
+
+	job->input_len = ZSTR_LEN(input);
+	job->input = pemalloc(job->input_len + 1, 1);
+
+	memcpy(job->input, ZSTR_VAL(input), job->input_len + 1);
+
+	return job;
+}
+
+
+/* Runs small inputs inline, copying them to a worker costs more than it saves. */
+static zend_bool zend_fiber_offload_await(zend_fiber_offload_job *job)
+{
+	if (job->input_len < (size_t) FIBER_G(offload_threshold)) {
+		job->job.run(&job->job);
+		return 1;
+	}
+
+	return zend_fiber_thread_pool_await(&job->job);
+}
+
+
+/* {{{ hash */
+static void zend_fiber_offload_run_hash(zend_fiber_job *job)
+{
+	zend_fiber_offload_job *offload;
+	void *context;
+	size_t offset;
+	size_t length;
+
+	offload = (zend_fiber_offload_job *) job;
+	context = pecalloc(1, offload->hash->context_size, 1);
+
+	offload->output_len = offload->hash->digest_size;
+	offload->output = pemalloc(offload->output_len, 1);
+
+#if PHP_VERSION_ID >= 80100
+	offload->hash->hash_init(context, NULL);
+#else
+	offload->hash->hash_init(context);
+#endif
+
+	/* Before PHP 8.0 the length passed to hash_update() is an unsigned int. */
+	for (offset = 0; offset < offload->input_len; offset += length) {
+		length = MIN(offload->input_len - offset, ZEND_FIBER_OFFLOAD_CHUNK);
+		offload->hash->hash_update(context, (const unsigned char *) offload->input + offset, length);
+	}
+
+	offload->hash->hash_final((unsigned char *) offload->output, context);
+
+	pefree(context, 1);
+}
+/* }}} */
+
+
+#ifdef HAVE_FIBER_ZLIB
+/* {{{ compress / decompress */
+static void zend_fiber_offload_run_compress(zend_fiber_job *job)
+{
+	zend_fiber_offload_job *offload;
+	z_stream stream;
+	size_t remaining_in;
+	size_t remaining_out;
+
+	offload = (zend_fiber_offload_job *) job;
+	memset(&stream, 0, sizeof(stream));
+
+	/* The bound is computed in uLong, which has 32 bits on Windows. */
+	if (offload->input_len > (size_t) (uLong) -1 / 2) {
+		offload->error = Z_BUF_ERROR;
+		return;
+	}
+
+	offload->error = deflateInit2(&stream, (int) offload->level, Z_DEFLATED, (int) offload->encoding, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+
+	if (offload->error != Z_OK) {
+		return;
+	}
+
+	offload->output_len = deflateBound(&stream, offload->input_len);
+	offload->output = pemalloc(offload->output_len, 1);
+
+	stream.next_in = (Bytef *) offload->input;
+	stream.next_out = (Bytef *) offload->output;
+	remaining_in = offload->input_len;
+	remaining_out = offload->output_len;
+
+	do {
+		if (stream.avail_in == 0 && remaining_in > 0) {
+			stream.avail_in = (uInt) MIN(remaining_in, ZEND_FIBER_OFFLOAD_CHUNK);
+			remaining_in -= stream.avail_in;
+		}
+
+		if (stream.avail_out == 0 && remaining_out > 0) {
+			stream.avail_out = (uInt) MIN(remaining_out, ZEND_FIBER_OFFLOAD_CHUNK);
+			remaining_out -= stream.avail_out;
+		}
+
+		offload->error = deflate(&stream, remaining_in == 0 ? Z_FINISH : Z_NO_FLUSH);
+	} while (offload->error == Z_OK || (offload->error == Z_BUF_ERROR && stream.avail_out == 0 && remaining_out > 0));
+
+	if (offload->error == Z_STREAM_END) {
+		offload->error = Z_OK;
+		offload->output_len = (char *) stream.next_out - offload->output;
+	} else if (offload->error == Z_OK) {
+		offload->error = Z_BUF_ERROR;
+	}
+
+	deflateEnd(&stream);
+}
+
+static void zend_fiber_offload_run_decompress(zend_fiber_job *job)
+{
+	zend_fiber_offload_job *offload;
+	z_stream stream;
+	size_t capacity;
+	size_t produced;
+	size_t remaining;
+	uInt available;
+
+	offload = (zend_fiber_offload_job *) job;
+	memset(&stream, 0, sizeof(stream));
+
+	offload->error = inflateInit2(&stream, (int) offload->encoding);
+
+	if (offload->error != Z_OK) {
+		return;
+	}
+
+	capacity = MAX(offload->input_len * 4, 4096);
+
+	if (offload->max_length > 0 && capacity > (size_t) offload->max_length) {
+		capacity = (size_t) offload->max_length;
+	}
+
+	offload->output = pemalloc(capacity, 1);
+
+	stream.next_in = (Bytef *) offload->input;
+	remaining = offload->input_len;
+	produced = 0;
+
+	do {
+		if (stream.avail_in == 0 && remaining > 0) {
+			stream.avail_in = (uInt) MIN(remaining, ZEND_FIBER_OFFLOAD_CHUNK);
+			remaining -= stream.avail_in;
+		}
+
+		if (produced == capacity) {
+			if (offload->max_length > 0 && capacity >= (size_t) offload->max_length) {
+				offload->error = Z_BUF_ERROR;
+				break;
+			}
+
+			capacity *= 2;
+
+			if (offload->max_length > 0 && capacity > (size_t) offload->max_length) {
+				capacity = (size_t) offload->max_length;
+			}
+
+			offload->output = perealloc(offload->output, capacity, 1);
+		}
+
+		/* total_out is a uLong, the produced length is tracked separately. */
+		available = (uInt) MIN(capacity - produced, ZEND_FIBER_OFFLOAD_CHUNK);
+		stream.next_out = (Bytef *) offload->output + produced;
+		stream.avail_out = available;
+
+		offload->error = inflate(&stream, Z_NO_FLUSH);
+		produced += available - stream.avail_out;
+	} while (offload->error == Z_OK
+		|| (offload->error == Z_BUF_ERROR && (stream.avail_out == 0 || (stream.avail_in == 0 && remaining > 0))));
+
+	if (offload->error == Z_STREAM_END) {
+		offload->error = Z_OK;
+	} else if (offload->error == Z_OK) {
+		offload->error = Z_DATA_ERROR;
+	}
+
+	offload->output_len = produced;
+
+	inflateEnd(&stream);
+}
+/* }}} */
+#endif
+
+
+/* {{{ proto string Fiber\Offload::hash(string $algo, string $data, bool $binary = false) */
+ZEND_METHOD(FiberOffload, hash)
+{
+	zend_fiber_offload_job *job;
+	const php_hash_ops *ops;
+	zend_string *algo;
+	zend_string *data;
+	zend_bool binary;
+
+	binary = 0;
+
+	ZEND_PARSE_PARAMETERS_START(2, 3)
+		Z_PARAM_STR(algo)
+		Z_PARAM_STR(data)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_BOOL(binary)
+	ZEND_PARSE_PARAMETERS_END();
+
+#if PHP_VERSION_ID >= 80000
+	ops = php_hash_fetch_ops(algo);
+#else
+	ops = php_hash_fetch_ops(ZSTR_VAL(algo), ZSTR_LEN(algo));
+#endif
+
+	if (ops == NULL) {
+		zend_throw_error(NULL, "Fiber\\Offload::hash(): Argument #1 ($algo) must be a valid hashing algorithm");
+		return;
+	}
+
+	job = zend_fiber_offload_job_create(zend_fiber_offload_run_hash, data);
+	job->hash = ops;
+
+	if (!zend_fiber_offload_await(job)) {
+		return;
+	}
+
+	if (binary) {
+		RETVAL_STRINGL(job->output, job->output_len);
+	} else {
+		RETVAL_NEW_STR(zend_string_safe_alloc(job->output_len, 2, 0, 0));
+		php_hash_bin2hex(Z_STRVAL_P(return_value), (unsigned char *) job->output, job->output_len);
+		Z_STRVAL_P(return_value)[job->output_len * 2] = '\0';
+	}
+
+	zend_fiber_offload_job_free(&job->job);
+}
+/* }}} */
+
+
+#ifdef HAVE_FIBER_ZLIB
+/* {{{ proto string Fiber\Offload::compress(string $data, int $level = -1, int $encoding = ZLIB_ENCODING_DEFLATE) */
+ZEND_METHOD(FiberOffload, compress)
+{
+	zend_fiber_offload_job *job;
+	zend_string *data;
+	zend_long level;
+	zend_long encoding;
+
+	level = -1;
+	encoding = MAX_WBITS;
+
+	ZEND_PARSE_PARAMETERS_START(1, 3)
+		Z_PARAM_STR(data)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(level)
+		Z_PARAM_LONG(encoding)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (level < -1 || level > 9) {
+		zend_throw_error(NULL, "Fiber\\Offload::compress(): Argument #2 ($level) must be between -1 and 9");
+		return;
+	}
+
+	if (encoding != -MAX_WBITS && encoding != MAX_WBITS && encoding != MAX_WBITS + 16) {
+		zend_throw_error(NULL, "Fiber\\Offload::compress(): Argument #3 ($encoding) must be one of ZLIB_ENCODING_RAW, ZLIB_ENCODING_GZIP, or ZLIB_ENCODING_DEFLATE");
+		return;
+	}
+
+	job = zend_fiber_offload_job_create(zend_fiber_offload_run_compress, data);
+	job->level = level;
+	job->encoding = encoding;
+
+	if (!zend_fiber_offload_await(job)) {
+		return;
+	}
+
+	if (job->error != Z_OK) {
+		php_error_docref(NULL, E_WARNING, "%s", zError(job->error));
+		RETVAL_FALSE;
+	} else {
+		RETVAL_STRINGL(job->output, job->output_len);
+	}
+
+	zend_fiber_offload_job_free(&job->job);
+}
+/* }}} */
+
+
+/* {{{ proto string Fiber\Offload::decompress(string $data, int $max_length = 0, int $encoding = 0) */
+ZEND_METHOD(FiberOffload, decompress)
+{
+	zend_fiber_offload_job *job;
+	zend_string *data;
+	zend_long max_length;
+	zend_long encoding;
+
+	max_length = 0;
+	encoding = 0;
+
+	ZEND_PARSE_PARAMETERS_START(1, 3)
+		Z_PARAM_STR(data)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(max_length)
+		Z_PARAM_LONG(encoding)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (max_length < 0) {
+		zend_throw_error(NULL, "Fiber\\Offload::decompress(): Argument #2 ($max_length) must be greater than or equal to 0");
+		return;
+	}
+
+	if (encoding != 0 && encoding != -MAX_WBITS && encoding != MAX_WBITS && encoding != MAX_WBITS + 16) {
+		zend_throw_error(NULL, "Fiber\\Offload::decompress(): Argument #3 ($encoding) must be 0 or one of the ZLIB_ENCODING_* constants");
+		return;
+	}
+
+	job = zend_fiber_offload_job_create(zend_fiber_offload_run_decompress, data);
+	job->max_length = max_length;
+
+	/* Zlib and gzip headers are detected automatically, raw deflate has to be requested. */
+	job->encoding = (encoding == 0) ? MAX_WBITS + 32 : encoding;
+
+	if (!zend_fiber_offload_await(job)) {
+		return;
+	}
+
+	if (job->error != Z_OK) {
+		php_error_docref(NULL, E_WARNING, "%s", zError(job->error));
+		RETVAL_FALSE;
+	} else {
+		RETVAL_STRINGL(job->output, job->output_len);
+	}
+
+	zend_fiber_offload_job_free(&job->job);
+}
+/* }}} */
+#else
+ZEND_METHOD(FiberOffload, compress)
+{
+	zend_throw_error(zend_ce_fiber_error, "Fiber extension has been compiled without zlib support");
+}
+
+ZEND_METHOD(FiberOffload, decompress)
+{
+	zend_throw_error(zend_ce_fiber_error, "Fiber extension has been compiled without zlib support");
+}
+#endif
+
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_offload_hash, 0, 2, IS_STRING, 0)
+	ZEND_ARG_TYPE_INFO(0, algo, IS_STRING, 0)
+	ZEND_ARG_TYPE_INFO(0, data, IS_STRING, 0)
+	ZEND_ARG_TYPE_INFO(0, binary, _IS_BOOL, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_offload_compress, 0, 0, 1)
+	ZEND_ARG_TYPE_INFO(0, data, IS_STRING, 0)
+	ZEND_ARG_TYPE_INFO(0, level, IS_LONG, 0)
+	ZEND_ARG_TYPE_INFO(0, encoding, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_offload_decompress, 0, 0, 1)
+	ZEND_ARG_TYPE_INFO(0, data, IS_STRING, 0)
+	ZEND_ARG_TYPE_INFO(0, max_length, IS_LONG, 0)
+	ZEND_ARG_TYPE_INFO(0, encoding, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+static const zend_function_entry fiber_offload_methods[] = {
+	ZEND_ME(FiberOffload, hash, arginfo_fiber_offload_hash, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberOffload, compress, arginfo_fiber_offload_compress, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberOffload, decompress, arginfo_fiber_offload_decompress, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_FE_END
+};
+
+
+void zend_fiber_offload_ce_register()
+{
+	zend_class_entry ce;
+
+	INIT_NS_CLASS_ENTRY(ce, "Fiber", "Offload", fiber_offload_methods);
+	zend_ce_fiber_offload = zend_register_internal_class(&ce);
+	zend_ce_fiber_offload->ce_flags |= ZEND_ACC_FINAL;
+}
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
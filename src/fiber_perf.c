@@ -0,0 +1,241 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "zend.h"
+#include "zend_API.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_perf.h"
+
+#ifdef ZEND_FIBER_PERF
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+typedef struct _zend_fiber_perf_event {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+} zend_fiber_perf_event;
+
+static const zend_fiber_perf_event zend_fiber_perf_events[ZEND_FIBER_PERF_COUNTERS] = {
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES }
+};
+
+struct _zend_fiber_perf {
+	/* Group leader is the first opened event, events the PMU does not support are skipped. */
+	int fds[ZEND_FIBER_PERF_COUNTERS];
+
+	/* Index into zend_fiber_perf_events of each value in a group read. */
+	int events[ZEND_FIBER_PERF_COUNTERS];
+	int count;
+
+	/* Values of the previous read. */
+	uint64_t last[ZEND_FIBER_PERF_COUNTERS];
+};
+
+typedef struct _zend_fiber_perf_read {
+	uint64_t nr;
+	uint64_t values[ZEND_FIBER_PERF_COUNTERS];
+} zend_fiber_perf_read;
+
+
+static int zend_fiber_perf_open(const zend_fiber_perf_event *event, int group)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+
+	attr.size = sizeof(attr);
+	attr.type = event->type;
+	attr.config = event->config;
+	attr.read_format = PERF_FORMAT_GROUP;
+
+	/* Allowed with perf_event_paranoid <= 2 for the own thread. */
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return (int) syscall(__NR_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+
+static zend_fiber_perf *zend_fiber_perf_get_state()
+{
+	zend_fiber_perf *perf;
+	zend_fiber_perf_read data;
+	int fd;
+	int i;
+
+	perf = FIBER_G(perf);
+
+	if (EXPECTED(perf != NULL) || FIBER_G(perf_failed)) {
+		return perf;
+	}
+
+	perf = pecalloc(1, sizeof(zend_fiber_perf), 1);
+
+	for (i = 0; i < ZEND_FIBER_PERF_COUNTERS; i++) {
+		fd = zend_fiber_perf_open(&zend_fiber_perf_events[i], (perf->count == 0) ? -1 : perf->fds[0]);
+
+		if (fd < 0) {
+			/* Without the leader (usually EACCES due to perf_event_paranoid) nothing can be counted. */
+			if (perf->count == 0 && (errno == EACCES || errno == EPERM || errno == ENOSYS)) {
+				break;
+			}
+
+			continue;
+		}
+
+		perf->fds[perf->count] = fd;
+		perf->events[perf->count] = i;
+		perf->count++;
+	}
+
+	if (perf->count == 0 || read(perf->fds[0], &data, sizeof(data)) < (ssize_t) sizeof(uint64_t)) {
+		for (i = 0; i < perf->count; i++) {
+			close(perf->fds[i]);
+		}
+
+		pefree(perf, 1);
+
+		FIBER_G(perf_failed) = 1;
+
+		return NULL;
+	}
+
+	for (i = 0; i < perf->count && i < (int) data.nr; i++) {
+		perf->last[i] = data.values[i];
+	}
+
+	FIBER_G(perf) = perf;
+
+	return perf;
+}
+
+
+void zend_fiber_perf_charge(zend_fiber *fiber)
+{
+	zend_fiber_perf *perf;
+	zend_fiber_perf_read data;
+	int i;
+
+	perf = zend_fiber_perf_get_state();
+
+	if (perf == NULL) {
+		return;
+	}
+
+	if (read(perf->fds[0], &data, sizeof(data)) < (ssize_t) sizeof(uint64_t)) {
+		return;
+	}
+
+	for (i = 0; i < perf->count && i < (int) data.nr; i++) {
+		if (fiber != NULL) {
+			fiber->perf[perf->events[i]] += data.values[i] - perf->last[i];
+		}
+
+		perf->last[i] = data.values[i];
+	}
+}
+
+
+void zend_fiber_perf_get(zend_fiber *fiber, zval *return_value)
+{
+	zend_fiber_perf *perf;
+	int i;
+
+	if (!FIBER_G(perf_counters)) {
+		return;
+	}
+
+	perf = zend_fiber_perf_get_state();
+
+	if (perf == NULL) {
+		return;
+	}
+
+	/* Include the running period of the calling fiber. */
+	if (fiber == FIBER_G(current_fiber)) {
+		zend_fiber_perf_charge(fiber);
+	}
+
+	array_init_size(return_value, perf->count);
+
+	for (i = 0; i < perf->count; i++) {
+		add_assoc_long(return_value, zend_fiber_perf_events[perf->events[i]].name, (zend_long) fiber->perf[perf->events[i]]);
+	}
+}
+
+
+void zend_fiber_perf_shutdown()
+{
+	zend_fiber_perf *perf;
+	int i;
+
+	perf = FIBER_G(perf);
+
+	if (perf == NULL) {
+		return;
+	}
+
+	for (i = 0; i < perf->count; i++) {
+		close(perf->fds[i]);
+	}
+
+	pefree(perf, 1);
+
+	FIBER_G(perf) = NULL;
+}
+
+
+void zend_fiber_perf_fork()
+{
+	/* Counters opened for pid 0 stay bound to the thread of the parent, the child opens its own on next use. */
+	zend_fiber_perf_shutdown();
+
+	FIBER_G(perf_failed) = 0;
+}
+
+#else
+
+void zend_fiber_perf_charge(zend_fiber *fiber)
+{
+}
+
+void zend_fiber_perf_get(zend_fiber *fiber, zval *return_value)
+{
+}
+
+void zend_fiber_perf_shutdown()
+{
+}
+
+void zend_fiber_perf_fork()
+{
+}
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
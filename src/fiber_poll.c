@@ -0,0 +1,683 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "zend_exceptions.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_poll.h"
+#include "fiber_uring.h"
+#include "fiber_watchdog.h"
+
+#ifndef ZEND_PARSE_PARAMETERS_NONE
+#define ZEND_PARSE_PARAMETERS_NONE() zend_parse_parameters_none()
+#endif
+
+void zend_fiber_poll_ref()
+{
+	FIBER_G(poll_pending)++;
+}
+
+
+void zend_fiber_poll_unref()
+{
+	/* Objects freed after the poller has been reset at request end still drop their registrations. */
+	if (EXPECTED(FIBER_G(poll_pending) > 0)) {
+		FIBER_G(poll_pending)--;
+	}
+}
+
+
+/* Resumes a parked fiber, an error that is already being thrown is kept and chained. */
+void zend_fiber_poll_wake(zend_fiber *fiber)
+{
+	zend_object *exception;
+
+	if (fiber->status != ZEND_FIBER_STATUS_SUSPENDED || (fiber->flags & (ZEND_FIBER_FLAG_PARKED | ZEND_FIBER_FLAG_ORPHANED)) != ZEND_FIBER_FLAG_PARKED) {
+		return;
+	}
+
+	GC_ADDREF(&fiber->std);
+
+	exception = EG(exception);
+	EG(exception) = NULL;
+
+	zend_fiber_do_resume(fiber, NULL);
+
+	if (exception != NULL) {
+		if (EG(exception)) {
+			zend_exception_set_previous(EG(exception), exception);
+		} else {
+			EG(exception) = exception;
+		}
+	}
+
+	OBJ_RELEASE(&fiber->std);
+}
+
+
+/* Resumes the fiber from the next dispatch of the poller instead of from the caller, used to wake a fiber from a
+ * context that must not switch (a finishing fiber). */
+void zend_fiber_poll_defer(zend_fiber *fiber)
+{
+	if (FIBER_G(poll_deferred_count) == FIBER_G(poll_deferred_size)) {
+		FIBER_G(poll_deferred_size) = MAX(FIBER_G(poll_deferred_size) * 2, 8);
+		FIBER_G(poll_deferred) = erealloc(FIBER_G(poll_deferred), FIBER_G(poll_deferred_size) * sizeof(zend_fiber *));
+	}
+
+	FIBER_G(poll_deferred)[FIBER_G(poll_deferred_count)++] = fiber;
+	GC_ADDREF(&fiber->std);
+
+	zend_fiber_poll_ref();
+}
+
+
+/* Resumes deferred fibers, returns their number. */
+static int zend_fiber_poll_run_deferred()
+{
+	zend_fiber **fibers;
+	uint32_t count;
+	uint32_t i;
+	int total;
+
+	total = 0;
+
+	/* Resumed fibers may defer further wakes, take the batch out first. */
+	while (FIBER_G(poll_deferred_count) > 0) {
+		fibers = FIBER_G(poll_deferred);
+		count = FIBER_G(poll_deferred_count);
+
+		FIBER_G(poll_deferred) = NULL;
+		FIBER_G(poll_deferred_count) = 0;
+		FIBER_G(poll_deferred_size) = 0;
+
+		for (i = 0; i < count; i++) {
+			zend_fiber_poll_unref();
+			zend_fiber_poll_wake(fibers[i]);
+			OBJ_RELEASE(&fibers[i]->std);
+		}
+
+		efree(fibers);
+		total += count;
+	}
+
+	return total;
+}
+
+
+static void zend_fiber_poll_drop_deferred()
+{
+	zend_fiber **fibers;
+	uint32_t count;
+	uint32_t i;
+
+	fibers = FIBER_G(poll_deferred);
+	count = FIBER_G(poll_deferred_count);
+
+	FIBER_G(poll_deferred) = NULL;
+	FIBER_G(poll_deferred_count) = 0;
+	FIBER_G(poll_deferred_size) = 0;
+
+	for (i = 0; i < count; i++) {
+		OBJ_RELEASE(&fibers[i]->std);
+	}
+
+	if (fibers != NULL) {
+		efree(fibers);
+	}
+}
+
+
+#ifdef ZEND_FIBER_POLL
+
+static zend_class_entry *zend_ce_fiber_poller;
+
+
+static zend_bool zend_fiber_poll_init()
+{
+	if (EXPECTED(FIBER_G(poll_fd) >= 0)) {
+		return 1;
+	}
+
+	FIBER_G(poll_fd) = epoll_create1(EPOLL_CLOEXEC);
+
+	if (FIBER_G(poll_fd) < 0) {
+		zend_throw_error(NULL, "Failed to create native poller: %s", strerror(errno));
+		return 0;
+	}
+
+	return 1;
+}
+
+
+void zend_fiber_poll_abandon(zend_fiber *fiber)
+{
+	zend_fiber_unpark_func unpark;
+	void *data;
+
+	unpark = fiber->unpark;
+	data = fiber->unpark_data;
+
+	if (unpark == NULL) {
+		return;
+	}
+
+	zend_fiber_unpark(fiber);
+
+	unpark(fiber, data);
+}
+
+
+void zend_fiber_poll_abandon_all()
+{
+	zend_fiber *fiber;
+
+	for (fiber = FIBER_G(fibers); fiber != NULL; fiber = fiber->registry_next) {
+		zend_fiber_poll_abandon(fiber);
+	}
+}
+
+
+/* Inserts the waiter into the timer list, most waits share one timeout so the scan starts at the last deadline. */
+static void zend_fiber_poll_timer_add(zend_fiber_poll_waiter *waiter, zend_long timeout)
+{
+	zend_fiber_poll_waiter *prev;
+
+	waiter->deadline = zend_fiber_clock() + (uint64_t) timeout * 1000000 + 1;
+
+	prev = FIBER_G(poll_timers_last);
+
+	while (prev != NULL && prev->deadline > waiter->deadline) {
+		prev = prev->timer_prev;
+	}
+
+	waiter->timer_prev = prev;
+
+	if (prev == NULL) {
+		waiter->timer_next = FIBER_G(poll_timers);
+		FIBER_G(poll_timers) = waiter;
+	} else {
+		waiter->timer_next = prev->timer_next;
+		prev->timer_next = waiter;
+	}
+
+	if (waiter->timer_next == NULL) {
+		FIBER_G(poll_timers_last) = waiter;
+	} else {
+		waiter->timer_next->timer_prev = waiter;
+	}
+}
+
+
+static void zend_fiber_poll_timer_remove(zend_fiber_poll_waiter *waiter)
+{
+	if (waiter->deadline == 0) {
+		return;
+	}
+
+	if (waiter->timer_prev == NULL) {
+		FIBER_G(poll_timers) = waiter->timer_next;
+	} else {
+		waiter->timer_prev->timer_next = waiter->timer_next;
+	}
+
+	if (waiter->timer_next == NULL) {
+		FIBER_G(poll_timers_last) = waiter->timer_prev;
+	} else {
+		waiter->timer_next->timer_prev = waiter->timer_prev;
+	}
+
+	waiter->deadline = 0;
+	waiter->timer_prev = NULL;
+	waiter->timer_next = NULL;
+}
+
+
+/* Shortens the epoll_wait() timeout (in milliseconds) to the nearest deadline. */
+static int zend_fiber_poll_timeout(int timeout)
+{
+	uint64_t now;
+	uint64_t remaining;
+
+	if (FIBER_G(poll_timers) == NULL) {
+		return timeout;
+	}
+
+	now = zend_fiber_clock();
+
+	if (FIBER_G(poll_timers)->deadline <= now) {
+		return 0;
+	}
+
+	remaining = (FIBER_G(poll_timers)->deadline - now + 999999) / 1000000;
+
+	if (timeout < 0 || remaining < (uint64_t) timeout) {
+		return remaining > INT_MAX ? INT_MAX : (int) remaining;
+	}
+
+	return timeout;
+}
+
+
+/* Ends all waits whose deadline has passed, returns the number of expired waiters. */
+static int zend_fiber_poll_expire()
+{
+	zend_fiber_poll_waiter *waiter;
+	zend_fiber *fiber;
+	uint64_t now;
+	int count;
+
+	if (FIBER_G(poll_timers) == NULL) {
+		return 0;
+	}
+
+	now = zend_fiber_clock();
+	count = 0;
+
+	/* Waiters added by resumed fibers have a later deadline than now. */
+	while (FIBER_G(poll_timers) != NULL && FIBER_G(poll_timers)->deadline <= now) {
+		waiter = FIBER_G(poll_timers);
+
+		zend_fiber_poll_timer_remove(waiter);
+
+		epoll_ctl(FIBER_G(poll_fd), EPOLL_CTL_DEL, waiter->fd, NULL);
+		zend_fiber_poll_unref();
+
+		waiter->expired = 1;
+		fiber = waiter->fiber;
+		count++;
+
+		if (fiber != NULL) {
+			GC_ADDREF(&fiber->std);
+			zend_fiber_poll_wake(fiber);
+			OBJ_RELEASE(&fiber->std);
+		}
+	}
+
+	return count;
+}
+
+
+/* Removes a waiter that has neither reported events nor expired. */
+static void zend_fiber_poll_cancel(zend_fiber_poll_waiter *waiter)
+{
+	if (waiter->revents != 0 || waiter->expired) {
+		return;
+	}
+
+	zend_fiber_poll_timer_remove(waiter);
+
+	epoll_ctl(FIBER_G(poll_fd), EPOLL_CTL_DEL, waiter->fd, NULL);
+	zend_fiber_poll_unref();
+}
+
+
+static void zend_fiber_poll_unpark(zend_fiber *fiber, void *data)
+{
+	/* Dispatch has already removed the descriptor if it has reported events or expired. */
+	zend_fiber_poll_cancel((zend_fiber_poll_waiter *) data);
+}
+
+
+uint32_t zend_fiber_poll_await(int fd, uint32_t events)
+{
+	return zend_fiber_poll_await_timeout(fd, events, -1);
+}
+
+
+uint32_t zend_fiber_poll_await_timeout(int fd, uint32_t events, zend_long timeout)
+{
+	zend_fiber_poll_waiter waiter;
+	struct epoll_event event;
+	zend_fiber *fiber;
+
+	if (!zend_fiber_poll_init()) {
+		return 0;
+	}
+
+	fiber = FIBER_G(current_fiber);
+
+	waiter.fd = fd;
+	waiter.events = events;
+	waiter.revents = 0;
+	waiter.fiber = fiber;
+	waiter.handler = NULL;
+	waiter.deadline = 0;
+	waiter.timer_prev = NULL;
+	waiter.timer_next = NULL;
+	waiter.expired = 0;
+
+	event.events = events | EPOLLONESHOT;
+	event.data.ptr = &waiter;
+
+	if (epoll_ctl(FIBER_G(poll_fd), EPOLL_CTL_ADD, fd, &event) == -1) {
+		if (errno == EPERM) {
+			/* Regular files and directories are always ready. */
+			return events;
+		}
+
+		if (errno == EEXIST) {
+			zend_throw_error(zend_ce_fiber_error, "File descriptor %d is already being awaited", fd);
+		} else {
+			zend_throw_error(NULL, "Failed to watch file descriptor %d: %s", fd, strerror(errno));
+		}
+
+		return 0;
+	}
+
+	zend_fiber_poll_ref();
+
+	/* Timeouts beyond a century are treated as none, the deadline must not overflow. */
+	if (timeout >= 0 && (uint64_t) timeout < (UINT64_C(1) << 42)) {
+		zend_fiber_poll_timer_add(&waiter, timeout);
+	}
+
+	if (fiber == NULL) {
+		while (waiter.revents == 0 && !waiter.expired && !EG(exception)) {
+			if (zend_fiber_poll_dispatch(-1) < 0) {
+				break;
+			}
+		}
+	} else {
+		zend_fiber_park(fiber, zend_fiber_poll_unpark, &waiter);
+
+		while (waiter.revents == 0 && !waiter.expired && !EG(exception)) {
+			zend_fiber_do_suspend(fiber, NULL, NULL);
+		}
+
+		zend_fiber_unpark(fiber);
+	}
+
+	if (waiter.revents == 0) {
+		zend_fiber_poll_cancel(&waiter);
+
+		return 0;
+	}
+
+	return waiter.revents;
+}
+
+
+zend_bool zend_fiber_poll_add_handler(zend_fiber_poll_waiter *waiter)
+{
+	struct epoll_event event;
+
+	if (!zend_fiber_poll_init()) {
+		return 0;
+	}
+
+	event.events = waiter->events;
+	event.data.ptr = waiter;
+
+	if (epoll_ctl(FIBER_G(poll_fd), EPOLL_CTL_ADD, waiter->fd, &event) == -1) {
+		zend_throw_error(NULL, "Failed to watch file descriptor %d: %s", waiter->fd, strerror(errno));
+		return 0;
+	}
+
+	return 1;
+}
+
+
+void zend_fiber_poll_remove_handler(zend_fiber_poll_waiter *waiter)
+{
+	if (FIBER_G(poll_fd) >= 0) {
+		epoll_ctl(FIBER_G(poll_fd), EPOLL_CTL_DEL, waiter->fd, NULL);
+	}
+}
+
+
+int zend_fiber_poll_dispatch(int timeout)
+{
+	struct epoll_event events[ZEND_FIBER_POLL_BATCH];
+	zend_fiber_poll_waiter *handlers[ZEND_FIBER_POLL_BATCH];
+	zend_fiber *fibers[ZEND_FIBER_POLL_BATCH];
+	zend_fiber_poll_waiter *waiter;
+	int handler_count;
+	int fiber_count;
+	int count;
+	int i;
+
+	if (FIBER_G(poll_pending) == 0) {
+		return 0;
+	}
+
+	if (FIBER_G(poll_fd) < 0) {
+		return zend_fiber_poll_run_deferred();
+	}
+
+	zend_fiber_uring_flush();
+
+	/* Deferred wakes are due now, only collect what is ready already. */
+	count = epoll_wait(FIBER_G(poll_fd), events, ZEND_FIBER_POLL_BATCH,
+		FIBER_G(poll_deferred_count) > 0 ? 0 : zend_fiber_poll_timeout(timeout));
+
+	if (count < 0) {
+		if (errno == EINTR) {
+			return 0;
+		}
+
+		zend_throw_error(NULL, "Failed to poll for events: %s", strerror(errno));
+		return -1;
+	}
+
+	handler_count = 0;
+	fiber_count = 0;
+
+	/* Collect everything first, resumed fibers may register new waiters. */
+	for (i = 0; i < count; i++) {
+		waiter = (zend_fiber_poll_waiter *) events[i].data.ptr;
+		waiter->revents = events[i].events;
+
+		if (waiter->handler != NULL) {
+			handlers[handler_count++] = waiter;
+			continue;
+		}
+
+		zend_fiber_poll_timer_remove(waiter);
+
+		epoll_ctl(FIBER_G(poll_fd), EPOLL_CTL_DEL, waiter->fd, NULL);
+		zend_fiber_poll_unref();
+
+		if (waiter->fiber != NULL) {
+			fibers[fiber_count] = waiter->fiber;
+			GC_ADDREF(&fibers[fiber_count]->std);
+			fiber_count++;
+		}
+	}
+
+	for (i = 0; i < handler_count; i++) {
+		handlers[i]->handler(handlers[i]);
+	}
+
+	for (i = 0; i < fiber_count; i++) {
+		zend_fiber_poll_wake(fibers[i]);
+		OBJ_RELEASE(&fibers[i]->std);
+	}
+
+	count += zend_fiber_poll_expire();
+
+	return count + zend_fiber_poll_run_deferred();
+}
+
+
+void zend_fiber_poll_fork()
+{
+	zend_fiber *fiber;
+
+	/* The epoll instance is shared with the parent, nothing must be removed from it. */
+	if (FIBER_G(poll_fd) >= 0) {
+		close(FIBER_G(poll_fd));
+		FIBER_G(poll_fd) = -1;
+	}
+
+	FIBER_G(poll_pending) = 0;
+	FIBER_G(poll_timers) = NULL;
+	FIBER_G(poll_timers_last) = NULL;
+
+	zend_fiber_poll_drop_deferred();
+
+	for (fiber = FIBER_G(fibers); fiber != NULL; fiber = fiber->registry_next) {
+		if (fiber->flags & ZEND_FIBER_FLAG_PARKED) {
+			fiber->flags |= ZEND_FIBER_FLAG_ORPHANED;
+			fiber->unpark = NULL;
+			fiber->unpark_data = NULL;
+		}
+	}
+}
+
+
+void zend_fiber_poll_shutdown()
+{
+	if (FIBER_G(poll_fd) >= 0) {
+		close(FIBER_G(poll_fd));
+		FIBER_G(poll_fd) = -1;
+	}
+
+	FIBER_G(poll_pending) = 0;
+	FIBER_G(poll_timers) = NULL;
+	FIBER_G(poll_timers_last) = NULL;
+
+	zend_fiber_poll_drop_deferred();
+}
+
+
+/* {{{ proto int Fiber\Poller::poll(int $timeout = -1) */
+ZEND_METHOD(FiberPoller, poll)
+{
+	zend_long timeout;
+	int count;
+
+	timeout = -1;
+
+	ZEND_PARSE_PARAMETERS_START(0, 1)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(timeout)
+	ZEND_PARSE_PARAMETERS_END();
+
+	count = zend_fiber_poll_dispatch((timeout < 0 || timeout > INT_MAX) ? -1 : (int) timeout);
+
+	if (count < 0) {
+		return;
+	}
+
+	RETURN_LONG(count);
+}
+/* }}} */
+
+
+/* {{{ proto void Fiber\Poller::run() */
+ZEND_METHOD(FiberPoller, run)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	while (FIBER_G(poll_pending) > 0 && !EG(exception)) {
+		if (zend_fiber_poll_dispatch(-1) < 0) {
+			return;
+		}
+	}
+}
+/* }}} */
+
+
+/* {{{ proto int Fiber\Poller::count() */
+ZEND_METHOD(FiberPoller, count)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	RETURN_LONG(FIBER_G(poll_pending));
+}
+/* }}} */
+
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_poller_poll, 0, 0, IS_LONG, 0)
+	ZEND_ARG_TYPE_INFO(0, timeout, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_fiber_poller_run, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_poller_count, 0, 0, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+static const zend_function_entry fiber_poller_methods[] = {
+	ZEND_ME(FiberPoller, poll, arginfo_fiber_poller_poll, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberPoller, run, arginfo_fiber_poller_run, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberPoller, count, arginfo_fiber_poller_count, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_FE_END
+};
+
+
+void zend_fiber_poll_ce_register()
+{
+	zend_class_entry ce;
+
+	INIT_NS_CLASS_ENTRY(ce, "Fiber", "Poller", fiber_poller_methods);
+	zend_ce_fiber_poller = zend_register_internal_class(&ce);
+	zend_ce_fiber_poller->ce_flags |= ZEND_ACC_FINAL;
+}
+
+#else
+
+uint32_t zend_fiber_poll_await(int fd, uint32_t events)
+{
+	zend_throw_error(NULL, "Native poller is not supported on this platform");
+	return 0;
+}
+
+uint32_t zend_fiber_poll_await_timeout(int fd, uint32_t events, zend_long timeout)
+{
+	zend_throw_error(NULL, "Native poller is not supported on this platform");
+	return 0;
+}
+
+int zend_fiber_poll_dispatch(int timeout)
+{
+	return zend_fiber_poll_run_deferred();
+}
+
+void zend_fiber_poll_abandon(zend_fiber *fiber)
+{
+}
+
+void zend_fiber_poll_abandon_all()
+{
+}
+
+void zend_fiber_poll_ce_register()
+{
+}
+
+void zend_fiber_poll_shutdown()
+{
+	FIBER_G(poll_pending) = 0;
+
+	zend_fiber_poll_drop_deferred();
+}
+
+void zend_fiber_poll_fork()
+{
+}
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,519 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "zend_exceptions.h"
+#include "ext/standard/proc_open.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_poll.h"
+#include "fiber_process.h"
+
+#if defined(ZEND_FIBER_POLL) && defined(HAVE_SYS_SIGNALFD_H)
+
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#define ZEND_FIBER_SIGNAL_BATCH 16
+
+typedef struct _zend_fiber_signal_waiter zend_fiber_signal_waiter;
+
+struct _zend_fiber_signal_waiter {
+	int signo;
+
+	/* Fiber waiting for the signal, NULL when awaited from main thread. */
+	zend_fiber *fiber;
+
+	struct signalfd_siginfo info;
+	zend_bool done;
+
+	zend_fiber_signal_waiter *prev;
+	zend_fiber_signal_waiter *next;
+};
+
+struct _zend_fiber_signal_state {
+	/* Signalfd registered with the native poller. */
+	zend_fiber_poll_waiter waiter;
+
+	/* Signals currently delivered through the signalfd. */
+	sigset_t mask;
+
+	/* Signals that had already been blocked by someone else, they are not unblocked again. */
+	sigset_t blocked;
+
+	/* Number of waiters per signal. */
+	uint32_t counts[_NSIG];
+
+	zend_fiber_signal_waiter *head;
+};
+
+static zend_class_entry *zend_ce_fiber_process;
+static zend_class_entry *zend_ce_fiber_signal;
+
+static int le_proc_open = 0;
+
+
+/* {{{ signals */
+static void zend_fiber_signal_dispatch(zend_fiber_poll_waiter *waiter)
+{
+	zend_fiber_signal_state *state;
+	zend_fiber_signal_waiter *entry;
+	struct signalfd_siginfo info[ZEND_FIBER_SIGNAL_BATCH];
+	zend_fiber **fibers;
+	uint32_t count;
+	uint32_t size;
+	uint32_t i;
+	ssize_t length;
+	ssize_t j;
+
+	state = FIBER_G(signals);
+	fibers = NULL;
+	count = 0;
+	size = 0;
+
+	while ((length = read(waiter->fd, info, sizeof(info))) > 0) {
+		for (j = 0; j < length / (ssize_t) sizeof(struct signalfd_siginfo); j++) {
+			/* Every waiter of the signal is woken, waiters remove themselves once they have been resumed. */
+			for (entry = state->head; entry != NULL; entry = entry->next) {
+				if (entry->done || entry->signo != (int) info[j].ssi_signo) {
+					continue;
+				}
+
+				entry->info = info[j];
+				entry->done = 1;
+
+				if (entry->fiber != NULL) {
+					if (count == size) {
+						size = MAX(size * 2, 8);
+						fibers = erealloc(fibers, size * sizeof(zend_fiber *));
+					}
+
+					fibers[count++] = entry->fiber;
+					GC_ADDREF(&entry->fiber->std);
+				}
+			}
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		zend_fiber_poll_wake(fibers[i]);
+		OBJ_RELEASE(&fibers[i]->std);
+	}
+
+	if (fibers != NULL) {
+		efree(fibers);
+	}
+}
+
+
+static zend_fiber_signal_state *zend_fiber_signal_get()
+{
+	zend_fiber_signal_state *state;
+
+	state = FIBER_G(signals);
+
+	if (EXPECTED(state != NULL)) {
+		return state;
+	}
+
+	state = pecalloc(1, sizeof(zend_fiber_signal_state), 1);
+
+	sigemptyset(&state->mask);
+	sigemptyset(&state->blocked);
+
+	state->waiter.fd = signalfd(-1, &state->mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	state->waiter.events = EPOLLIN;
+	state->waiter.handler = zend_fiber_signal_dispatch;
+
+	if (state->waiter.fd < 0) {
+		zend_throw_error(NULL, "Failed to create signalfd: %s", strerror(errno));
+		pefree(state, 1);
+		return NULL;
+	}
+
+	if (!zend_fiber_poll_add_handler(&state->waiter)) {
+		close(state->waiter.fd);
+		pefree(state, 1);
+		return NULL;
+	}
+
+	FIBER_G(signals) = state;
+
+	return state;
+}
+
+
+/* Routes the signal into the signalfd, it has to be blocked to not be delivered the regular way. */
+static zend_bool zend_fiber_signal_add(zend_fiber_signal_state *state, int signo)
+{
+	sigset_t set;
+	sigset_t prev;
+
+	sigemptyset(&set);
+	sigaddset(&set, signo);
+
+	if (sigprocmask(SIG_BLOCK, &set, &prev) != 0) {
+		zend_throw_error(NULL, "Failed to block signal %d: %s", signo, strerror(errno));
+		return 0;
+	}
+
+	if (sigismember(&prev, signo)) {
+		sigaddset(&state->blocked, signo);
+	}
+
+	sigaddset(&state->mask, signo);
+
+	if (signalfd(state->waiter.fd, &state->mask, 0) < 0) {
+		zend_throw_error(NULL, "Failed to watch signal %d: %s", signo, strerror(errno));
+		return 0;
+	}
+
+	return 1;
+}
+
+
+static void zend_fiber_signal_remove(zend_fiber_signal_state *state, int signo)
+{
+	sigset_t set;
+
+	sigdelset(&state->mask, signo);
+	signalfd(state->waiter.fd, &state->mask, 0);
+
+	if (sigismember(&state->blocked, signo)) {
+		sigdelset(&state->blocked, signo);
+		return;
+	}
+
+	sigemptyset(&set);
+	sigaddset(&set, signo);
+	sigprocmask(SIG_UNBLOCK, &set, NULL);
+}
+
+
+/* Unlinks a waiter that has been woken or is being abandoned, the signal is unblocked once nobody waits for it. */
+static void zend_fiber_signal_leave(zend_fiber_signal_state *state, zend_fiber_signal_waiter *waiter)
+{
+	zend_fiber_poll_unref();
+
+	if (waiter->prev != NULL) {
+		waiter->prev->next = waiter->next;
+	} else {
+		state->head = waiter->next;
+	}
+
+	if (waiter->next != NULL) {
+		waiter->next->prev = waiter->prev;
+	}
+
+	if (--state->counts[waiter->signo] == 0) {
+		zend_fiber_signal_remove(state, waiter->signo);
+	}
+}
+
+
+static void zend_fiber_signal_unpark(zend_fiber *fiber, void *data)
+{
+	zend_fiber_signal_leave(FIBER_G(signals), (zend_fiber_signal_waiter *) data);
+}
+
+
+/* Links a waiter for the signal, deliveries are routed into the signalfd from now on until it leaves. */
+static zend_bool zend_fiber_signal_enter(zend_fiber_signal_state *state, zend_fiber_signal_waiter *waiter, int signo)
+{
+	if (state->counts[signo] == 0 && !zend_fiber_signal_add(state, signo)) {
+		return 0;
+	}
+
+	state->counts[signo]++;
+
+	memset(waiter, 0, sizeof(zend_fiber_signal_waiter));
+	waiter->signo = signo;
+	waiter->fiber = FIBER_G(current_fiber);
+	waiter->next = state->head;
+
+	if (state->head != NULL) {
+		state->head->prev = waiter;
+	}
+
+	state->head = waiter;
+
+	zend_fiber_poll_ref();
+
+	return 1;
+}
+
+
+/* Suspends until the waiter has received its signal, returns 0 if an error is being thrown. */
+static zend_bool zend_fiber_signal_park(zend_fiber_signal_waiter *waiter)
+{
+	if (waiter->fiber == NULL) {
+		while (!waiter->done && !EG(exception)) {
+			if (zend_fiber_poll_dispatch(-1) < 0) {
+				break;
+			}
+		}
+	} else {
+		zend_fiber_park(waiter->fiber, zend_fiber_signal_unpark, waiter);
+
+		while (!waiter->done && !EG(exception)) {
+			zend_fiber_do_suspend(waiter->fiber, NULL, NULL);
+		}
+
+		zend_fiber_unpark(waiter->fiber);
+	}
+
+	return waiter->done;
+}
+
+
+void zend_fiber_signal_shutdown()
+{
+	zend_fiber_signal_state *state;
+	int signo;
+
+	state = FIBER_G(signals);
+
+	if (state == NULL) {
+		return;
+	}
+
+	for (signo = 1; signo < _NSIG; signo++) {
+		if (sigismember(&state->mask, signo)) {
+			zend_fiber_signal_remove(state, signo);
+		}
+	}
+
+	zend_fiber_poll_remove_handler(&state->waiter);
+	close(state->waiter.fd);
+
+	pefree(state, 1);
+
+	FIBER_G(signals) = NULL;
+}
+/* }}} */
+
+
+/* {{{ processes */
+/* Waits for SIGCHLD through the signalfd and checks the child with WNOHANG, used if pidfd_open() is not available.
+ * The signal is routed before the first check, an exit in between leaves it pending in the signalfd. */
+static zend_bool zend_fiber_process_wait_signal(pid_t pid, siginfo_t *info)
+{
+	zend_fiber_signal_state *state;
+	zend_fiber_signal_waiter waiter;
+	zend_bool result;
+
+	state = zend_fiber_signal_get();
+
+	if (state == NULL || !zend_fiber_signal_enter(state, &waiter, SIGCHLD)) {
+		return 0;
+	}
+
+	while (1) {
+		memset(info, 0, sizeof(siginfo_t));
+
+		if (waitid(P_PID, pid, info, WEXITED | WNOHANG | WNOWAIT) != 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			php_error_docref(NULL, E_WARNING, "Failed to wait for process %d: %s", (int) pid, strerror(errno));
+			result = 0;
+			break;
+		}
+
+		if (info->si_pid == pid) {
+			result = 1;
+			break;
+		}
+
+		/* Any child may have raised the signal, coalesced deliveries are covered by checking again. */
+		waiter.done = 0;
+
+		if (!zend_fiber_signal_park(&waiter)) {
+			result = 0;
+			break;
+		}
+	}
+
+	zend_fiber_signal_leave(state, &waiter);
+
+	return result;
+}
+
+
+static int zend_fiber_pidfd_open(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	return (int) syscall(SYS_pidfd_open, pid, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+/* }}} */
+
+
+/* {{{ proto int|false Fiber\Process::wait(resource $process) */
+ZEND_METHOD(FiberProcess, wait)
+{
+	php_process_handle *proc;
+	siginfo_t info;
+	zval *zproc;
+	pid_t pid;
+	int fd;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_RESOURCE(zproc)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (le_proc_open == 0) {
+		le_proc_open = zend_fetch_list_dtor_id("process");
+	}
+
+	proc = (php_process_handle *) zend_fetch_resource(Z_RES_P(zproc), "process", le_proc_open);
+
+	if (proc == NULL) {
+		return;
+	}
+
+	pid = proc->child;
+	fd = zend_fiber_pidfd_open(pid);
+
+	if (fd >= 0) {
+		if (zend_fiber_poll_await(fd, EPOLLIN) == 0) {
+			close(fd);
+			return;
+		}
+
+		close(fd);
+
+		/* The child is left as a zombie, proc_close() and proc_get_status() still report its status. */
+		while (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) != 0) {
+			if (errno != EINTR) {
+				php_error_docref(NULL, E_WARNING, "Failed to wait for process %d: %s", (int) pid, strerror(errno));
+				RETURN_FALSE;
+			}
+		}
+	} else if (errno == ESRCH) {
+		php_error_docref(NULL, E_WARNING, "Process %d has already been reaped", (int) pid);
+		RETURN_FALSE;
+	} else if (!zend_fiber_process_wait_signal(pid, &info)) {
+		if (EG(exception)) {
+			return;
+		}
+
+		RETURN_FALSE;
+	}
+
+	/* si_status holds the number of the signal that terminated the child. */
+	RETURN_LONG(info.si_code == CLD_EXITED ? info.si_status : -info.si_status);
+}
+/* }}} */
+
+
+/* {{{ proto array Fiber\Signal::await(int $signo) */
+ZEND_METHOD(FiberSignal, await)
+{
+	zend_fiber_signal_state *state;
+	zend_fiber_signal_waiter waiter;
+	zend_long signo;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_LONG(signo)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (signo <= 0 || signo >= _NSIG || signo == SIGKILL || signo == SIGSTOP) {
+		zend_throw_error(NULL, "Fiber\\Signal::await(): Argument #1 ($signo) must be a signal that can be caught");
+		return;
+	}
+
+	state = zend_fiber_signal_get();
+
+	if (state == NULL || !zend_fiber_signal_enter(state, &waiter, (int) signo)) {
+		return;
+	}
+
+	zend_fiber_signal_park(&waiter);
+	zend_fiber_signal_leave(state, &waiter);
+
+	if (!waiter.done) {
+		return;
+	}
+
+	array_init(return_value);
+	add_assoc_long(return_value, "signo", waiter.info.ssi_signo);
+	add_assoc_long(return_value, "errno", waiter.info.ssi_errno);
+	add_assoc_long(return_value, "code", waiter.info.ssi_code);
+	add_assoc_long(return_value, "pid", waiter.info.ssi_pid);
+	add_assoc_long(return_value, "uid", waiter.info.ssi_uid);
+}
+/* }}} */
+
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_process_wait, 0, 0, 1)
+	ZEND_ARG_INFO(0, process)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_signal_await, 0, 1, IS_ARRAY, 0)
+	ZEND_ARG_TYPE_INFO(0, signo, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+static const zend_function_entry fiber_process_methods[] = {
+	ZEND_ME(FiberProcess, wait, arginfo_fiber_process_wait, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_FE_END
+};
+
+static const zend_function_entry fiber_signal_methods[] = {
+	ZEND_ME(FiberSignal, await, arginfo_fiber_signal_await, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_FE_END
+};
+
+
+void zend_fiber_process_ce_register()
+{
+	zend_class_entry ce;
+
+	INIT_NS_CLASS_ENTRY(ce, "Fiber", "Process", fiber_process_methods);
+	zend_ce_fiber_process = zend_register_internal_class(&ce);
+	zend_ce_fiber_process->ce_flags |= ZEND_ACC_FINAL;
+
+	INIT_NS_CLASS_ENTRY(ce, "Fiber", "Signal", fiber_signal_methods);
+	zend_ce_fiber_signal = zend_register_internal_class(&ce);
+	zend_ce_fiber_signal->ce_flags |= ZEND_ACC_FINAL;
+}
+
+#else
+
+void zend_fiber_process_ce_register()
+{
+}
+
+void zend_fiber_signal_shutdown()
+{
+}
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,430 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "zend_exceptions.h"
+#include "zend_smart_str.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_interrupt.h"
+#include "fiber_profiler.h"
+#include "fiber_registry.h"
+
+#ifdef ZEND_FIBER_TICKER
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <time.h>
+
+#define ZEND_FIBER_PROFILER_MAX_DEPTH 128
+
+#define ZEND_FIBER_PROFILER_GROUP_NONE 0
+#define ZEND_FIBER_PROFILER_GROUP_CALLABLE 1
+#define ZEND_FIBER_PROFILER_GROUP_FIBER 2
+
+static zend_class_entry *zend_ce_fiber_profiler;
+
+struct _zend_fiber_profiler {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	zend_bool stopping;
+
+	/* CPU time clock of the profiled PHP thread. */
+	clockid_t clock;
+
+	/* Sampling interval in ns of CPU time. */
+	uint64_t interval;
+
+	/* Root frame added to every stack, one of ZEND_FIBER_PROFILER_GROUP_*. */
+	zend_long group;
+
+	/* Raised by the sampler thread. */
+	uint32_t *pending;
+	zend_fiber_vm_interrupt *vm_interrupt;
+
+	/* Folded stack => number of samples, only accessed by the PHP thread. */
+	HashTable samples;
+};
+
+
+static uint64_t zend_fiber_profiler_cpu_time(clockid_t clock)
+{
+	struct timespec ts;
+
+	if (clock_gettime(clock, &ts) != 0) {
+		return 0;
+	}
+
+	return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+
+static void *zend_fiber_profiler_run(void *arg)
+{
+	zend_fiber_profiler *profiler;
+	struct timeval now;
+	struct timespec deadline;
+	uint64_t last;
+	uint64_t cpu;
+
+	profiler = (zend_fiber_profiler *) arg;
+	last = zend_fiber_profiler_cpu_time(profiler->clock);
+
+	pthread_mutex_lock(&profiler->mutex);
+
+	while (!profiler->stopping) {
+		gettimeofday(&now, NULL);
+
+		deadline.tv_sec = now.tv_sec + (time_t) (profiler->interval / 1000000000);
+		deadline.tv_nsec = now.tv_usec * 1000 + (long) (profiler->interval % 1000000000);
+
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+
+		pthread_cond_timedwait(&profiler->cond, &profiler->mutex, &deadline);
+
+		if (profiler->stopping) {
+			break;
+		}
+
+		/* Only sample on CPU time, a thread waiting in the poller must not be charged. */
+		cpu = zend_fiber_profiler_cpu_time(profiler->clock);
+
+		if (cpu - last >= profiler->interval) {
+			zend_fiber_interrupt_raise(profiler->pending, profiler->vm_interrupt, ZEND_FIBER_INTERRUPT_SAMPLE);
+			last = cpu;
+		}
+	}
+
+	pthread_mutex_unlock(&profiler->mutex);
+
+	return NULL;
+}
+
+
+void zend_fiber_profiler_sample(zend_execute_data *execute_data)
+{
+	zend_fiber_profiler *profiler;
+	zend_execute_data *frames[ZEND_FIBER_PROFILER_MAX_DEPTH];
+	zend_execute_data *ex;
+	zend_fiber *fiber;
+	zend_string *name;
+	smart_str key = {0};
+	zval *count;
+	zval tmp;
+	int depth;
+
+	profiler = FIBER_G(profiler);
+
+	if (profiler == NULL) {
+		return;
+	}
+
+	depth = 0;
+
+	for (ex = execute_data; ex != NULL && depth < ZEND_FIBER_PROFILER_MAX_DEPTH; ex = ex->prev_execute_data) {
+		if (ex->func == NULL) {
+			continue;
+		}
+
+		/* Frames of a fiber end at its runner, the resumer is not part of the fiber's stack. */
+		if (zend_fiber_is_run_func(ex->func)) {
+			break;
+		}
+
+		frames[depth++] = ex;
+	}
+
+	fiber = FIBER_G(current_fiber);
+
+	if (profiler->group != ZEND_FIBER_PROFILER_GROUP_NONE) {
+		if (fiber == NULL) {
+			smart_str_appends(&key, "main");
+		} else {
+			name = zend_get_callable_name(&fiber->fci.function_name);
+
+			if (profiler->group == ZEND_FIBER_PROFILER_GROUP_FIBER) {
+				smart_str_appends(&key, "fiber#");
+				smart_str_append_long(&key, (zend_long) fiber->std.handle);
+				smart_str_appendc(&key, ':');
+			} else {
+				smart_str_appends(&key, "fiber:");
+			}
+
+			smart_str_append(&key, name);
+			zend_string_release(name);
+		}
+	}
+
+	while (depth-- > 0) {
+		if (key.s != NULL && ZSTR_LEN(key.s) > 0) {
+			smart_str_appendc(&key, ';');
+		}
+
+		zend_fiber_append_frame_name(&key, frames[depth]);
+	}
+
+	if (key.s == NULL) {
+		return;
+	}
+
+	smart_str_0(&key);
+
+	count = zend_hash_find(&profiler->samples, key.s);
+
+	if (count != NULL) {
+		Z_LVAL_P(count)++;
+	} else {
+		ZVAL_LONG(&tmp, 1);
+		zend_hash_add_new(&profiler->samples, key.s, &tmp);
+	}
+
+	smart_str_free(&key);
+}
+
+
+static void zend_fiber_profiler_stop(zend_fiber_profiler *profiler)
+{
+	pthread_mutex_lock(&profiler->mutex);
+	profiler->stopping = 1;
+	pthread_cond_signal(&profiler->cond);
+	pthread_mutex_unlock(&profiler->mutex);
+
+	pthread_join(profiler->thread, NULL);
+
+	pthread_cond_destroy(&profiler->cond);
+	pthread_mutex_destroy(&profiler->mutex);
+
+	FIBER_G(profiler) = NULL;
+
+	/* Drop a sample raised after the last stack has been taken. */
+	__atomic_fetch_and(profiler->pending, ~ZEND_FIBER_INTERRUPT_SAMPLE, __ATOMIC_SEQ_CST);
+}
+
+
+/* {{{ proto void Fiber\Profiler::start(int $interval = 10000, int $group = Fiber\Profiler::GROUP_CALLABLE) */
+ZEND_METHOD(FiberProfiler, start)
+{
+	zend_fiber_profiler *profiler;
+	zend_long interval;
+	zend_long group;
+	sigset_t mask;
+	sigset_t prev;
+
+	interval = 10000;
+	group = ZEND_FIBER_PROFILER_GROUP_CALLABLE;
+
+	ZEND_PARSE_PARAMETERS_START(0, 2)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(interval)
+		Z_PARAM_LONG(group)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (FIBER_G(profiler) != NULL) {
+		zend_throw_error(zend_ce_fiber_error, "Profiler is already running");
+		return;
+	}
+
+	if (interval < 100) {
+		zend_throw_error(zend_ce_fiber_error, "Sampling interval must be at least 100 microseconds");
+		return;
+	}
+
+	if (group < ZEND_FIBER_PROFILER_GROUP_NONE || group > ZEND_FIBER_PROFILER_GROUP_FIBER) {
+		zend_throw_error(zend_ce_fiber_error, "Invalid profiler grouping");
+		return;
+	}
+
+	profiler = pecalloc(1, sizeof(zend_fiber_profiler), 1);
+
+	if (pthread_getcpuclockid(pthread_self(), &profiler->clock) != 0) {
+		pefree(profiler, 1);
+		zend_throw_error(zend_ce_fiber_error, "Failed to get CPU time clock of the current thread");
+		return;
+	}
+
+	profiler->interval = (uint64_t) interval * 1000;
+	profiler->group = group;
+	profiler->pending = &FIBER_G(interrupt_pending);
+	profiler->vm_interrupt = &EG(vm_interrupt);
+
+	zend_hash_init(&profiler->samples, 64, NULL, NULL, 0);
+
+	pthread_mutex_init(&profiler->mutex, NULL);
+	pthread_cond_init(&profiler->cond, NULL);
+
+	/* Signals (timeouts, pcntl) must keep being delivered to the PHP thread. */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &prev);
+
+	if (pthread_create(&profiler->thread, NULL, zend_fiber_profiler_run, profiler) != 0) {
+		pthread_sigmask(SIG_SETMASK, &prev, NULL);
+
+		pthread_cond_destroy(&profiler->cond);
+		pthread_mutex_destroy(&profiler->mutex);
+		zend_hash_destroy(&profiler->samples);
+		pefree(profiler, 1);
+
+		zend_throw_error(zend_ce_fiber_error, "Failed to start sampler thread");
+		return;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &prev, NULL);
+
+	FIBER_G(profiler) = profiler;
+}
+/* }}} */
+
+
+/* {{{ proto string Fiber\Profiler::stop() */
+ZEND_METHOD(FiberProfiler, stop)
+{
+	zend_fiber_profiler *profiler;
+	zend_string *key;
+	zval *count;
+	smart_str out = {0};
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	profiler = FIBER_G(profiler);
+
+	if (profiler == NULL) {
+		zend_throw_error(zend_ce_fiber_error, "Profiler is not running");
+		return;
+	}
+
+	zend_fiber_profiler_stop(profiler);
+
+	ZEND_HASH_FOREACH_STR_KEY_VAL(&profiler->samples, key, count) {
+		smart_str_append(&out, key);
+		smart_str_appendc(&out, ' ');
+		smart_str_append_long(&out, Z_LVAL_P(count));
+		smart_str_appendc(&out, '\n');
+	} ZEND_HASH_FOREACH_END();
+
+	zend_hash_destroy(&profiler->samples);
+	pefree(profiler, 1);
+
+	if (out.s == NULL) {
+		RETURN_EMPTY_STRING();
+	}
+
+	smart_str_0(&out);
+
+	RETURN_NEW_STR(out.s);
+}
+/* }}} */
+
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_profiler_start, 0, 0, 0)
+	ZEND_ARG_TYPE_INFO(0, interval, IS_LONG, 0)
+	ZEND_ARG_TYPE_INFO(0, group, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_profiler_stop, 0, 0, IS_STRING, 0)
+ZEND_END_ARG_INFO()
+
+static const zend_function_entry fiber_profiler_methods[] = {
+	ZEND_ME(FiberProfiler, start, arginfo_fiber_profiler_start, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberProfiler, stop, arginfo_fiber_profiler_stop, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_FE_END
+};
+
+
+void zend_fiber_profiler_ce_register()
+{
+	zend_class_entry ce;
+
+	INIT_NS_CLASS_ENTRY(ce, "Fiber", "Profiler", fiber_profiler_methods);
+	zend_ce_fiber_profiler = zend_register_internal_class(&ce);
+	zend_ce_fiber_profiler->ce_flags |= ZEND_ACC_FINAL;
+
+	zend_declare_class_constant_long(zend_ce_fiber_profiler, "GROUP_NONE", sizeof("GROUP_NONE")-1, ZEND_FIBER_PROFILER_GROUP_NONE);
+	zend_declare_class_constant_long(zend_ce_fiber_profiler, "GROUP_CALLABLE", sizeof("GROUP_CALLABLE")-1, ZEND_FIBER_PROFILER_GROUP_CALLABLE);
+	zend_declare_class_constant_long(zend_ce_fiber_profiler, "GROUP_FIBER", sizeof("GROUP_FIBER")-1, ZEND_FIBER_PROFILER_GROUP_FIBER);
+}
+
+
+void zend_fiber_profiler_shutdown()
+{
+	zend_fiber_profiler *profiler;
+
+	profiler = FIBER_G(profiler);
+
+	if (profiler == NULL) {
+		return;
+	}
+
+	zend_fiber_profiler_stop(profiler);
+
+	zend_hash_destroy(&profiler->samples);
+	pefree(profiler, 1);
+}
+
+
+void zend_fiber_profiler_fork()
+{
+	zend_fiber_profiler *profiler;
+
+	profiler = FIBER_G(profiler);
+
+	if (profiler == NULL) {
+		return;
+	}
+
+	/* The sampler thread has not been forked and may have held the mutex, neither is touched. Samples of the parent
+	 * are dropped, the child is not being profiled. */
+	zend_hash_destroy(&profiler->samples);
+	pefree(profiler, 1);
+
+	FIBER_G(profiler) = NULL;
+
+	__atomic_fetch_and(&FIBER_G(interrupt_pending), ~ZEND_FIBER_INTERRUPT_SAMPLE, __ATOMIC_SEQ_CST);
+}
+
+#else
+
+void zend_fiber_profiler_ce_register()
+{
+}
+
+void zend_fiber_profiler_sample(zend_execute_data *execute_data)
+{
+}
+
+void zend_fiber_profiler_shutdown()
+{
+}
+
+void zend_fiber_profiler_fork()
+{
+}
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,442 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "zend_builtin_functions.h"
+#include "zend_smart_str.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_registry.h"
+#include "fiber_stack.h"
+#include "fiber_stats.h"
+
+#define ZEND_FIBER_DUMP_MAX_DEPTH 64
+
+/* Groups of leaked fibers written by zend_fiber_registry_leaks(), the rest is summarized. */
+#define ZEND_FIBER_LEAK_MAX_GROUPS 20
+
+typedef struct _zend_fiber_leak_group {
+	uint32_t count;
+
+	/* Mapped C stack bytes (with guard pages) of the fibers in the group. */
+	size_t bytes;
+
+	/* Time the longest suspended fiber of the group has been suspended, in zend_fiber_ticks() units. */
+	uint64_t age;
+} zend_fiber_leak_group;
+
+
+void zend_fiber_registry_add(zend_fiber *fiber)
+{
+	fiber->registry_prev = NULL;
+	fiber->registry_next = FIBER_G(fibers);
+
+	if (fiber->registry_next != NULL) {
+		fiber->registry_next->registry_prev = fiber;
+	}
+
+	FIBER_G(fibers) = fiber;
+}
+
+
+void zend_fiber_registry_remove(zend_fiber *fiber)
+{
+	if (fiber->registry_prev != NULL) {
+		fiber->registry_prev->registry_next = fiber->registry_next;
+	} else if (FIBER_G(fibers) == fiber) {
+		FIBER_G(fibers) = fiber->registry_next;
+	} else {
+		return;
+	}
+
+	if (fiber->registry_next != NULL) {
+		fiber->registry_next->registry_prev = fiber->registry_prev;
+	}
+
+	fiber->registry_prev = NULL;
+	fiber->registry_next = NULL;
+}
+
+
+zend_execute_data *zend_fiber_get_frame(zend_fiber *fiber)
+{
+	if (fiber == FIBER_G(current_fiber)) {
+		return EG(current_execute_data);
+	}
+
+	/* Saved by zend_fiber_do_suspend() or, for a fiber that resumed another one, by zend_fiber_switch_to(). */
+	if (fiber->status == ZEND_FIBER_STATUS_SUSPENDED || fiber->status == ZEND_FIBER_STATUS_RUNNING) {
+		return fiber->exec;
+	}
+
+	return NULL;
+}
+
+
+void zend_fiber_append_frame_name(smart_str *str, zend_execute_data *ex)
+{
+	zend_function *func;
+
+	func = ex->func;
+
+	if (func->common.function_name == NULL) {
+		if (ex->prev_execute_data == NULL) {
+			smart_str_appends(str, "{main}");
+		} else {
+			smart_str_append(str, func->op_array.filename);
+		}
+
+		return;
+	}
+
+	if (func->common.scope != NULL) {
+		smart_str_append(str, func->common.scope->name);
+		smart_str_appendl(str, "::", sizeof("::") - 1);
+	}
+
+	smart_str_append(str, func->common.function_name);
+}
+
+
+void zend_fiber_registry_get_all(zval *return_value)
+{
+	zend_fiber *fiber;
+	zval tmp;
+
+	array_init(return_value);
+
+	for (fiber = FIBER_G(fibers); fiber != NULL; fiber = fiber->registry_next) {
+		GC_ADDREF(&fiber->std);
+		ZVAL_OBJ(&tmp, &fiber->std);
+
+		zend_hash_next_index_insert_new(Z_ARRVAL_P(return_value), &tmp);
+	}
+}
+
+
+void zend_fiber_registry_get_trace(zend_fiber *fiber, zend_long options, zend_long limit, zval *return_value)
+{
+	zend_execute_data *exec;
+	zend_execute_data *prev;
+	zval *frame;
+	zval *func;
+	uint32_t count;
+
+	exec = zend_fiber_get_frame(fiber);
+
+	if (exec == NULL) {
+		array_init(return_value);
+		return;
+	}
+
+	/* Frames of a suspended fiber stay intact on its VM stack, they can be walked without resuming it. */
+	prev = EG(current_execute_data);
+	EG(current_execute_data) = exec;
+
+	zend_fetch_debug_backtrace(return_value, (fiber == FIBER_G(current_fiber)) ? 1 : 0, (int) options, (int) limit);
+
+	EG(current_execute_data) = prev;
+
+	/* Strip the runner frame, the fiber callable is the bottom frame. */
+	count = zend_hash_num_elements(Z_ARRVAL_P(return_value));
+
+	if (count == 0) {
+		return;
+	}
+
+	frame = zend_hash_index_find(Z_ARRVAL_P(return_value), count - 1);
+
+	if (frame == NULL || Z_TYPE_P(frame) != IS_ARRAY) {
+		return;
+	}
+
+	func = zend_hash_str_find(Z_ARRVAL_P(frame), "function", sizeof("function") - 1);
+
+	if (func != NULL && Z_TYPE_P(func) == IS_STRING && zend_string_equals_literal(Z_STR_P(func), "Fiber::run")) {
+		zend_hash_index_del(Z_ARRVAL_P(return_value), count - 1);
+	}
+}
+
+
+#if PHP_VERSION_ID >= 80000
+static int zend_fiber_registry_compare(Bucket *a, Bucket *b)
+#else
+static int zend_fiber_registry_compare(const void *a, const void *b)
+#endif
+{
+	zend_long x;
+	zend_long y;
+
+	x = Z_LVAL(((Bucket *) a)->val);
+	y = Z_LVAL(((Bucket *) b)->val);
+
+	return (x < y) ? 1 : ((x > y) ? -1 : 0);
+}
+
+
+static void zend_fiber_registry_append_frames(smart_str *str, zend_fiber *fiber)
+{
+	zend_execute_data *ex;
+	int depth;
+
+	depth = 0;
+
+	for (ex = zend_fiber_get_frame(fiber); ex != NULL && depth < ZEND_FIBER_DUMP_MAX_DEPTH; ex = ex->prev_execute_data) {
+		if (ex->func == NULL) {
+			continue;
+		}
+
+		if (zend_fiber_is_run_func(ex->func)) {
+			break;
+		}
+
+		smart_str_appends(str, "  #");
+		smart_str_append_long(str, depth++);
+		smart_str_appendc(str, ' ');
+
+		zend_fiber_append_frame_name(str, ex);
+
+		if (ZEND_USER_CODE(ex->func->type) && ex->opline != NULL) {
+			smart_str_appendc(str, ' ');
+			smart_str_append(str, ex->func->op_array.filename);
+			smart_str_appendc(str, ':');
+			smart_str_append_long(str, (zend_long) ex->opline->lineno);
+		}
+
+		smart_str_appendc(str, '\n');
+	}
+}
+
+
+static void zend_fiber_registry_append_trace(smart_str *str, zend_fiber *fiber)
+{
+	if (fiber->flags & ZEND_FIBER_FLAG_PARKED) {
+		smart_str_appends(str, "parked");
+	} else if (fiber->flags & ZEND_FIBER_FLAG_PREEMPTED) {
+		smart_str_appends(str, "preempted");
+	} else if (fiber->status == ZEND_FIBER_STATUS_RUNNING) {
+		smart_str_appends(str, "running");
+	} else {
+		smart_str_appends(str, "suspended");
+	}
+
+	smart_str_appendc(str, '\n');
+
+	zend_fiber_registry_append_frames(str, fiber);
+}
+
+
+zend_string *zend_fiber_registry_dump()
+{
+	HashTable groups;
+	zend_fiber *fiber;
+	zend_string *key;
+	smart_str str = {0};
+	smart_str out = {0};
+	zval *count;
+	zval tmp;
+
+	zend_hash_init(&groups, 16, NULL, NULL, 0);
+
+	for (fiber = FIBER_G(fibers); fiber != NULL; fiber = fiber->registry_next) {
+		zend_fiber_registry_append_trace(&str, fiber);
+		smart_str_0(&str);
+
+		count = zend_hash_find(&groups, str.s);
+
+		if (count != NULL) {
+			Z_LVAL_P(count)++;
+		} else {
+			ZVAL_LONG(&tmp, 1);
+			zend_hash_add_new(&groups, str.s, &tmp);
+		}
+
+		smart_str_free(&str);
+	}
+
+	zend_hash_sort(&groups, zend_fiber_registry_compare, 0);
+
+	ZEND_HASH_FOREACH_STR_KEY_VAL(&groups, key, count) {
+		smart_str_append_long(&out, Z_LVAL_P(count));
+		smart_str_appends(&out, (Z_LVAL_P(count) == 1) ? " fiber " : " fibers ");
+		smart_str_append(&out, key);
+		smart_str_appendc(&out, '\n');
+	} ZEND_HASH_FOREACH_END();
+
+	zend_hash_destroy(&groups);
+
+	if (out.s == NULL) {
+		return ZSTR_EMPTY_ALLOC();
+	}
+
+	smart_str_0(&out);
+
+	return out.s;
+}
+
+
+#if PHP_VERSION_ID >= 80000
+static int zend_fiber_leak_group_compare(Bucket *a, Bucket *b)
+#else
+static int zend_fiber_leak_group_compare(const void *a, const void *b)
+#endif
+{
+	zend_fiber_leak_group *x;
+	zend_fiber_leak_group *y;
+
+	x = (zend_fiber_leak_group *) Z_PTR(((Bucket *) a)->val);
+	y = (zend_fiber_leak_group *) Z_PTR(((Bucket *) b)->val);
+
+	/* Groups of the same size are ordered by the memory they hold, the sort is not stable. */
+	if (x->count != y->count) {
+		return (x->count < y->count) ? 1 : -1;
+	}
+
+	return (x->bytes < y->bytes) ? 1 : ((x->bytes > y->bytes) ? -1 : 0);
+}
+
+
+static void zend_fiber_leak_group_dtor(zval *zv)
+{
+	efree(Z_PTR_P(zv));
+}
+
+
+/* Suspended fibers grouped by creation site, state and stack like zend_fiber_registry_dump(), largest groups first. */
+zend_string *zend_fiber_registry_leaks()
+{
+	HashTable groups;
+	zend_fiber_leak_group *group;
+	zend_fiber *fiber;
+	zend_string *key;
+	const char *frames;
+	smart_str str = {0};
+	smart_str out = {0};
+	uint64_t now;
+	uint64_t age;
+	uint32_t count;
+	uint32_t written;
+	uint32_t omitted;
+	size_t bytes;
+	size_t mapped;
+	char buf[160];
+
+	now = zend_fiber_ticks();
+	count = 0;
+	bytes = 0;
+
+	zend_hash_init(&groups, 16, NULL, zend_fiber_leak_group_dtor, 0);
+
+	for (fiber = FIBER_G(fibers); fiber != NULL; fiber = fiber->registry_next) {
+		if (fiber->status != ZEND_FIBER_STATUS_SUSPENDED) {
+			continue;
+		}
+
+		mapped = zend_fiber_stack_mapped_size(fiber->stack_size);
+		age = now - fiber->switched_at;
+
+		count++;
+		bytes += mapped;
+
+		smart_str_appends(&str, "created at ");
+
+		if (fiber->created_file != NULL) {
+			smart_str_append(&str, fiber->created_file);
+			smart_str_appendc(&str, ':');
+			smart_str_append_long(&str, (zend_long) fiber->created_line);
+		} else {
+			smart_str_appends(&str, "[no active file]");
+		}
+
+		smart_str_appends(&str, (fiber->flags & ZEND_FIBER_FLAG_PARKED) ? " parked\n" : " suspended\n");
+
+		zend_fiber_registry_append_frames(&str, fiber);
+		smart_str_0(&str);
+
+		group = zend_hash_find_ptr(&groups, str.s);
+
+		if (group == NULL) {
+			group = ecalloc(1, sizeof(zend_fiber_leak_group));
+			zend_hash_add_new_ptr(&groups, str.s, group);
+		}
+
+		group->count++;
+		group->bytes += mapped;
+		group->age = MAX(group->age, age);
+
+		smart_str_free(&str);
+	}
+
+	if (count == 0) {
+		zend_hash_destroy(&groups);
+		return NULL;
+	}
+
+	zend_hash_sort(&groups, zend_fiber_leak_group_compare, 0);
+
+	written = 0;
+	omitted = 0;
+
+	ZEND_HASH_FOREACH_STR_KEY_PTR(&groups, key, group) {
+		if (written == ZEND_FIBER_LEAK_MAX_GROUPS) {
+			omitted += group->count;
+			continue;
+		}
+
+		written++;
+
+		/* The first line of the key names the creation site and state, the frames follow. */
+		frames = strchr(ZSTR_VAL(key), '\n');
+
+		smart_str_append_long(&out, (zend_long) group->count);
+		smart_str_appends(&out, (group->count == 1) ? " fiber " : " fibers ");
+		smart_str_appendl(&out, ZSTR_VAL(key), frames - ZSTR_VAL(key));
+
+		snprintf(buf, sizeof(buf), " for up to %.3f s, %zu mapped stack bytes\n",
+			zend_fiber_ticks_to_ns(group->age) / 1000000000.0,
+			group->bytes
+		);
+		smart_str_appends(&out, buf);
+		smart_str_appends(&out, frames + 1);
+	} ZEND_HASH_FOREACH_END();
+
+	if (omitted > 0) {
+		snprintf(buf, sizeof(buf), "%u more %s in %u smaller %s\n",
+			omitted,
+			(omitted == 1) ? "fiber" : "fibers",
+			zend_hash_num_elements(&groups) - written,
+			(zend_hash_num_elements(&groups) - written == 1) ? "group" : "groups"
+		);
+		smart_str_appends(&out, buf);
+	}
+
+	zend_hash_destroy(&groups);
+
+	snprintf(buf, sizeof(buf), "%u suspended fibers holding %zu mapped stack bytes\n", count, bytes);
+	smart_str_appends(&out, buf);
+	smart_str_0(&out);
+
+	return out.s;
+}
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
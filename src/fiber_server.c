@@ -0,0 +1,699 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "zend_exceptions.h"
+#include "main/php_network.h"
+#include "main/php_streams.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_poll.h"
+#include "fiber_server.h"
+#include "fiber_stream.h"
+
+#ifndef ZEND_PARSE_PARAMETERS_NONE
+#define ZEND_PARSE_PARAMETERS_NONE() zend_parse_parameters_none()
+#endif
+
+#ifdef ZEND_FIBER_POLL
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+struct _zend_fiber_server {
+	/* Listening socket registered with the native poller while connections are being accepted. */
+	zend_fiber_poll_waiter waiter;
+
+	/* Handler invoked in a new fiber for every connection. */
+	zend_fcall_info fci;
+	zend_fcall_info_cache fci_cache;
+
+	/* Fibers of connections that are still being handled, keyed by object handle. */
+	HashTable connections;
+
+	/* Accepting pauses while this many connections are being handled, 0 for no limit. */
+	zend_long max_connections;
+
+	/* Connections accepted per readiness notification of the listening socket. */
+	zend_long batch;
+
+	uint64_t accepted;
+
+	zend_bool accepting;
+	zend_bool closed;
+
+	/* Fiber\Server PHP object handle. */
+	zend_object std;
+};
+
+#define ZEND_FIBER_SERVER(obj) ((zend_fiber_server *) ((char *) (obj) - XtOffsetOf(zend_fiber_server, std)))
+
+static zend_class_entry *zend_ce_fiber_server;
+static zend_object_handlers zend_fiber_server_handlers;
+
+static void zend_fiber_server_accept(zend_fiber_poll_waiter *waiter);
+
+
+/* Uncaught errors of a connection are reported, they must not reach whoever resumed the connection. */
+static void zend_fiber_server_report(zend_object *exception)
+{
+	GC_ADDREF(exception);
+	zend_clear_exception();
+
+	zend_exception_error(exception, E_WARNING);
+
+	OBJ_RELEASE(exception);
+}
+
+
+static void zend_fiber_server_resume_accept(zend_fiber_server *server)
+{
+	if (server->accepting || server->closed) {
+		return;
+	}
+
+	if (!zend_fiber_poll_add_handler(&server->waiter)) {
+		return;
+	}
+
+	zend_fiber_poll_ref();
+
+	server->accepting = 1;
+}
+
+
+static void zend_fiber_server_pause_accept(zend_fiber_server *server)
+{
+	if (!server->accepting) {
+		return;
+	}
+
+	zend_fiber_poll_remove_handler(&server->waiter);
+	zend_fiber_poll_unref();
+
+	server->accepting = 0;
+}
+
+
+static void zend_fiber_server_close(zend_fiber_server *server)
+{
+	if (server->closed) {
+		return;
+	}
+
+	zend_fiber_server_pause_accept(server);
+
+	close(server->waiter.fd);
+
+	server->waiter.fd = -1;
+	server->closed = 1;
+}
+
+
+void zend_fiber_server_connection_done(zend_fiber *fiber)
+{
+	zend_fiber_server *server;
+
+	server = fiber->server;
+	fiber->server = NULL;
+
+	if (EG(exception)) {
+		zend_fiber_server_report(EG(exception));
+	}
+
+	GC_ADDREF(&server->std);
+
+	zend_hash_index_del(&server->connections, fiber->std.handle);
+
+	if (server->max_connections == 0 || zend_hash_num_elements(&server->connections) < (uint32_t) server->max_connections) {
+		zend_fiber_server_resume_accept(server);
+	}
+
+	OBJ_RELEASE(&server->std);
+}
+
+
+/* Runs the handler in a new fiber, the fiber keeps running until it parks or finishes. */
+static void zend_fiber_server_spawn(zend_fiber_server *server, int fd)
+{
+	php_stream *stream;
+	zend_fiber *fiber;
+	zval connection;
+	zval obj;
+
+	stream = php_stream_sock_open_from_socket(fd, NULL);
+
+	if (stream == NULL) {
+		close(fd);
+		return;
+	}
+
+	/* The descriptor is non-blocking, reads and writes of the handler park its fiber. */
+	zend_fiber_stream_adopt(stream);
+	php_stream_to_zval(stream, &connection);
+
+	object_init_ex(&obj, zend_ce_fiber);
+	fiber = (zend_fiber *) Z_OBJ(obj);
+
+	zend_fiber_init(fiber, &server->fci, &server->fci_cache);
+
+	fiber->flags |= ZEND_FIBER_FLAG_ASYNC_STREAMS;
+	fiber->server = server;
+
+	Z_ADDREF(obj);
+	zend_hash_index_add_new(&server->connections, fiber->std.handle, &obj);
+
+	server->accepted++;
+
+	if (!zend_fiber_do_start(fiber, &connection, 1) && fiber->status == ZEND_FIBER_STATUS_INIT) {
+		fiber->server = NULL;
+		zend_hash_index_del(&server->connections, fiber->std.handle);
+
+		if (EG(exception)) {
+			zend_fiber_server_report(EG(exception));
+		}
+	}
+
+	zval_ptr_dtor(&connection);
+	zval_ptr_dtor(&obj);
+}
+
+
+static void zend_fiber_server_accept(zend_fiber_poll_waiter *waiter)
+{
+	zend_fiber_server *server;
+	zend_long i;
+	int fd;
+
+	server = (zend_fiber_server *) waiter;
+
+	GC_ADDREF(&server->std);
+
+	for (i = 0; i < server->batch && !server->closed; i++) {
+		/* Connections left in the backlog are accepted once a handler has finished. */
+		if (server->max_connections > 0 && zend_hash_num_elements(&server->connections) >= (uint32_t) server->max_connections) {
+			zend_fiber_server_pause_accept(server);
+			break;
+		}
+
+		fd = accept4(waiter->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				php_error_docref(NULL, E_WARNING, "Failed to accept connection: %s", strerror(errno));
+			}
+
+			break;
+		}
+
+		zend_fiber_server_spawn(server, fd);
+	}
+
+	OBJ_RELEASE(&server->std);
+}
+
+
+/* Parses "host:port" or "[host]:port" with a numeric IPv4 or IPv6 host, an empty host or "*" binds to all addresses. */
+static zend_bool zend_fiber_server_parse_address(const char *address, size_t len, struct sockaddr_storage *addr, socklen_t *addr_len)
+{
+	struct sockaddr_in *in4;
+	struct sockaddr_in6 *in6;
+	const char *colon;
+	char host[INET6_ADDRSTRLEN];
+	char *end;
+	size_t host_len;
+	zend_long port;
+
+	if (len > sizeof("tcp://") - 1 && strncmp(address, "tcp://", sizeof("tcp://") - 1) == 0) {
+		address += sizeof("tcp://") - 1;
+		len -= sizeof("tcp://") - 1;
+	}
+
+	colon = zend_memrchr(address, ':', len);
+
+	if (colon == NULL || colon == address + len - 1) {
+		return 0;
+	}
+
+	port = ZEND_STRTOL(colon + 1, &end, 10);
+
+	if (end != address + len || port < 0 || port > 65535) {
+		return 0;
+	}
+
+	host_len = colon - address;
+
+	if (host_len >= 2 && address[0] == '[' && address[host_len - 1] == ']') {
+		address++;
+		host_len -= 2;
+	}
+
+	if (host_len >= sizeof(host)) {
+		return 0;
+	}
+
+	memcpy(host, address, host_len);
+	host[host_len] = '\0';
+
+	memset(addr, 0, sizeof(struct sockaddr_storage));
+
+	if (host_len == 0 || strcmp(host, "*") == 0) {
+		strcpy(host, "0.0.0.0");
+	}
+
+	in4 = (struct sockaddr_in *) addr;
+
+	if (inet_pton(AF_INET, host, &in4->sin_addr) == 1) {
+		in4->sin_family = AF_INET;
+		in4->sin_port = htons((uint16_t) port);
+		*addr_len = sizeof(struct sockaddr_in);
+
+		return 1;
+	}
+
+	in6 = (struct sockaddr_in6 *) addr;
+
+	if (inet_pton(AF_INET6, host, &in6->sin6_addr) == 1) {
+		in6->sin6_family = AF_INET6;
+		in6->sin6_port = htons((uint16_t) port);
+		*addr_len = sizeof(struct sockaddr_in6);
+
+		return 1;
+	}
+
+	return 0;
+}
+
+
+static int zend_fiber_server_bind(zend_string *address, zend_long backlog, zend_bool reuseport)
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	int fd;
+	int on;
+
+	if (!zend_fiber_server_parse_address(ZSTR_VAL(address), ZSTR_LEN(address), &addr, &addr_len)) {
+		zend_throw_error(NULL, "Fiber\\Server::listen(): Argument #1 ($address) must be a numeric \"host:port\" address, \"%s\" given", ZSTR_VAL(address));
+		return -1;
+	}
+
+	fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (fd < 0) {
+		zend_throw_error(NULL, "Failed to create socket: %s", strerror(errno));
+		return -1;
+	}
+
+	on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	/* Every worker process binds its own listener, the kernel balances connections between them. */
+	if (reuseport) {
+#ifdef SO_REUSEPORT
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+			zend_throw_error(NULL, "Failed to enable SO_REUSEPORT: %s", strerror(errno));
+			close(fd);
+			return -1;
+		}
+#else
+		zend_throw_error(NULL, "SO_REUSEPORT is not supported on this platform");
+		close(fd);
+		return -1;
+#endif
+	}
+
+	if (bind(fd, (struct sockaddr *) &addr, addr_len) != 0) {
+		zend_throw_error(NULL, "Failed to bind to %s: %s", ZSTR_VAL(address), strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if (listen(fd, (int) backlog) != 0) {
+		zend_throw_error(NULL, "Failed to listen on %s: %s", ZSTR_VAL(address), strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+static zend_object *zend_fiber_server_object_create(zend_class_entry *ce)
+{
+	zend_fiber_server *server;
+
+	server = emalloc(sizeof(zend_fiber_server) + zend_object_properties_size(ce));
+	memset(server, 0, sizeof(zend_fiber_server));
+
+	zend_object_std_init(&server->std, ce);
+	server->std.handlers = &zend_fiber_server_handlers;
+
+	server->waiter.fd = -1;
+	server->waiter.events = EPOLLIN;
+	server->waiter.handler = zend_fiber_server_accept;
+
+	ZVAL_UNDEF(&server->fci.function_name);
+	zend_hash_init(&server->connections, 8, NULL, ZVAL_PTR_DTOR, 0);
+
+	return &server->std;
+}
+
+
+/* Unwinds the fibers of connections that are still being handled, they report back as they finish. */
+static void zend_fiber_server_cancel(zend_fiber_server *server)
+{
+	zend_fiber **fibers;
+	zval *connection;
+	uint32_t count;
+	uint32_t i;
+
+	count = zend_hash_num_elements(&server->connections);
+
+	if (count == 0) {
+		return;
+	}
+
+	fibers = safe_emalloc(count, sizeof(zend_fiber *), 0);
+	i = 0;
+
+	ZEND_HASH_FOREACH_VAL(&server->connections, connection) {
+		fibers[i] = (zend_fiber *) Z_OBJ_P(connection);
+		GC_ADDREF(&fibers[i]->std);
+		i++;
+	} ZEND_HASH_FOREACH_END();
+
+	for (i = 0; i < count; i++) {
+		zend_fiber_do_cancel(fibers[i]);
+		OBJ_RELEASE(&fibers[i]->std);
+	}
+
+	efree(fibers);
+}
+
+
+/* Runs as destructor so that connection handlers are unwound before anything is freed. */
+static void zend_fiber_server_object_dtor(zend_object *object)
+{
+	zend_fiber_server *server;
+
+	server = ZEND_FIBER_SERVER(object);
+
+	zend_fiber_server_close(server);
+	zend_fiber_server_cancel(server);
+}
+
+
+static void zend_fiber_server_object_destroy(zend_object *object)
+{
+	zend_fiber_server *server;
+	zval *connection;
+
+	server = ZEND_FIBER_SERVER(object);
+
+	/* Connections must not report back into a server that is being freed (left over after a fatal error). */
+	ZEND_HASH_FOREACH_VAL(&server->connections, connection) {
+		((zend_fiber *) Z_OBJ_P(connection))->server = NULL;
+	} ZEND_HASH_FOREACH_END();
+
+	zend_hash_destroy(&server->connections);
+
+	/* Destructors are not called after a fatal error, the poller is gone by then. */
+	if (server->waiter.fd >= 0) {
+		close(server->waiter.fd);
+	}
+
+	zval_ptr_dtor(&server->fci.function_name);
+
+	zend_object_std_dtor(&server->std);
+}
+
+
+#if PHP_VERSION_ID >= 80000
+static HashTable *zend_fiber_server_get_gc(zend_object *object, zval **table, int *n)
+{
+	zend_fiber_server *server = ZEND_FIBER_SERVER(object);
+#else
+static HashTable *zend_fiber_server_get_gc(zval *object, zval **table, int *n)
+{
+	zend_fiber_server *server = ZEND_FIBER_SERVER(Z_OBJ_P(object));
+#endif
+
+	/* A handler closure capturing the server and the fibers of its connections form cycles. */
+	*table = &server->fci.function_name;
+	*n = Z_ISUNDEF(server->fci.function_name) ? 0 : 1;
+
+	return &server->connections;
+}
+
+
+/* {{{ proto Fiber\Server::__construct() */
+ZEND_METHOD(FiberServer, __construct)
+{
+}
+/* }}} */
+
+
+/* {{{ proto Fiber\Server Fiber\Server::listen(string $address, callable $handler, array $options = []) */
+ZEND_METHOD(FiberServer, listen)
+{
+	zend_fiber_server *server;
+	zend_string *address;
+	zend_fcall_info fci;
+	zend_fcall_info_cache fci_cache;
+	HashTable *options;
+	zend_long backlog;
+	zend_long max_connections;
+	zend_long batch;
+	zend_bool reuseport;
+	zval *option;
+	int fd;
+
+	options = NULL;
+
+	ZEND_PARSE_PARAMETERS_START(2, 3)
+		Z_PARAM_STR(address)
+		Z_PARAM_FUNC(fci, fci_cache)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_ARRAY_HT(options)
+	ZEND_PARSE_PARAMETERS_END();
+
+	backlog = SOMAXCONN;
+	max_connections = 0;
+	batch = ZEND_FIBER_POLL_BATCH;
+	reuseport = 1;
+
+	if (options != NULL) {
+		if ((option = zend_hash_str_find(options, "backlog", sizeof("backlog") - 1)) != NULL) {
+			backlog = zval_get_long(option);
+		}
+
+		if ((option = zend_hash_str_find(options, "max_connections", sizeof("max_connections") - 1)) != NULL) {
+			max_connections = zval_get_long(option);
+		}
+
+		if ((option = zend_hash_str_find(options, "batch", sizeof("batch") - 1)) != NULL) {
+			batch = zval_get_long(option);
+		}
+
+		if ((option = zend_hash_str_find(options, "reuseport", sizeof("reuseport") - 1)) != NULL) {
+			reuseport = zend_is_true(option);
+		}
+	}
+
+	if (backlog < 1 || backlog > INT_MAX) {
+		zend_throw_error(NULL, "Fiber\\Server::listen(): Option \"backlog\" must be between 1 and %d", INT_MAX);
+		return;
+	}
+
+	if (max_connections < 0 || (zend_ulong) max_connections > UINT32_MAX) {
+		zend_throw_error(NULL, "Fiber\\Server::listen(): Option \"max_connections\" must be between 0 and %u", UINT32_MAX);
+		return;
+	}
+
+	if (batch < 1) {
+		zend_throw_error(NULL, "Fiber\\Server::listen(): Option \"batch\" must be greater than 0");
+		return;
+	}
+
+	fd = zend_fiber_server_bind(address, backlog, reuseport);
+
+	if (fd < 0) {
+		return;
+	}
+
+	object_init_ex(return_value, zend_ce_fiber_server);
+	server = ZEND_FIBER_SERVER(Z_OBJ_P(return_value));
+
+	server->waiter.fd = fd;
+	server->max_connections = max_connections;
+	server->batch = batch;
+
+	server->fci = fci;
+	server->fci_cache = fci_cache;
+	Z_TRY_ADDREF(server->fci.function_name);
+
+	zend_fiber_server_resume_accept(server);
+}
+/* }}} */
+
+
+/* {{{ proto string Fiber\Server::getAddress() */
+ZEND_METHOD(FiberServer, getAddress)
+{
+	zend_fiber_server *server;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	char host[INET6_ADDRSTRLEN];
+	uint16_t port;
+
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	server = ZEND_FIBER_SERVER(Z_OBJ_P(getThis()));
+
+	if (server->closed) {
+		zend_throw_error(zend_ce_fiber_error, "Server has been closed");
+		return;
+	}
+
+	addr_len = sizeof(addr);
+
+	if (getsockname(server->waiter.fd, (struct sockaddr *) &addr, &addr_len) != 0) {
+		zend_throw_error(NULL, "Failed to get listening address: %s", strerror(errno));
+		return;
+	}
+
+	if (addr.ss_family == AF_INET6) {
+		inet_ntop(AF_INET6, &((struct sockaddr_in6 *) &addr)->sin6_addr, host, sizeof(host));
+		port = ntohs(((struct sockaddr_in6 *) &addr)->sin6_port);
+
+		RETURN_STR(zend_strpprintf(0, "[%s]:%u", host, (unsigned int) port));
+	}
+
+	inet_ntop(AF_INET, &((struct sockaddr_in *) &addr)->sin_addr, host, sizeof(host));
+	port = ntohs(((struct sockaddr_in *) &addr)->sin_port);
+
+	RETURN_STR(zend_strpprintf(0, "%s:%u", host, (unsigned int) port));
+}
+/* }}} */
+
+
+/* {{{ proto int Fiber\Server::getConnectionCount() */
+ZEND_METHOD(FiberServer, getConnectionCount)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	RETURN_LONG(zend_hash_num_elements(&ZEND_FIBER_SERVER(Z_OBJ_P(getThis()))->connections));
+}
+/* }}} */
+
+
+/* {{{ proto int Fiber\Server::getAcceptedCount() */
+ZEND_METHOD(FiberServer, getAcceptedCount)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	RETURN_LONG((zend_long) ZEND_FIBER_SERVER(Z_OBJ_P(getThis()))->accepted);
+}
+/* }}} */
+
+
+/* {{{ proto void Fiber\Server::close() */
+ZEND_METHOD(FiberServer, close)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	zend_fiber_server_close(ZEND_FIBER_SERVER(Z_OBJ_P(getThis())));
+}
+/* }}} */
+
+
+ZEND_BEGIN_ARG_INFO(arginfo_fiber_server_construct, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_OBJ_INFO_EX(arginfo_fiber_server_listen, 0, 2, Fiber\\Server, 0)
+	ZEND_ARG_TYPE_INFO(0, address, IS_STRING, 0)
+	ZEND_ARG_TYPE_INFO(0, handler, IS_CALLABLE, 0)
+	ZEND_ARG_TYPE_INFO(0, options, IS_ARRAY, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_server_get_address, 0, 0, IS_STRING, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_server_get_connection_count, 0, 0, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_server_get_accepted_count, 0, 0, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_fiber_server_close, 0)
+ZEND_END_ARG_INFO()
+
+static const zend_function_entry fiber_server_methods[] = {
+	ZEND_ME(FiberServer, __construct, arginfo_fiber_server_construct, ZEND_ACC_PRIVATE)
+	ZEND_ME(FiberServer, listen, arginfo_fiber_server_listen, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberServer, getAddress, arginfo_fiber_server_get_address, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberServer, getConnectionCount, arginfo_fiber_server_get_connection_count, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberServer, getAcceptedCount, arginfo_fiber_server_get_accepted_count, ZEND_ACC_PUBLIC)
+	ZEND_ME(FiberServer, close, arginfo_fiber_server_close, ZEND_ACC_PUBLIC)
+	ZEND_FE_END
+};
+
+
+void zend_fiber_server_ce_register()
+{
+	zend_class_entry ce;
+
+	INIT_NS_CLASS_ENTRY(ce, "Fiber", "Server", fiber_server_methods);
+	zend_ce_fiber_server = zend_register_internal_class(&ce);
+	zend_ce_fiber_server->ce_flags |= ZEND_ACC_FINAL;
+	zend_ce_fiber_server->create_object = zend_fiber_server_object_create;
+	zend_ce_fiber_server->serialize = zend_class_serialize_deny;
+	zend_ce_fiber_server->unserialize = zend_class_unserialize_deny;
+
+	memcpy(&zend_fiber_server_handlers, &std_object_handlers, sizeof(zend_object_handlers));
+	zend_fiber_server_handlers.offset = XtOffsetOf(zend_fiber_server, std);
+	zend_fiber_server_handlers.dtor_obj = zend_fiber_server_object_dtor;
+	zend_fiber_server_handlers.free_obj = zend_fiber_server_object_destroy;
+	zend_fiber_server_handlers.get_gc = zend_fiber_server_get_gc;
+	zend_fiber_server_handlers.clone_obj = NULL;
+}
+
+#else
+
+void zend_fiber_server_ce_register()
+{
+}
+
+void zend_fiber_server_connection_done(zend_fiber *fiber)
+{
+	fiber->server = NULL;
+}
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
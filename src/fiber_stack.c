@@ -21,8 +21,127 @@
 #include "php.h"
 #include "zend.h"
 
+#include "php_fiber.h"
+#include "fiber_probes.h"
 #include "fiber_stack.h"
 
+#ifdef ZEND_FIBER_MMAP
+
+/* Takes a mapped stack of the same size kept by zend_fiber_stack_free(). */
+static zend_bool zend_fiber_stack_pool_take(zend_fiber_stack *stack)
+{
+	uint32_t i;
+
+	for (i = FIBER_G(stack_pool_count); i > 0; i--) {
+		if (FIBER_G(stack_pool)[i - 1].size == stack->size) {
+			stack->pointer = FIBER_G(stack_pool)[i - 1].pointer;
+			FIBER_G(stack_pool)[i - 1] = FIBER_G(stack_pool)[--FIBER_G(stack_pool_count)];
+
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Keeps the mapping of a stack for reuse (fiber.stack_pool), stacks are not touched in between. */
+static zend_bool zend_fiber_stack_pool_put(zend_fiber_stack *stack)
+{
+	if (FIBER_G(stack_pool_count) >= (uint32_t) FIBER_G(stack_pool_size)) {
+		return 0;
+	}
+
+	if (FIBER_G(stack_pool) == NULL) {
+		FIBER_G(stack_pool) = pecalloc((size_t) FIBER_G(stack_pool_size), sizeof(zend_fiber_stack), 1);
+		FIBER_G(stack_pool_alloc) = (uint32_t) FIBER_G(stack_pool_size);
+	} else if (FIBER_G(stack_pool_count) == FIBER_G(stack_pool_alloc)) {
+		FIBER_G(stack_pool_alloc) = (uint32_t) FIBER_G(stack_pool_size);
+		FIBER_G(stack_pool) = safe_perealloc(FIBER_G(stack_pool), FIBER_G(stack_pool_alloc), sizeof(zend_fiber_stack), 0, 1);
+	}
+
+	FIBER_G(stack_pool)[FIBER_G(stack_pool_count)].pointer = stack->pointer;
+	FIBER_G(stack_pool)[FIBER_G(stack_pool_count)].size = stack->size;
+	FIBER_G(stack_pool_count)++;
+
+	return 1;
+}
+
+#endif
+
+void zend_fiber_stack_pool_shutdown()
+{
+#ifdef ZEND_FIBER_MMAP
+	size_t page_size;
+	uint32_t i;
+
+	page_size = ZEND_FIBER_PAGESIZE;
+
+	for (i = 0; i < FIBER_G(stack_pool_count); i++) {
+		munmap((char *) FIBER_G(stack_pool)[i].pointer - ZEND_FIBER_GUARDPAGES * page_size, FIBER_G(stack_pool)[i].size + ZEND_FIBER_GUARDPAGES * page_size);
+
+		FIBER_G(stack_count)--;
+		FIBER_G(stack_bytes) -= FIBER_G(stack_pool)[i].size;
+	}
+
+	if (FIBER_G(stack_pool) != NULL) {
+		pefree(FIBER_G(stack_pool), 1);
+		FIBER_G(stack_pool) = NULL;
+	}
+
+	FIBER_G(stack_pool_count) = 0;
+	FIBER_G(stack_pool_alloc) = 0;
+#endif
+}
+
+size_t zend_fiber_stack_mapped_size(size_t size)
+{
+	size_t page_size;
+
+	page_size = ZEND_FIBER_PAGESIZE;
+	size = (size + page_size - 1) / page_size * page_size;
+
+#ifdef ZEND_FIBER_MMAP
+	size += ZEND_FIBER_GUARDPAGES * page_size;
+#endif
+
+	return size;
+}
+
+/* Pooled stacks stay counted in stack_bytes, they are unmapped as needed to keep a new stack within
+ * fiber.max_stack_memory. A pooled stack of the same size is reused and does not add to the total. */
+zend_bool zend_fiber_stack_reserve(size_t size)
+{
+	size_t page_size;
+
+	if (FIBER_G(max_stack_memory) <= 0) {
+		return 1;
+	}
+
+	page_size = ZEND_FIBER_PAGESIZE;
+	size = (size + page_size - 1) / page_size * page_size;
+
+#ifdef ZEND_FIBER_MMAP
+	uint32_t i;
+
+	for (i = 0; i < FIBER_G(stack_pool_count); i++) {
+		if (FIBER_G(stack_pool)[i].size == size) {
+			return 1;
+		}
+	}
+
+	while (FIBER_G(stack_pool_count) > 0 && FIBER_G(stack_bytes) + size > (size_t) FIBER_G(max_stack_memory)) {
+		i = --FIBER_G(stack_pool_count);
+
+		munmap((char *) FIBER_G(stack_pool)[i].pointer - ZEND_FIBER_GUARDPAGES * page_size, FIBER_G(stack_pool)[i].size + ZEND_FIBER_GUARDPAGES * page_size);
+
+		FIBER_G(stack_count)--;
+		FIBER_G(stack_bytes) -= FIBER_G(stack_pool)[i].size;
+	}
+#endif
+
+	return FIBER_G(stack_bytes) + size <= (size_t) FIBER_G(max_stack_memory);
+}
+
 zend_bool zend_fiber_stack_allocate(zend_fiber_stack *stack, unsigned int size)
 {
 	static __thread size_t page_size;
@@ -32,7 +151,9 @@ zend_bool zend_fiber_stack_allocate(zend_fiber_stack *stack, unsigned int size)
 	}
 
 	size_t msize;
+	zend_bool pooled;
 
+	pooled = 0;
 	stack->size = ((size_t) size + page_size - 1) / page_size * page_size;
 
 #ifdef ZEND_FIBER_MMAP
@@ -40,19 +161,25 @@ zend_bool zend_fiber_stack_allocate(zend_fiber_stack *stack, unsigned int size)
 	void *pointer;
 
 	msize = stack->size + ZEND_FIBER_GUARDPAGES * page_size;
-	pointer = mmap(0, msize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
-	if (pointer == (void *) -1) {
-		pointer = mmap(0, msize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (zend_fiber_stack_pool_take(stack)) {
+		pointer = (void *)((char *) stack->pointer - ZEND_FIBER_GUARDPAGES * page_size);
+		pooled = 1;
+	} else {
+		pointer = mmap(0, msize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
 		if (pointer == (void *) -1) {
-			return 0;
+			pointer = mmap(0, msize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+			if (pointer == (void *) -1) {
+				return 0;
+			}
 		}
-	}
 
 #if ZEND_FIBER_GUARDPAGES
-	mprotect(pointer, ZEND_FIBER_GUARDPAGES * page_size, PROT_NONE);
+		mprotect(pointer, ZEND_FIBER_GUARDPAGES * page_size, PROT_NONE);
 #endif
+	}
 
 	stack->pointer = (void *)((char *) pointer + ZEND_FIBER_GUARDPAGES * page_size);
 #else
@@ -71,6 +198,14 @@ zend_bool zend_fiber_stack_allocate(zend_fiber_stack *stack, unsigned int size)
 	stack->valgrind = VALGRIND_STACK_REGISTER(base, base + msize - ZEND_FIBER_GUARDPAGES * page_size);
 #endif
 
+	/* Pooled stacks are still counted. */
+	if (!pooled) {
+		FIBER_G(stack_count)++;
+		FIBER_G(stack_bytes) += stack->size;
+	}
+
+	ZEND_FIBER_PROBE_STACK(stack__allocate, stack->pointer, stack->size);
+
 	return 1;
 }
 
@@ -83,6 +218,8 @@ void zend_fiber_stack_free(zend_fiber_stack *stack)
 	}
 
 	if (stack->pointer != NULL) {
+		ZEND_FIBER_PROBE_STACK(stack__free, stack->pointer, stack->size);
+
 #ifdef VALGRIND_STACK_DEREGISTER
 		VALGRIND_STACK_DEREGISTER(stack->valgrind);
 #endif
@@ -95,9 +232,18 @@ void zend_fiber_stack_free(zend_fiber_stack *stack)
 		address = (void *)((char *) stack->pointer - ZEND_FIBER_GUARDPAGES * page_size);
 		len = stack->size + ZEND_FIBER_GUARDPAGES * page_size;
 
-		munmap(address, len);
+		/* Pooled stacks remain counted against fiber.max_stack_memory until they are unmapped. */
+		if (!zend_fiber_stack_pool_put(stack)) {
+			munmap(address, len);
+
+			FIBER_G(stack_count)--;
+			FIBER_G(stack_bytes) -= stack->size;
+		}
 #else
 		efree(stack->pointer);
+
+		FIBER_G(stack_count)--;
+		FIBER_G(stack_bytes) -= stack->size;
 #endif
 
 		stack->pointer = NULL;
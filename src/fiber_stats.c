@@ -0,0 +1,162 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "ext/standard/info.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_stats.h"
+
+#ifdef ZEND_FIBER_TICKS_TSC
+static uint64_t zend_fiber_stats_base_ticks;
+static uint64_t zend_fiber_stats_base_ns;
+#endif
+
+
+void zend_fiber_stats_startup()
+{
+#ifdef ZEND_FIBER_TICKS_TSC
+	zend_fiber_stats_base_ns = zend_fiber_clock();
+	zend_fiber_stats_base_ticks = zend_fiber_ticks();
+#endif
+}
+
+
+uint64_t zend_fiber_ticks_to_ns(uint64_t ticks)
+{
+#ifdef ZEND_FIBER_TICKS_TSC
+	uint64_t ns;
+	uint64_t elapsed;
+
+	/* The longer the process runs, the more accurate the rate measured since startup. */
+	ns = zend_fiber_clock() - zend_fiber_stats_base_ns;
+	elapsed = zend_fiber_ticks() - zend_fiber_stats_base_ticks;
+
+	if (elapsed == 0) {
+		return ticks;
+	}
+
+	return (uint64_t) ((double) ticks * ((double) ns / (double) elapsed));
+#else
+	return ticks;
+#endif
+}
+
+
+/* Pages of the VM stack, a suspended fiber keeps the stack it had when leaving. */
+static size_t zend_fiber_stats_vm_stack_bytes(zend_fiber *fiber)
+{
+	zend_vm_stack page;
+	size_t bytes;
+
+	page = (fiber == FIBER_G(current_fiber)) ? EG(vm_stack) : fiber->stack;
+	bytes = 0;
+
+	for (; page != NULL; page = page->prev) {
+		bytes += (char *) page->end - (char *) page;
+	}
+
+	return bytes;
+}
+
+
+void zend_fiber_stats_get(zend_fiber *fiber, zval *return_value)
+{
+	uint64_t now;
+	uint64_t run;
+	uint64_t suspended;
+	int64_t memory;
+
+	now = zend_fiber_ticks();
+	run = fiber->run_ticks;
+	suspended = fiber->suspended_ticks;
+
+	/* Include the current segment, a running fiber that resumed another one is not on CPU. */
+	if (fiber == FIBER_G(current_fiber)) {
+		run += now - fiber->switched_at;
+	} else if (fiber->status == ZEND_FIBER_STATUS_SUSPENDED) {
+		suspended += now - fiber->switched_at;
+	}
+
+	memory = fiber->memory;
+
+	/* Include allocations of the running fiber since it has been switched to. */
+	if (fiber == FIBER_G(current_fiber)) {
+		memory += (int64_t) zend_memory_usage(0) - (int64_t) FIBER_G(memory_mark);
+	}
+
+	array_init_size(return_value, 9);
+
+	add_assoc_long(return_value, "resumes", (zend_long) fiber->resumes);
+	add_assoc_long(return_value, "run_time_ns", (zend_long) zend_fiber_ticks_to_ns(run));
+	add_assoc_long(return_value, "suspended_time_ns", (zend_long) zend_fiber_ticks_to_ns(suspended));
+
+	if (fiber->first_run_at == 0) {
+		add_assoc_null(return_value, "time_to_first_run_ns");
+	} else {
+		add_assoc_long(return_value, "time_to_first_run_ns", (zend_long) zend_fiber_ticks_to_ns(fiber->first_run_at - fiber->created_at));
+	}
+
+	add_assoc_long(return_value, "stack_size", (zend_long) fiber->stack_size);
+	add_assoc_long(return_value, "vm_stack_bytes", (zend_long) zend_fiber_stats_vm_stack_bytes(fiber));
+	add_assoc_long(return_value, "memory_bytes", (zend_long) memory);
+
+	if (fiber->memory_budget == 0) {
+		add_assoc_null(return_value, "memory_budget");
+	} else {
+		add_assoc_long(return_value, "memory_budget", (zend_long) fiber->memory_budget);
+	}
+}
+
+
+void zend_fiber_stats_info()
+{
+	char buf[128];
+
+	snprintf(buf, sizeof(buf), "%u / %u / %u / %u / %u",
+		FIBER_G(fiber_count)[ZEND_FIBER_STATUS_INIT],
+		FIBER_G(fiber_count)[ZEND_FIBER_STATUS_SUSPENDED],
+		FIBER_G(fiber_count)[ZEND_FIBER_STATUS_RUNNING],
+		FIBER_G(fiber_count)[ZEND_FIBER_STATUS_FINISHED],
+		FIBER_G(fiber_count)[ZEND_FIBER_STATUS_DEAD]
+	);
+	php_info_print_table_row(2, "Live fibers (init / suspended / running / finished / dead)", buf);
+
+	snprintf(buf, sizeof(buf), "%" PRIu64, FIBER_G(switches));
+	php_info_print_table_row(2, "Context switches", buf);
+
+	if (FIBER_G(max_stack_memory) > 0) {
+		snprintf(buf, sizeof(buf), "%u (%zu of " ZEND_LONG_FMT " bytes)", FIBER_G(stack_count), FIBER_G(stack_bytes), FIBER_G(max_stack_memory));
+	} else {
+		snprintf(buf, sizeof(buf), "%u (%zu bytes)", FIBER_G(stack_count), FIBER_G(stack_bytes));
+	}
+	php_info_print_table_row(2, "Mapped fiber stacks", buf);
+
+	snprintf(buf, sizeof(buf), "%u of " ZEND_LONG_FMT, FIBER_G(stack_pool_count), FIBER_G(stack_pool_size));
+	php_info_print_table_row(2, "Pooled fiber stacks", buf);
+
+	snprintf(buf, sizeof(buf), "%u fibers in %.3f ms", FIBER_G(shutdown_count), FIBER_G(shutdown_time) / 1000000.0);
+	php_info_print_table_row(2, "Last request shutdown", buf);
+}
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
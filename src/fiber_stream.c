@@ -0,0 +1,551 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "zend.h"
+#include "main/php_network.h"
+#include "main/php_streams.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_poll.h"
+#include "fiber_stream.h"
+
+#ifdef ZEND_FIBER_POLL
+
+#include <sys/socket.h>
+
+#if PHP_VERSION_ID >= 70400
+typedef ssize_t zend_fiber_stream_size;
+#else
+typedef size_t zend_fiber_stream_size;
+#endif
+
+typedef struct _zend_fiber_stream zend_fiber_stream;
+
+/* Replaces the ops of every socket stream, the original ops are restored around every call into them so that
+ * transports comparing stream->ops keep working. Whether an operation parks the fiber is decided per call, a stream
+ * opened in main code (a connection pool, a client created before the fiber started) parks a fiber using it with async
+ * streams in effect and blocks as usual everywhere else. */
+struct _zend_fiber_stream {
+	/* Copy of the original ops with read, write, close and set_option replaced, must be the first member. */
+	php_stream_ops ops;
+
+	const php_stream_ops *orig;
+
+	/* Blocking mode requested by the user. */
+	int blocking;
+
+	/* Blocking mode the socket is currently in, -1 if unknown. */
+	int actual;
+
+	/* Plain TCP, UDP or Unix socket, connects of crypto transports are left blocking. */
+	zend_bool plain;
+
+	/* Abstract data starts with php_netstream_data_t (plain and crypto sockets), used for timeouts. */
+	zend_bool netstream;
+};
+
+/* Original factories keyed by transport name. */
+static HashTable zend_fiber_stream_factories;
+
+static void zend_fiber_stream_wrap(php_stream *stream, zend_bool plain, zend_bool netstream);
+
+
+zend_bool zend_fiber_stream_is_async()
+{
+	zend_fiber *fiber;
+
+	fiber = FIBER_G(current_fiber);
+
+	if (EXPECTED(fiber == NULL)) {
+		return 0;
+	}
+
+	if (fiber->flags & (ZEND_FIBER_FLAG_ASYNC_STREAMS | ZEND_FIBER_FLAG_SYNC_STREAMS)) {
+		return (fiber->flags & ZEND_FIBER_FLAG_ASYNC_STREAMS) != 0;
+	}
+
+	return FIBER_G(async_streams);
+}
+
+
+static int zend_fiber_stream_call_set_option(zend_fiber_stream *state, php_stream *stream, int option, int value, void *ptrparam)
+{
+	int result;
+
+	stream->ops = state->orig;
+	result = state->orig->set_option(stream, option, value, ptrparam);
+	stream->ops = &state->ops;
+
+	return result;
+}
+
+
+/* Puts the socket into the mode required by the caller, returns 1 if would-block results have to park the fiber. */
+static zend_bool zend_fiber_stream_prepare(zend_fiber_stream *state, php_stream *stream, zend_bool allow_async)
+{
+	zend_bool async;
+	int blocking;
+
+	async = allow_async && state->blocking && zend_fiber_stream_is_async();
+	blocking = async ? 0 : state->blocking;
+
+	if (state->actual != blocking) {
+		if (zend_fiber_stream_call_set_option(state, stream, PHP_STREAM_OPTION_BLOCKING, blocking, NULL) != -1) {
+			state->actual = blocking;
+		}
+	}
+
+	return async && state->actual == 0;
+}
+
+
+/* Socket data holding the read / write timeout (stream_set_timeout(), default_socket_timeout), NULL if unknown. */
+static php_netstream_data_t *zend_fiber_stream_sock(zend_fiber_stream *state, php_stream *stream)
+{
+	php_netstream_data_t *sock;
+
+	if (!state->netstream || stream->abstract == NULL) {
+		return NULL;
+	}
+
+	sock = (php_netstream_data_t *) stream->abstract;
+	sock->timeout_event = 0;
+
+	return sock;
+}
+
+
+/* Parks the fiber until the socket is ready, returns 0 if the fiber is being destroyed or the socket is gone and -1
+ * if the timeout (NULL or a negative one for none) passed first. */
+static int zend_fiber_stream_await(zend_fiber_stream *state, php_stream *stream, uint32_t events, struct timeval *timeout)
+{
+	php_socket_t fd;
+	zend_long ms;
+
+	if (state->orig->cast == NULL || state->orig->cast(stream, PHP_STREAM_AS_FD_FOR_SELECT, (void **) &fd) != SUCCESS) {
+		return 0;
+	}
+
+	ms = (timeout == NULL || timeout->tv_sec < 0) ? -1 : (zend_long) timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+
+	if (zend_fiber_poll_await_timeout((int) fd, events, ms) != 0) {
+		return 1;
+	}
+
+	return EG(exception) ? 0 : -1;
+}
+
+
+/* Waits for a read or write like the blocking socket would, a timeout is reported by stream_get_meta_data(). */
+static zend_bool zend_fiber_stream_await_io(zend_fiber_stream *state, php_stream *stream, php_netstream_data_t *sock, uint32_t events)
+{
+	int ready;
+
+	ready = zend_fiber_stream_await(state, stream, events, sock ? &sock->timeout : NULL);
+
+	if (ready < 0 && sock != NULL) {
+		sock->timeout_event = 1;
+	}
+
+	return ready > 0;
+}
+
+
+static zend_fiber_stream_size zend_fiber_stream_write(php_stream *stream, const char *buf, size_t count)
+{
+	zend_fiber_stream *state;
+	zend_fiber_stream_size result;
+	php_netstream_data_t *sock;
+	zend_bool async;
+
+	state = (zend_fiber_stream *) stream->ops;
+	async = zend_fiber_stream_prepare(state, stream, 1);
+	sock = async ? zend_fiber_stream_sock(state, stream) : NULL;
+
+	while (1) {
+		stream->ops = state->orig;
+		result = state->orig->write(stream, buf, count);
+		stream->ops = &state->ops;
+
+		if (!async || (zend_long) result > 0 || count == 0 || !PHP_IS_TRANSIENT_ERROR(php_socket_errno())) {
+			return result;
+		}
+
+		if (!zend_fiber_stream_await_io(state, stream, sock, EPOLLOUT)) {
+			return result;
+		}
+	}
+}
+
+
+static zend_fiber_stream_size zend_fiber_stream_read(php_stream *stream, char *buf, size_t count)
+{
+	zend_fiber_stream *state;
+	zend_fiber_stream_size result;
+	php_netstream_data_t *sock;
+	zend_bool async;
+
+	state = (zend_fiber_stream *) stream->ops;
+	async = zend_fiber_stream_prepare(state, stream, 1);
+	sock = async ? zend_fiber_stream_sock(state, stream) : NULL;
+
+	while (1) {
+		stream->ops = state->orig;
+		result = state->orig->read(stream, buf, count);
+		stream->ops = &state->ops;
+
+		if (!async || (zend_long) result > 0 || stream->eof || !PHP_IS_TRANSIENT_ERROR(php_socket_errno())) {
+			return result;
+		}
+
+		if (!zend_fiber_stream_await_io(state, stream, sock, EPOLLIN)) {
+			return result;
+		}
+	}
+}
+
+
+static int zend_fiber_stream_close(php_stream *stream, int close_handle)
+{
+	zend_fiber_stream *state;
+	int result;
+
+	state = (zend_fiber_stream *) stream->ops;
+
+	stream->ops = state->orig;
+	result = state->orig->close(stream, close_handle);
+
+	pefree(state, stream->is_persistent);
+
+	return result;
+}
+
+
+/* Connects without blocking and parks the fiber until the connection has been established. */
+static int zend_fiber_stream_connect(zend_fiber_stream *state, php_stream *stream, php_stream_xport_param *xparam)
+{
+	socklen_t length;
+	int result;
+	int ready;
+	int error;
+	php_socket_t fd;
+
+	xparam->op = STREAM_XPORT_OP_CONNECT_ASYNC;
+	result = zend_fiber_stream_call_set_option(state, stream, PHP_STREAM_OPTION_XPORT_API, 0, xparam);
+	xparam->op = STREAM_XPORT_OP_CONNECT;
+
+	/* The descriptor is left non-blocking, the stream still believes it is blocking. */
+	state->actual = -1;
+
+	if (result != PHP_STREAM_OPTION_RETURN_OK || xparam->outputs.returncode != 1) {
+		return result;
+	}
+
+	ready = zend_fiber_stream_await(state, stream, EPOLLOUT, xparam->inputs.timeout);
+
+	if (ready == 0) {
+		xparam->outputs.returncode = -1;
+		xparam->outputs.error_code = ECANCELED;
+
+		return result;
+	}
+
+	error = 0;
+	length = sizeof(error);
+
+	if (ready < 0) {
+		error = PHP_TIMEOUT_ERROR_VALUE;
+	} else if (state->orig->cast(stream, PHP_STREAM_AS_FD_FOR_SELECT, (void **) &fd) != SUCCESS
+		|| getsockopt(fd, SOL_SOCKET, SO_ERROR, (char *) &error, &length) != 0) {
+		error = errno;
+	}
+
+	if (error != 0) {
+		xparam->outputs.returncode = -1;
+		xparam->outputs.error_code = error;
+
+		if (xparam->want_errortext) {
+			xparam->outputs.error_text = php_socket_error_str(error);
+		}
+	} else {
+		xparam->outputs.returncode = 0;
+	}
+
+	return result;
+}
+
+
+static int zend_fiber_stream_accept(zend_fiber_stream *state, php_stream *stream, php_stream_xport_param *xparam, zend_bool async)
+{
+	int result;
+	int ready;
+
+	while (1) {
+		ready = async ? zend_fiber_stream_await(state, stream, EPOLLIN, xparam->inputs.timeout) : 1;
+
+		if (ready <= 0) {
+			xparam->outputs.returncode = -1;
+
+			/* Reported like the timeout of a blocking accept. */
+			if (ready < 0) {
+				xparam->outputs.error_code = PHP_TIMEOUT_ERROR_VALUE;
+
+				if (xparam->want_errortext) {
+					xparam->outputs.error_text = php_socket_error_str(PHP_TIMEOUT_ERROR_VALUE);
+				}
+			}
+
+			return PHP_STREAM_OPTION_RETURN_OK;
+		}
+
+		result = zend_fiber_stream_call_set_option(state, stream, PHP_STREAM_OPTION_XPORT_API, 0, xparam);
+
+		/* Another fiber may have accepted the connection in the meantime. */
+		if (!async || result != PHP_STREAM_OPTION_RETURN_OK || xparam->outputs.returncode == 0
+			|| !PHP_IS_TRANSIENT_ERROR(xparam->outputs.error_code)) {
+			break;
+		}
+
+		if (xparam->outputs.error_text != NULL) {
+			zend_string_release(xparam->outputs.error_text);
+			xparam->outputs.error_text = NULL;
+		}
+	}
+
+	if (result == PHP_STREAM_OPTION_RETURN_OK && xparam->outputs.returncode == 0 && xparam->outputs.client != NULL) {
+		zend_fiber_stream_wrap(xparam->outputs.client, state->plain, state->netstream);
+	}
+
+	return result;
+}
+
+
+static int zend_fiber_stream_set_option(php_stream *stream, int option, int value, void *ptrparam)
+{
+	zend_fiber_stream *state;
+	php_stream_xport_param *xparam;
+	php_netstream_data_t *sock;
+	zend_bool async;
+	int result;
+
+	state = (zend_fiber_stream *) stream->ops;
+
+	if (option == PHP_STREAM_OPTION_BLOCKING) {
+		result = state->blocking;
+		state->blocking = value ? 1 : 0;
+
+		zend_fiber_stream_prepare(state, stream, 1);
+
+		return result;
+	}
+
+	if (option != PHP_STREAM_OPTION_XPORT_API) {
+		return zend_fiber_stream_call_set_option(state, stream, option, value, ptrparam);
+	}
+
+	xparam = (php_stream_xport_param *) ptrparam;
+
+	switch (xparam->op) {
+		case STREAM_XPORT_OP_CONNECT:
+			/* The socket is only created by the connect, its mode cannot be prepared up front. */
+			if (state->plain && state->blocking && zend_fiber_stream_is_async()) {
+				return zend_fiber_stream_connect(state, stream, xparam);
+			}
+			break;
+
+		case STREAM_XPORT_OP_ACCEPT:
+			return zend_fiber_stream_accept(state, stream, xparam, zend_fiber_stream_prepare(state, stream, 1));
+
+		case STREAM_XPORT_OP_RECV:
+		case STREAM_XPORT_OP_SEND:
+			async = zend_fiber_stream_prepare(state, stream, 1);
+			sock = async ? zend_fiber_stream_sock(state, stream) : NULL;
+
+			while (1) {
+				result = zend_fiber_stream_call_set_option(state, stream, option, value, ptrparam);
+
+				if (!async || result != PHP_STREAM_OPTION_RETURN_OK || xparam->outputs.returncode >= 0
+					|| !PHP_IS_TRANSIENT_ERROR(php_socket_errno())) {
+					return result;
+				}
+
+				if (!zend_fiber_stream_await_io(state, stream, sock, xparam->op == STREAM_XPORT_OP_RECV ? EPOLLIN : EPOLLOUT)) {
+					return result;
+				}
+			}
+
+		default:
+			break;
+	}
+
+	return zend_fiber_stream_call_set_option(state, stream, option, value, ptrparam);
+}
+
+
+static void zend_fiber_stream_wrap(php_stream *stream, zend_bool plain, zend_bool netstream)
+{
+	zend_fiber_stream *state;
+
+	if (stream->ops->set_option == NULL || stream->ops->read == NULL || stream->ops->write == NULL) {
+		return;
+	}
+
+	state = pemalloc(sizeof(zend_fiber_stream), stream->is_persistent);
+
+	memcpy(&state->ops, stream->ops, sizeof(php_stream_ops));
+	state->ops.write = zend_fiber_stream_write;
+	state->ops.read = zend_fiber_stream_read;
+	state->ops.close = zend_fiber_stream_close;
+	state->ops.set_option = zend_fiber_stream_set_option;
+
+	state->orig = stream->ops;
+	state->blocking = 1;
+	state->actual = 1;
+	state->plain = plain;
+	state->netstream = netstream;
+
+	stream->ops = &state->ops;
+}
+
+
+void zend_fiber_stream_adopt(php_stream *stream)
+{
+	zend_fiber_stream_wrap(stream, 1, 1);
+}
+
+
+static php_stream *zend_fiber_stream_factory(const char *proto, size_t protolen, const char *resourcename, size_t resourcenamelen,
+	const char *persistent_id, int options, int flags, struct timeval *timeout, php_stream_context *context STREAMS_DC)
+{
+	php_stream_transport_factory factory;
+	php_stream *stream;
+	zend_bool plain;
+	zend_bool netstream;
+
+	factory = zend_hash_str_find_ptr(&zend_fiber_stream_factories, proto, protolen);
+
+	if (factory == NULL) {
+		return NULL;
+	}
+
+	stream = factory(proto, protolen, resourcename, resourcenamelen, persistent_id, options, flags, timeout, context STREAMS_REL_CC);
+
+	if (stream != NULL) {
+		plain = (protolen == 3 && (strncmp(proto, "tcp", 3) == 0 || strncmp(proto, "udp", 3) == 0 || strncmp(proto, "udg", 3) == 0))
+			|| (protolen == 4 && strncmp(proto, "unix", 4) == 0);
+
+		/* The crypto transports of ext/openssl embed php_netstream_data_t as their first member. */
+		netstream = plain || (protolen >= 3 && (strncmp(proto, "ssl", 3) == 0 || strncmp(proto, "tls", 3) == 0));
+
+		zend_fiber_stream_wrap(stream, plain, netstream);
+	}
+
+	return stream;
+}
+
+
+static void zend_fiber_stream_hook()
+{
+	HashTable *transports;
+	zend_string *name;
+	zval *factory;
+
+	transports = php_stream_xport_get_hash();
+
+	ZEND_HASH_FOREACH_STR_KEY_VAL(transports, name, factory) {
+		if (name == NULL || Z_PTR_P(factory) == zend_fiber_stream_factory) {
+			continue;
+		}
+
+		/* Registered after the last scan, or registered again replacing the factory hooked before. */
+		zend_hash_update_ptr(&zend_fiber_stream_factories, name, Z_PTR_P(factory));
+		Z_PTR_P(factory) = zend_fiber_stream_factory;
+	} ZEND_HASH_FOREACH_END();
+}
+
+
+void zend_fiber_stream_startup()
+{
+	zend_hash_init(&zend_fiber_stream_factories, 8, NULL, NULL, 1);
+
+	zend_fiber_stream_hook();
+}
+
+
+void zend_fiber_stream_activate()
+{
+#ifndef ZTS
+	/* Picks up transports of extensions started after this one, the table is shared by all threads in ZTS builds
+	 * and can only be changed during startup there. */
+	zend_fiber_stream_hook();
+#endif
+}
+
+
+void zend_fiber_stream_shutdown()
+{
+	HashTable *transports;
+	zend_string *name;
+	zval *factory;
+	zval *orig;
+
+	transports = php_stream_xport_get_hash();
+
+	ZEND_HASH_FOREACH_STR_KEY_VAL(transports, name, factory) {
+		if (name != NULL && Z_PTR_P(factory) == zend_fiber_stream_factory) {
+			orig = zend_hash_find(&zend_fiber_stream_factories, name);
+
+			if (orig != NULL) {
+				Z_PTR_P(factory) = Z_PTR_P(orig);
+			}
+		}
+	} ZEND_HASH_FOREACH_END();
+
+	zend_hash_destroy(&zend_fiber_stream_factories);
+}
+
+#else
+
+void zend_fiber_stream_startup()
+{
+}
+
+void zend_fiber_stream_activate()
+{
+}
+
+void zend_fiber_stream_shutdown()
+{
+}
+
+zend_bool zend_fiber_stream_is_async()
+{
+	return 0;
+}
+
+void zend_fiber_stream_adopt(php_stream *stream)
+{
+}
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,428 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "zend.h"
+#include "zend_exceptions.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_poll.h"
+#include "fiber_thread_pool.h"
+
+#ifdef ZEND_FIBER_POLL
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+
+struct _zend_fiber_thread_pool {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	/* Jobs waiting for a worker (FIFO). */
+	zend_fiber_job *head;
+	zend_fiber_job *tail;
+
+	/* Jobs that have been run but not yet seen by the PHP thread (LIFO). */
+	zend_fiber_job *completed;
+
+	/* Signalled by workers whenever a job has been completed. */
+	zend_fiber_poll_waiter waiter;
+
+	pthread_t *threads;
+	int thread_count;
+
+	/* Incremented at request end (PHP thread only), jobs of earlier requests have lost their waiters. */
+	uint32_t generation;
+
+	zend_bool registered;
+	zend_bool stopping;
+};
+
+
+static void *zend_fiber_thread_pool_worker(void *arg)
+{
+	zend_fiber_thread_pool *pool;
+	zend_fiber_job *job;
+	uint64_t one;
+
+	pool = (zend_fiber_thread_pool *) arg;
+	one = 1;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	while (1) {
+		while (pool->head == NULL && !pool->stopping) {
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		}
+
+		if (pool->head == NULL) {
+			break;
+		}
+
+		job = pool->head;
+		pool->head = job->next;
+
+		if (pool->head == NULL) {
+			pool->tail = NULL;
+		}
+
+		pthread_mutex_unlock(&pool->mutex);
+
+		job->run(job);
+
+		pthread_mutex_lock(&pool->mutex);
+
+		job->next = pool->completed;
+		pool->completed = job;
+
+		if (write(pool->waiter.fd, &one, sizeof(one)) < 0) {
+			/* Counter overflow is impossible, the PHP thread resets it on every read. */
+		}
+	}
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+
+static void zend_fiber_thread_pool_complete(zend_fiber_poll_waiter *waiter)
+{
+	zend_fiber_thread_pool *pool;
+	zend_fiber_job *job;
+	zend_fiber_job *list;
+	zend_fiber_job *next;
+	uint64_t count;
+
+	pool = FIBER_G(thread_pool);
+
+	if (read(waiter->fd, &count, sizeof(count)) < 0) {
+		/* Nothing to do, another dispatch already consumed the counter. */
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	job = pool->completed;
+	pool->completed = NULL;
+	pthread_mutex_unlock(&pool->mutex);
+
+	/* Restore submission order. */
+	list = NULL;
+
+	while (job != NULL) {
+		next = job->next;
+		job->next = list;
+		list = job;
+		job = next;
+	}
+
+	for (job = list; job != NULL; job = next) {
+		next = job->next;
+
+		/* The poller has been reset since, the job is not referenced any more. */
+		if (job->generation != pool->generation) {
+			job->free(job);
+			continue;
+		}
+
+		job->done = 1;
+
+		zend_fiber_poll_unref();
+
+		if (job->abandoned) {
+			job->free(job);
+		} else if (job->fiber != NULL) {
+			zend_fiber_poll_wake(job->fiber);
+		}
+	}
+}
+
+
+static zend_fiber_thread_pool *zend_fiber_thread_pool_get()
+{
+	zend_fiber_thread_pool *pool;
+	sigset_t mask;
+	sigset_t prev;
+	int count;
+	int i;
+
+	pool = FIBER_G(thread_pool);
+
+	if (EXPECTED(pool != NULL)) {
+		if (UNEXPECTED(!pool->registered)) {
+			if (!zend_fiber_poll_add_handler(&pool->waiter)) {
+				return NULL;
+			}
+
+			pool->registered = 1;
+		}
+
+		return pool;
+	}
+
+	count = (int) FIBER_G(thread_pool_size);
+
+	if (count <= 0) {
+		return NULL;
+	}
+
+	pool = pecalloc(1, sizeof(zend_fiber_thread_pool), 1);
+
+	pool->waiter.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	pool->waiter.events = EPOLLIN;
+	pool->waiter.handler = zend_fiber_thread_pool_complete;
+
+	if (pool->waiter.fd < 0) {
+		pefree(pool, 1);
+		return NULL;
+	}
+
+	if (!zend_fiber_poll_add_handler(&pool->waiter)) {
+		close(pool->waiter.fd);
+		pefree(pool, 1);
+		return NULL;
+	}
+
+	pool->registered = 1;
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	pool->threads = pecalloc(count, sizeof(pthread_t), 1);
+
+	/* Signals (timeouts, pcntl) must keep being delivered to the PHP thread. */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &prev);
+
+	for (i = 0; i < count; i++) {
+		if (pthread_create(&pool->threads[pool->thread_count], NULL, zend_fiber_thread_pool_worker, pool) == 0) {
+			pool->thread_count++;
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &prev, NULL);
+
+	FIBER_G(thread_pool) = pool;
+
+	if (pool->thread_count == 0) {
+		zend_fiber_thread_pool_shutdown();
+		return NULL;
+	}
+
+	return pool;
+}
+
+
+static void zend_fiber_thread_pool_unpark(zend_fiber *fiber, void *data)
+{
+	zend_fiber_job *job;
+
+	job = (zend_fiber_job *) data;
+
+	/* A worker may still be running the job, it is freed once it has completed. */
+	job->fiber = NULL;
+	job->abandoned = 1;
+}
+
+
+zend_bool zend_fiber_thread_pool_await(zend_fiber_job *job)
+{
+	zend_fiber_thread_pool *pool;
+	zend_fiber *fiber;
+
+	job->next = NULL;
+	job->done = 0;
+	job->abandoned = 0;
+
+	pool = zend_fiber_thread_pool_get();
+
+	if (UNEXPECTED(EG(exception))) {
+		job->free(job);
+		return 0;
+	}
+
+	if (pool == NULL) {
+		/* No workers available, degrade to a blocking call. */
+		job->run(job);
+		job->done = 1;
+
+		return 1;
+	}
+
+	fiber = FIBER_G(current_fiber);
+	job->fiber = fiber;
+
+	job->generation = pool->generation;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	if (pool->tail == NULL) {
+		pool->head = job;
+	} else {
+		pool->tail->next = job;
+	}
+
+	pool->tail = job;
+
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	zend_fiber_poll_ref();
+
+	if (fiber == NULL) {
+		while (!job->done && !EG(exception)) {
+			if (zend_fiber_poll_dispatch(-1) < 0) {
+				break;
+			}
+		}
+	} else {
+		zend_fiber_park(fiber, zend_fiber_thread_pool_unpark, job);
+
+		while (!job->done && !EG(exception)) {
+			zend_fiber_do_suspend(fiber, NULL, NULL);
+		}
+
+		zend_fiber_unpark(fiber);
+	}
+
+	if (!job->done) {
+		job->fiber = NULL;
+		job->abandoned = 1;
+
+		return 0;
+	}
+
+	return 1;
+}
+
+
+void zend_fiber_thread_pool_reset()
+{
+	zend_fiber_thread_pool *pool;
+
+	pool = FIBER_G(thread_pool);
+
+	if (pool == NULL) {
+		return;
+	}
+
+	if (pool->registered) {
+		zend_fiber_poll_remove_handler(&pool->waiter);
+		pool->registered = 0;
+	}
+
+	pool->generation++;
+}
+
+
+void zend_fiber_thread_pool_fork()
+{
+	zend_fiber_thread_pool *pool;
+
+	pool = FIBER_G(thread_pool);
+
+	if (pool == NULL) {
+		return;
+	}
+
+	/* Workers have not been forked and may have held the mutex, queued jobs are left to orphaned fibers. */
+	close(pool->waiter.fd);
+
+	pefree(pool->threads, 1);
+	pefree(pool, 1);
+
+	FIBER_G(thread_pool) = NULL;
+}
+
+
+void zend_fiber_thread_pool_shutdown()
+{
+	zend_fiber_thread_pool *pool;
+	zend_fiber_job *job;
+	zend_fiber_job *next;
+	int i;
+
+	pool = FIBER_G(thread_pool);
+
+	if (pool == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stopping = 1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->thread_count; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	/* Waiting fibers are gone by now, everything left over has been abandoned. */
+	for (job = pool->head; job != NULL; job = next) {
+		next = job->next;
+		job->free(job);
+	}
+
+	for (job = pool->completed; job != NULL; job = next) {
+		next = job->next;
+		job->free(job);
+	}
+
+	if (pool->registered) {
+		zend_fiber_poll_remove_handler(&pool->waiter);
+	}
+
+	close(pool->waiter.fd);
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+
+	pefree(pool->threads, 1);
+	pefree(pool, 1);
+
+	FIBER_G(thread_pool) = NULL;
+}
+
+#else
+
+zend_bool zend_fiber_thread_pool_await(zend_fiber_job *job)
+{
+	job->run(job);
+	job->done = 1;
+
+	return 1;
+}
+
+void zend_fiber_thread_pool_shutdown()
+{
+}
+
+void zend_fiber_thread_pool_reset()
+{
+}
+
+void zend_fiber_thread_pool_fork()
+{
+}
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,1218 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "zend_exceptions.h"
+#include "main/fopen_wrappers.h"
+#include "main/php_network.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_poll.h"
+#include "fiber_uring.h"
+
+#ifndef ZEND_PARSE_PARAMETERS_NONE
+#define ZEND_PARSE_PARAMETERS_NONE() zend_parse_parameters_none()
+#endif
+
+#ifdef ZEND_FIBER_POLL
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+
+#ifdef HAVE_FIBER_URING
+#include <liburing.h>
+
+typedef struct _zend_fiber_uring_request zend_fiber_uring_request;
+
+struct _zend_fiber_uring_request {
+	/* Fiber waiting for the completion, NULL when awaited from main thread. */
+	zend_fiber *fiber;
+
+	/* Result of the operation, negative errno on failure. */
+	int result;
+
+	zend_bool done;
+};
+
+/* Interval (in nanoseconds) after which a cancellation that has not completed the operation is repeated. */
+#define ZEND_FIBER_URING_CANCEL_RETRY 100000000
+
+struct _zend_fiber_uring {
+	struct io_uring ring;
+
+	/* Eventfd registered with the ring, signalled for every completion. */
+	zend_fiber_poll_waiter waiter;
+
+	/* Operations supported by the running kernel (indexed by opcode). */
+	zend_bool supported[IORING_OP_LAST];
+
+	/* Number of prepared but not yet submitted SQEs. */
+	uint32_t queued;
+
+	/* Fibers whose operations have completed but have not been resumed yet. */
+	zend_fiber **ready;
+	uint32_t ready_count;
+	uint32_t ready_size;
+};
+#endif
+
+static zend_class_entry *zend_ce_fiber_uring;
+
+
+#ifdef HAVE_FIBER_URING
+static void zend_fiber_uring_complete(zend_fiber_uring *uring, struct io_uring_cqe *cqe)
+{
+	zend_fiber_uring_request *request;
+
+	request = (zend_fiber_uring_request *) io_uring_cqe_get_data(cqe);
+
+	/* Cancellations are submitted without a request. */
+	if (request != NULL) {
+		request->result = cqe->res;
+		request->done = 1;
+
+		zend_fiber_poll_unref();
+
+		if (request->fiber != NULL) {
+			if (uring->ready_count == uring->ready_size) {
+				uring->ready_size = MAX(uring->ready_size * 2, 16);
+				uring->ready = perealloc(uring->ready, uring->ready_size * sizeof(zend_fiber *), 1);
+			}
+
+			uring->ready[uring->ready_count++] = request->fiber;
+			GC_ADDREF(&request->fiber->std);
+		}
+	}
+
+	io_uring_cqe_seen(&uring->ring, cqe);
+}
+
+
+/* Reaps all completions and resumes their fibers in one batch. */
+static void zend_fiber_uring_handler(zend_fiber_poll_waiter *waiter)
+{
+	zend_fiber_uring *uring;
+	struct io_uring_cqe *cqe;
+	zend_fiber **fibers;
+	uint32_t count;
+	uint32_t i;
+	uint64_t value;
+
+	uring = FIBER_G(uring);
+
+	if (read(waiter->fd, &value, sizeof(value)) < 0) {
+		/* Nothing to do, completions may already have been reaped. */
+	}
+
+	while (io_uring_peek_cqe(&uring->ring, &cqe) == 0) {
+		zend_fiber_uring_complete(uring, cqe);
+	}
+
+	/* Resumed fibers may queue and reap further operations, take the batch out first. */
+	while (uring->ready_count > 0) {
+		fibers = uring->ready;
+		count = uring->ready_count;
+
+		uring->ready = NULL;
+		uring->ready_count = 0;
+		uring->ready_size = 0;
+
+		for (i = 0; i < count; i++) {
+			zend_fiber_poll_wake(fibers[i]);
+			OBJ_RELEASE(&fibers[i]->std);
+		}
+
+		pefree(fibers, 1);
+	}
+}
+
+
+static zend_fiber_uring *zend_fiber_uring_get()
+{
+	zend_fiber_uring *uring;
+	struct io_uring_probe *probe;
+	int i;
+
+	uring = FIBER_G(uring);
+
+	if (EXPECTED(uring != NULL) || FIBER_G(uring_failed)) {
+		return uring;
+	}
+
+	/* Any failure (old kernel, seccomp, memlock limits) permanently selects the fallback. */
+	FIBER_G(uring_failed) = 1;
+
+	uring = pecalloc(1, sizeof(zend_fiber_uring), 1);
+
+	if (io_uring_queue_init(ZEND_FIBER_URING_ENTRIES, &uring->ring, 0) < 0) {
+		pefree(uring, 1);
+		return NULL;
+	}
+
+	probe = io_uring_get_probe_ring(&uring->ring);
+
+	if (probe == NULL) {
+		io_uring_queue_exit(&uring->ring);
+		pefree(uring, 1);
+		return NULL;
+	}
+
+	for (i = 0; i < IORING_OP_LAST; i++) {
+		uring->supported[i] = io_uring_opcode_supported(probe, i);
+	}
+
+	io_uring_free_probe(probe);
+
+	uring->waiter.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	uring->waiter.events = EPOLLIN;
+	uring->waiter.handler = zend_fiber_uring_handler;
+
+	if (uring->waiter.fd < 0 || io_uring_register_eventfd(&uring->ring, uring->waiter.fd) < 0) {
+		if (uring->waiter.fd >= 0) {
+			close(uring->waiter.fd);
+		}
+
+		io_uring_queue_exit(&uring->ring);
+		pefree(uring, 1);
+		return NULL;
+	}
+
+	if (!zend_fiber_poll_add_handler(&uring->waiter)) {
+		zend_clear_exception();
+		close(uring->waiter.fd);
+		io_uring_queue_exit(&uring->ring);
+		pefree(uring, 1);
+		return NULL;
+	}
+
+	FIBER_G(uring) = uring;
+	FIBER_G(uring_failed) = 0;
+
+	return uring;
+}
+
+
+/* Returns an SQE for the given operation or NULL if the fallback must be used. */
+static struct io_uring_sqe *zend_fiber_uring_sqe(zend_uchar opcode)
+{
+	zend_fiber_uring *uring;
+	struct io_uring_sqe *sqe;
+
+	uring = zend_fiber_uring_get();
+
+	if (uring == NULL || !uring->supported[opcode]) {
+		return NULL;
+	}
+
+	sqe = io_uring_get_sqe(&uring->ring);
+
+	if (sqe == NULL) {
+		zend_fiber_uring_flush();
+		sqe = io_uring_get_sqe(&uring->ring);
+	}
+
+	return sqe;
+}
+
+
+/* Submits a cancellation of the request, the submission queue is flushed until there is room for it. */
+static void zend_fiber_uring_submit_cancel(zend_fiber_uring *uring, zend_fiber_uring_request *request)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	zend_bool reaped;
+
+	while ((sqe = io_uring_get_sqe(&uring->ring)) == NULL) {
+		if (io_uring_submit(&uring->ring) >= 0) {
+			continue;
+		}
+
+		/* Submission fails while the completion queue is full, reaping makes room. */
+		reaped = 0;
+
+		while (io_uring_peek_cqe(&uring->ring, &cqe) == 0) {
+			zend_fiber_uring_complete(uring, cqe);
+			reaped = 1;
+		}
+
+		if (!reaped) {
+			break;
+		}
+	}
+
+	if (sqe != NULL) {
+		io_uring_prep_cancel(sqe, request, 0);
+		io_uring_sqe_set_data(sqe, NULL);
+	}
+
+	io_uring_submit(&uring->ring);
+	uring->queued = 0;
+}
+
+
+/* Cancels an operation whose fiber is being destroyed, the kernel must be done with the buffers before returning. */
+static void zend_fiber_uring_cancel(zend_fiber_uring *uring, zend_fiber_uring_request *request)
+{
+	struct io_uring_cqe *cqe;
+	struct __kernel_timespec timeout;
+	uint64_t one;
+	int result;
+
+	request->fiber = NULL;
+
+	zend_fiber_uring_submit_cancel(uring, request);
+
+	while (!request->done) {
+		timeout.tv_sec = 0;
+		timeout.tv_nsec = ZEND_FIBER_URING_CANCEL_RETRY;
+
+		result = io_uring_wait_cqe_timeout(&uring->ring, &cqe, &timeout);
+
+		if (result == -EINTR) {
+			continue;
+		}
+
+		/* The operation may not have been cancellable yet (still being issued by a kernel worker), try again. */
+		if (result == -ETIME || result == -EAGAIN || result == -EBUSY) {
+			zend_fiber_uring_submit_cancel(uring, request);
+			continue;
+		}
+
+		if (result < 0) {
+			break;
+		}
+
+		zend_fiber_uring_complete(uring, cqe);
+	}
+
+	/* Completions of other fibers have been reaped here, make sure the handler runs to resume them. */
+	if (uring->ready_count > 0) {
+		one = 1;
+
+		if (write(uring->waiter.fd, &one, sizeof(one)) < 0) {
+			/* The handler runs anyway if the counter is already non-zero. */
+		}
+	}
+}
+
+
+static void zend_fiber_uring_unpark(zend_fiber *fiber, void *data)
+{
+	zend_fiber_uring_request *request;
+
+	request = (zend_fiber_uring_request *) data;
+
+	if (!request->done) {
+		zend_fiber_uring_cancel(FIBER_G(uring), request);
+	}
+}
+
+
+/* Queues the prepared SQE and suspends until it has completed, submission is deferred to the next flush. */
+static int zend_fiber_uring_submit(struct io_uring_sqe *sqe)
+{
+	zend_fiber_uring *uring;
+	zend_fiber_uring_request request;
+	zend_fiber *fiber;
+
+	uring = FIBER_G(uring);
+	fiber = FIBER_G(current_fiber);
+
+	request.fiber = fiber;
+	request.result = 0;
+	request.done = 0;
+
+	io_uring_sqe_set_data(sqe, &request);
+
+	uring->queued++;
+	zend_fiber_poll_ref();
+
+	if (fiber == NULL) {
+		while (!request.done && !EG(exception)) {
+			if (zend_fiber_poll_dispatch(-1) < 0) {
+				break;
+			}
+		}
+	} else {
+		zend_fiber_park(fiber, zend_fiber_uring_unpark, &request);
+
+		while (!request.done && !EG(exception)) {
+			zend_fiber_do_suspend(fiber, NULL, NULL);
+		}
+
+		zend_fiber_unpark(fiber);
+	}
+
+	if (!request.done) {
+		zend_fiber_uring_cancel(uring, &request);
+
+		return -ECANCELED;
+	}
+
+	return request.result;
+}
+
+
+void zend_fiber_uring_flush()
+{
+	zend_fiber_uring *uring;
+
+	uring = FIBER_G(uring);
+
+	if (uring != NULL && uring->queued > 0 && io_uring_submit(&uring->ring) >= 0) {
+		uring->queued = 0;
+	}
+}
+
+
+void zend_fiber_uring_shutdown()
+{
+	zend_fiber_uring *uring;
+	uint32_t i;
+
+	uring = FIBER_G(uring);
+
+	if (uring == NULL) {
+		return;
+	}
+
+	zend_fiber_poll_remove_handler(&uring->waiter);
+	close(uring->waiter.fd);
+
+	/* Operations of parked fibers have been cancelled, only requests abandoned by a bailout can be left. */
+	io_uring_queue_exit(&uring->ring);
+
+	for (i = 0; i < uring->ready_count; i++) {
+		OBJ_RELEASE(&uring->ready[i]->std);
+	}
+
+	if (uring->ready != NULL) {
+		pefree(uring->ready, 1);
+	}
+
+	pefree(uring, 1);
+
+	FIBER_G(uring) = NULL;
+}
+
+
+void zend_fiber_uring_fork()
+{
+	zend_fiber_uring *uring;
+	uint32_t i;
+
+	uring = FIBER_G(uring);
+
+	if (uring == NULL) {
+		return;
+	}
+
+	/* The ring is shared with the parent, it is only unmapped and closed in the child. */
+	close(uring->waiter.fd);
+	io_uring_queue_exit(&uring->ring);
+
+	for (i = 0; i < uring->ready_count; i++) {
+		OBJ_RELEASE(&uring->ready[i]->std);
+	}
+
+	if (uring->ready != NULL) {
+		pefree(uring->ready, 1);
+	}
+
+	pefree(uring, 1);
+
+	FIBER_G(uring) = NULL;
+}
+
+
+zend_bool zend_fiber_uring_available()
+{
+	return zend_fiber_uring_get() != NULL;
+}
+
+#else
+
+void zend_fiber_uring_flush()
+{
+}
+
+void zend_fiber_uring_shutdown()
+{
+}
+
+void zend_fiber_uring_fork()
+{
+}
+
+zend_bool zend_fiber_uring_available()
+{
+	return 0;
+}
+
+#endif
+
+
+/* Waits for readiness after a syscall of the fallback failed with EAGAIN, returns 0 if the error is final. */
+static zend_bool zend_fiber_uring_would_block(int fd, uint32_t events)
+{
+	int error;
+
+	error = errno;
+
+	if (error != EAGAIN && error != EWOULDBLOCK) {
+		return 0;
+	}
+
+	if (zend_fiber_poll_await(fd, events) == 0) {
+		errno = EG(exception) ? ECANCELED : error;
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/* Switches a pipe, socket or terminal to non-blocking mode for one syscall of the fallback, returns the flags to restore
+ * or -1 if the descriptor was left alone. The mode is shared with every other user of the descriptor, it must not stay
+ * changed while the fiber is parked. */
+static int zend_fiber_uring_nonblock(int fd)
+{
+	struct stat st;
+	int flags;
+
+	/* Regular files and block devices never report EAGAIN. */
+	if (fstat(fd, &st) != 0 || S_ISREG(st.st_mode) || S_ISBLK(st.st_mode)) {
+		return -1;
+	}
+
+	flags = fcntl(fd, F_GETFL);
+
+	if (flags < 0 || (flags & O_NONBLOCK) || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+		return -1;
+	}
+
+	return flags;
+}
+
+
+static void zend_fiber_uring_restore(int fd, int flags)
+{
+	int error;
+
+	if (flags >= 0) {
+		error = errno;
+		fcntl(fd, F_SETFL, flags);
+		errno = error;
+	}
+}
+
+
+/* Streams still holding read data in their buffer are rejected when reading, the raw descriptor is past that data. */
+static zend_bool zend_fiber_uring_arg_fd(zval *arg, const char *method, zend_bool reading, int *fd)
+{
+	php_stream *stream;
+	php_socket_t handle;
+
+	if (Z_TYPE_P(arg) == IS_LONG) {
+		if (Z_LVAL_P(arg) < 0 || Z_LVAL_P(arg) > INT_MAX) {
+			zend_throw_error(NULL, "Fiber\\Uring::%s(): Argument #1 ($fd) must be a valid file descriptor", method);
+			return 0;
+		}
+
+		*fd = (int) Z_LVAL_P(arg);
+
+		return 1;
+	}
+
+	if (Z_TYPE_P(arg) != IS_RESOURCE) {
+		zend_type_error("Fiber\\Uring::%s(): Argument #1 ($fd) must be of type resource|int, %s given", method, zend_zval_type_name(arg));
+		return 0;
+	}
+
+	php_stream_from_zval_no_verify(stream, arg);
+
+	if (stream == NULL) {
+		zend_type_error("Fiber\\Uring::%s(): Argument #1 ($fd) must be a valid stream resource", method);
+		return 0;
+	}
+
+	if (reading && stream->writepos > stream->readpos) {
+		zend_throw_error(NULL, "Fiber\\Uring::%s(): Argument #1 ($fd) must not have data buffered by the stream", method);
+		return 0;
+	}
+
+	php_stream_flush(stream);
+
+	if (php_stream_cast(stream, PHP_STREAM_AS_FD_FOR_SELECT | PHP_STREAM_CAST_INTERNAL, (void *) &handle, REPORT_ERRORS) == FAILURE) {
+		return 0;
+	}
+
+	*fd = (int) handle;
+
+	return 1;
+}
+
+
+static zend_bool zend_fiber_uring_result(const char *method, ssize_t result)
+{
+	if (result >= 0) {
+		return 1;
+	}
+
+	if (!EG(exception)) {
+		php_error_docref(NULL, E_WARNING, "%s(): %s", method, strerror((int) -result));
+	}
+
+	return 0;
+}
+
+
+/* {{{ proto string|false Fiber\Uring::read(resource|int $fd, int $length, int $offset = -1) */
+ZEND_METHOD(FiberUring, read)
+{
+#ifdef HAVE_FIBER_URING
+	struct io_uring_sqe *sqe;
+#endif
+	zval *arg;
+	zend_string *buffer;
+	zend_long length;
+	zend_long offset;
+	ssize_t result;
+	int nonblock;
+	int fd;
+
+	offset = -1;
+
+	ZEND_PARSE_PARAMETERS_START(2, 3)
+		Z_PARAM_ZVAL(arg)
+		Z_PARAM_LONG(length)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(offset)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (length <= 0 || length > INT_MAX) {
+		zend_throw_error(NULL, "Fiber\\Uring::read(): Argument #2 ($length) must be between 1 and %d", INT_MAX);
+		return;
+	}
+
+	if (!zend_fiber_uring_arg_fd(arg, "read", 1, &fd)) {
+		return;
+	}
+
+	/* The kernel writes straight into the string that is returned. */
+	buffer = zend_string_alloc(length, 0);
+
+#ifdef HAVE_FIBER_URING
+	if ((sqe = zend_fiber_uring_sqe(IORING_OP_READ)) != NULL) {
+		io_uring_prep_read(sqe, fd, ZSTR_VAL(buffer), (unsigned) length, (uint64_t) (offset < 0 ? -1 : offset));
+		result = zend_fiber_uring_submit(sqe);
+	} else
+#endif
+	{
+		do {
+			nonblock = zend_fiber_uring_nonblock(fd);
+			result = (offset < 0) ? read(fd, ZSTR_VAL(buffer), length) : pread(fd, ZSTR_VAL(buffer), length, offset);
+			zend_fiber_uring_restore(fd, nonblock);
+		} while (result < 0 && zend_fiber_uring_would_block(fd, EPOLLIN));
+
+		result = (result < 0) ? -errno : result;
+	}
+
+	if (!zend_fiber_uring_result("read", result)) {
+		zend_string_efree(buffer);
+		RETURN_FALSE;
+	}
+
+	if ((zend_long) result < length / 2) {
+		buffer = zend_string_truncate(buffer, result, 0);
+	}
+
+	ZSTR_LEN(buffer) = result;
+	ZSTR_VAL(buffer)[result] = '\0';
+
+	RETURN_NEW_STR(buffer);
+}
+/* }}} */
+
+
+/* {{{ proto int|false Fiber\Uring::write(resource|int $fd, string $data, int $offset = -1) */
+ZEND_METHOD(FiberUring, write)
+{
+#ifdef HAVE_FIBER_URING
+	struct io_uring_sqe *sqe;
+#endif
+	zval *arg;
+	zend_string *data;
+	zend_long offset;
+	ssize_t result;
+	int nonblock;
+	int fd;
+
+	offset = -1;
+
+	ZEND_PARSE_PARAMETERS_START(2, 3)
+		Z_PARAM_ZVAL(arg)
+		Z_PARAM_STR(data)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(offset)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (!zend_fiber_uring_arg_fd(arg, "write", 0, &fd)) {
+		return;
+	}
+
+	/* Keep the buffer alive even if the variable is reassigned while the fiber is suspended. */
+	zend_string_addref(data);
+
+#ifdef HAVE_FIBER_URING
+	if ((sqe = zend_fiber_uring_sqe(IORING_OP_WRITE)) != NULL) {
+		io_uring_prep_write(sqe, fd, ZSTR_VAL(data), (unsigned) MIN(ZSTR_LEN(data), INT_MAX), (uint64_t) (offset < 0 ? -1 : offset));
+		result = zend_fiber_uring_submit(sqe);
+	} else
+#endif
+	{
+		do {
+			nonblock = zend_fiber_uring_nonblock(fd);
+			result = (offset < 0) ? write(fd, ZSTR_VAL(data), ZSTR_LEN(data)) : pwrite(fd, ZSTR_VAL(data), ZSTR_LEN(data), offset);
+			zend_fiber_uring_restore(fd, nonblock);
+		} while (result < 0 && zend_fiber_uring_would_block(fd, EPOLLOUT));
+
+		result = (result < 0) ? -errno : result;
+	}
+
+	zend_string_release(data);
+
+	if (!zend_fiber_uring_result("write", result)) {
+		RETURN_FALSE;
+	}
+
+	RETURN_LONG(result);
+}
+/* }}} */
+
+
+/* {{{ proto array|false Fiber\Uring::readv(resource|int $fd, array $lengths, int $offset = -1) */
+ZEND_METHOD(FiberUring, readv)
+{
+#ifdef HAVE_FIBER_URING
+	struct io_uring_sqe *sqe;
+#endif
+	zval *arg;
+	zval *entry;
+	HashTable *lengths;
+	zend_string **buffers;
+	struct iovec *iov;
+	zend_long offset;
+	ssize_t result;
+	size_t remaining;
+	uint32_t count;
+	uint32_t i;
+	int nonblock;
+	int fd;
+
+	offset = -1;
+
+	ZEND_PARSE_PARAMETERS_START(2, 3)
+		Z_PARAM_ZVAL(arg)
+		Z_PARAM_ARRAY_HT(lengths)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(offset)
+	ZEND_PARSE_PARAMETERS_END();
+
+	count = zend_hash_num_elements(lengths);
+
+	if (count == 0 || count > IOV_MAX) {
+		zend_throw_error(NULL, "Fiber\\Uring::readv(): Argument #2 ($lengths) must contain between 1 and %d lengths", IOV_MAX);
+		return;
+	}
+
+	ZEND_HASH_FOREACH_VAL(lengths, entry) {
+		if (Z_TYPE_P(entry) != IS_LONG || Z_LVAL_P(entry) <= 0 || Z_LVAL_P(entry) > INT_MAX) {
+			zend_throw_error(NULL, "Fiber\\Uring::readv(): Argument #2 ($lengths) must only contain positive integers");
+			return;
+		}
+	} ZEND_HASH_FOREACH_END();
+
+	if (!zend_fiber_uring_arg_fd(arg, "readv", 1, &fd)) {
+		return;
+	}
+
+	buffers = safe_emalloc(count, sizeof(zend_string *), 0);
+	iov = safe_emalloc(count, sizeof(struct iovec), 0);
+	i = 0;
+
+	ZEND_HASH_FOREACH_VAL(lengths, entry) {
+		buffers[i] = zend_string_alloc(Z_LVAL_P(entry), 0);
+		iov[i].iov_base = ZSTR_VAL(buffers[i]);
+		iov[i].iov_len = Z_LVAL_P(entry);
+		i++;
+	} ZEND_HASH_FOREACH_END();
+
+#ifdef HAVE_FIBER_URING
+	if ((sqe = zend_fiber_uring_sqe(IORING_OP_READV)) != NULL) {
+		io_uring_prep_readv(sqe, fd, iov, count, (uint64_t) (offset < 0 ? -1 : offset));
+		result = zend_fiber_uring_submit(sqe);
+	} else
+#endif
+	{
+		do {
+			nonblock = zend_fiber_uring_nonblock(fd);
+			result = (offset < 0) ? readv(fd, iov, count) : preadv(fd, iov, count, offset);
+			zend_fiber_uring_restore(fd, nonblock);
+		} while (result < 0 && zend_fiber_uring_would_block(fd, EPOLLIN));
+
+		result = (result < 0) ? -errno : result;
+	}
+
+	if (zend_fiber_uring_result("readv", result)) {
+		array_init_size(return_value, count);
+		remaining = result;
+
+		for (i = 0; i < count; i++) {
+			ZSTR_LEN(buffers[i]) = MIN(remaining, iov[i].iov_len);
+			ZSTR_VAL(buffers[i])[ZSTR_LEN(buffers[i])] = '\0';
+			remaining -= ZSTR_LEN(buffers[i]);
+
+			add_next_index_str(return_value, buffers[i]);
+		}
+	} else {
+		for (i = 0; i < count; i++) {
+			zend_string_efree(buffers[i]);
+		}
+
+		RETVAL_FALSE;
+	}
+
+	efree(buffers);
+	efree(iov);
+}
+/* }}} */
+
+
+/* {{{ proto resource|false Fiber\Uring::openat(string $path, int $flags = Fiber\Uring::O_RDONLY, int $mode = 0666) */
+ZEND_METHOD(FiberUring, openat)
+{
+#ifdef HAVE_FIBER_URING
+	struct io_uring_sqe *sqe;
+#endif
+	php_stream *stream;
+	zend_string *path;
+	zend_long flags;
+	zend_long mode;
+	const char *stream_mode;
+	char *resolved;
+	int result;
+
+	flags = O_RDONLY;
+	mode = 0666;
+
+	ZEND_PARSE_PARAMETERS_START(1, 3)
+		Z_PARAM_PATH_STR(path)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(flags)
+		Z_PARAM_LONG(mode)
+	ZEND_PARSE_PARAMETERS_END();
+
+	resolved = expand_filepath(ZSTR_VAL(path), NULL);
+
+	if (resolved == NULL) {
+		php_error_docref(NULL, E_WARNING, "Unable to resolve path '%s'", ZSTR_VAL(path));
+		RETURN_FALSE;
+	}
+
+	if (php_check_open_basedir(resolved)) {
+		efree(resolved);
+		RETURN_FALSE;
+	}
+
+	flags |= O_CLOEXEC;
+
+#ifdef HAVE_FIBER_URING
+	if ((sqe = zend_fiber_uring_sqe(IORING_OP_OPENAT)) != NULL) {
+		io_uring_prep_openat(sqe, AT_FDCWD, resolved, (int) flags, (mode_t) mode);
+		result = zend_fiber_uring_submit(sqe);
+	} else
+#endif
+	{
+		result = open(resolved, (int) flags, (mode_t) mode);
+		result = (result < 0) ? -errno : result;
+	}
+
+	efree(resolved);
+
+	if (!zend_fiber_uring_result("openat", result)) {
+		RETURN_FALSE;
+	}
+
+	switch (flags & O_ACCMODE) {
+		case O_WRONLY:
+			stream_mode = (flags & O_APPEND) ? "ab" : "wb";
+			break;
+		case O_RDWR:
+			stream_mode = (flags & O_APPEND) ? "a+b" : "r+b";
+			break;
+		default:
+			stream_mode = "rb";
+			break;
+	}
+
+	stream = php_stream_fopen_from_fd(result, stream_mode, NULL);
+
+	if (stream == NULL) {
+		close(result);
+		RETURN_FALSE;
+	}
+
+	php_stream_to_zval(stream, return_value);
+}
+/* }}} */
+
+
+/* {{{ proto bool Fiber\Uring::fsync(resource|int $fd, bool $datasync = false) */
+ZEND_METHOD(FiberUring, fsync)
+{
+#ifdef HAVE_FIBER_URING
+	struct io_uring_sqe *sqe;
+#endif
+	zval *arg;
+	zend_bool datasync;
+	int result;
+	int fd;
+
+	datasync = 0;
+
+	ZEND_PARSE_PARAMETERS_START(1, 2)
+		Z_PARAM_ZVAL(arg)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_BOOL(datasync)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (!zend_fiber_uring_arg_fd(arg, "fsync", 0, &fd)) {
+		return;
+	}
+
+#ifdef HAVE_FIBER_URING
+	if ((sqe = zend_fiber_uring_sqe(IORING_OP_FSYNC)) != NULL) {
+		io_uring_prep_fsync(sqe, fd, datasync ? IORING_FSYNC_DATASYNC : 0);
+		result = zend_fiber_uring_submit(sqe);
+	} else
+#endif
+	{
+		result = datasync ? fdatasync(fd) : fsync(fd);
+		result = (result < 0) ? -errno : result;
+	}
+
+	RETURN_BOOL(zend_fiber_uring_result("fsync", result));
+}
+/* }}} */
+
+
+/* {{{ proto resource|false Fiber\Uring::accept(resource|int $socket) */
+ZEND_METHOD(FiberUring, accept)
+{
+#ifdef HAVE_FIBER_URING
+	struct io_uring_sqe *sqe;
+#endif
+	php_stream *stream;
+	zval *arg;
+	int result;
+	int nonblock;
+	int fd;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_ZVAL(arg)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (!zend_fiber_uring_arg_fd(arg, "accept", 1, &fd)) {
+		return;
+	}
+
+#ifdef HAVE_FIBER_URING
+	if ((sqe = zend_fiber_uring_sqe(IORING_OP_ACCEPT)) != NULL) {
+		io_uring_prep_accept(sqe, fd, NULL, NULL, SOCK_CLOEXEC);
+		result = zend_fiber_uring_submit(sqe);
+	} else
+#endif
+	{
+		do {
+			nonblock = zend_fiber_uring_nonblock(fd);
+			result = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+			zend_fiber_uring_restore(fd, nonblock);
+		} while (result < 0 && zend_fiber_uring_would_block(fd, EPOLLIN));
+
+		result = (result < 0) ? -errno : result;
+	}
+
+	if (!zend_fiber_uring_result("accept", result)) {
+		RETURN_FALSE;
+	}
+
+	stream = php_stream_sock_open_from_socket(result, NULL);
+
+	if (stream == NULL) {
+		close(result);
+		RETURN_FALSE;
+	}
+
+	php_stream_to_zval(stream, return_value);
+}
+/* }}} */
+
+
+/* {{{ proto string|false Fiber\Uring::recv(resource|int $socket, int $length, int $flags = 0) */
+ZEND_METHOD(FiberUring, recv)
+{
+#ifdef HAVE_FIBER_URING
+	struct io_uring_sqe *sqe;
+#endif
+	zval *arg;
+	zend_string *buffer;
+	zend_long length;
+	zend_long flags;
+	ssize_t result;
+	int fd;
+
+	flags = 0;
+
+	ZEND_PARSE_PARAMETERS_START(2, 3)
+		Z_PARAM_ZVAL(arg)
+		Z_PARAM_LONG(length)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(flags)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (length <= 0 || length > INT_MAX) {
+		zend_throw_error(NULL, "Fiber\\Uring::recv(): Argument #2 ($length) must be between 1 and %d", INT_MAX);
+		return;
+	}
+
+	if (!zend_fiber_uring_arg_fd(arg, "recv", 1, &fd)) {
+		return;
+	}
+
+	buffer = zend_string_alloc(length, 0);
+
+#ifdef HAVE_FIBER_URING
+	if ((sqe = zend_fiber_uring_sqe(IORING_OP_RECV)) != NULL) {
+		io_uring_prep_recv(sqe, fd, ZSTR_VAL(buffer), (size_t) length, (int) flags);
+		result = zend_fiber_uring_submit(sqe);
+	} else
+#endif
+	{
+		do {
+			result = recv(fd, ZSTR_VAL(buffer), length, (int) flags | MSG_DONTWAIT);
+		} while (result < 0 && zend_fiber_uring_would_block(fd, EPOLLIN));
+
+		result = (result < 0) ? -errno : result;
+	}
+
+	if (!zend_fiber_uring_result("recv", result)) {
+		zend_string_efree(buffer);
+		RETURN_FALSE;
+	}
+
+	if ((zend_long) result < length / 2) {
+		buffer = zend_string_truncate(buffer, result, 0);
+	}
+
+	ZSTR_LEN(buffer) = result;
+	ZSTR_VAL(buffer)[result] = '\0';
+
+	RETURN_NEW_STR(buffer);
+}
+/* }}} */
+
+
+/* {{{ proto int|false Fiber\Uring::send(resource|int $socket, string $data, int $flags = 0) */
+ZEND_METHOD(FiberUring, send)
+{
+#ifdef HAVE_FIBER_URING
+	struct io_uring_sqe *sqe;
+#endif
+	zval *arg;
+	zend_string *data;
+	zend_long flags;
+	ssize_t result;
+	int fd;
+
+	flags = 0;
+
+	ZEND_PARSE_PARAMETERS_START(2, 3)
+		Z_PARAM_ZVAL(arg)
+		Z_PARAM_STR(data)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(flags)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (!zend_fiber_uring_arg_fd(arg, "send", 0, &fd)) {
+		return;
+	}
+
+	zend_string_addref(data);
+
+	/* A closed peer must not kill the process. */
+	flags |= MSG_NOSIGNAL;
+
+#ifdef HAVE_FIBER_URING
+	if ((sqe = zend_fiber_uring_sqe(IORING_OP_SEND)) != NULL) {
+		io_uring_prep_send(sqe, fd, ZSTR_VAL(data), ZSTR_LEN(data), (int) flags);
+		result = zend_fiber_uring_submit(sqe);
+	} else
+#endif
+	{
+		do {
+			result = send(fd, ZSTR_VAL(data), ZSTR_LEN(data), (int) flags | MSG_DONTWAIT);
+		} while (result < 0 && zend_fiber_uring_would_block(fd, EPOLLOUT));
+
+		result = (result < 0) ? -errno : result;
+	}
+
+	zend_string_release(data);
+
+	if (!zend_fiber_uring_result("send", result)) {
+		RETURN_FALSE;
+	}
+
+	RETURN_LONG(result);
+}
+/* }}} */
+
+
+/* {{{ proto bool Fiber\Uring::isAvailable() */
+ZEND_METHOD(FiberUring, isAvailable)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	RETURN_BOOL(zend_fiber_uring_available());
+}
+/* }}} */
+
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_uring_read, 0, 0, 2)
+	ZEND_ARG_INFO(0, fd)
+	ZEND_ARG_TYPE_INFO(0, length, IS_LONG, 0)
+	ZEND_ARG_TYPE_INFO(0, offset, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_uring_write, 0, 0, 2)
+	ZEND_ARG_INFO(0, fd)
+	ZEND_ARG_TYPE_INFO(0, data, IS_STRING, 0)
+	ZEND_ARG_TYPE_INFO(0, offset, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_uring_readv, 0, 0, 2)
+	ZEND_ARG_INFO(0, fd)
+	ZEND_ARG_TYPE_INFO(0, lengths, IS_ARRAY, 0)
+	ZEND_ARG_TYPE_INFO(0, offset, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_uring_openat, 0, 0, 1)
+	ZEND_ARG_TYPE_INFO(0, path, IS_STRING, 0)
+	ZEND_ARG_TYPE_INFO(0, flags, IS_LONG, 0)
+	ZEND_ARG_TYPE_INFO(0, mode, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_uring_fsync, 0, 1, _IS_BOOL, 0)
+	ZEND_ARG_INFO(0, fd)
+	ZEND_ARG_TYPE_INFO(0, datasync, _IS_BOOL, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_uring_accept, 0, 0, 1)
+	ZEND_ARG_INFO(0, socket)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_uring_recv, 0, 0, 2)
+	ZEND_ARG_INFO(0, socket)
+	ZEND_ARG_TYPE_INFO(0, length, IS_LONG, 0)
+	ZEND_ARG_TYPE_INFO(0, flags, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_fiber_uring_send, 0, 0, 2)
+	ZEND_ARG_INFO(0, socket)
+	ZEND_ARG_TYPE_INFO(0, data, IS_STRING, 0)
+	ZEND_ARG_TYPE_INFO(0, flags, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_fiber_uring_is_available, 0, 0, _IS_BOOL, 0)
+ZEND_END_ARG_INFO()
+
+static const zend_function_entry fiber_uring_methods[] = {
+	ZEND_ME(FiberUring, read, arginfo_fiber_uring_read, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberUring, write, arginfo_fiber_uring_write, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberUring, readv, arginfo_fiber_uring_readv, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberUring, openat, arginfo_fiber_uring_openat, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberUring, fsync, arginfo_fiber_uring_fsync, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberUring, accept, arginfo_fiber_uring_accept, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberUring, recv, arginfo_fiber_uring_recv, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberUring, send, arginfo_fiber_uring_send, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_ME(FiberUring, isAvailable, arginfo_fiber_uring_is_available, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	ZEND_FE_END
+};
+
+
+void zend_fiber_uring_ce_register()
+{
+	zend_class_entry ce;
+
+	INIT_NS_CLASS_ENTRY(ce, "Fiber", "Uring", fiber_uring_methods);
+	zend_ce_fiber_uring = zend_register_internal_class(&ce);
+	zend_ce_fiber_uring->ce_flags |= ZEND_ACC_FINAL;
+
+	zend_declare_class_constant_long(zend_ce_fiber_uring, ZEND_STRL("O_RDONLY"), O_RDONLY);
+	zend_declare_class_constant_long(zend_ce_fiber_uring, ZEND_STRL("O_WRONLY"), O_WRONLY);
+	zend_declare_class_constant_long(zend_ce_fiber_uring, ZEND_STRL("O_RDWR"), O_RDWR);
+	zend_declare_class_constant_long(zend_ce_fiber_uring, ZEND_STRL("O_CREAT"), O_CREAT);
+	zend_declare_class_constant_long(zend_ce_fiber_uring, ZEND_STRL("O_EXCL"), O_EXCL);
+	zend_declare_class_constant_long(zend_ce_fiber_uring, ZEND_STRL("O_TRUNC"), O_TRUNC);
+	zend_declare_class_constant_long(zend_ce_fiber_uring, ZEND_STRL("O_APPEND"), O_APPEND);
+}
+
+#else
+
+void zend_fiber_uring_ce_register()
+{
+}
+
+void zend_fiber_uring_shutdown()
+{
+}
+
+void zend_fiber_uring_fork()
+{
+}
+
+void zend_fiber_uring_flush()
+{
+}
+
+zend_bool zend_fiber_uring_available()
+{
+	return 0;
+}
+
+#endif
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
@@ -0,0 +1,138 @@
+/*
+  +--------------------------------------------------------------------+
+  | ext-fiber                                                          |
+  +--------------------------------------------------------------------+
+  | Redistribution and use in source and binary forms, with or without |
+  | modification, are permitted provided that the conditions mentioned |
+  | in the accompanying LICENSE file are met.                          |
+  +--------------------------------------------------------------------+
+  | Authors: Martin Schröder <m.schroeder2007@gmail.com>               |
+  |          Aaron Piotrowski <aaron@trowski.com>                      |
+  +--------------------------------------------------------------------+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "php.h"
+#include "zend.h"
+#include "zend_API.h"
+#include "zend_builtin_functions.h"
+#include "zend_exceptions.h"
+
+#include "php_fiber.h"
+#include "fiber.h"
+#include "fiber_watchdog.h"
+
+
+void zend_fiber_watchdog_switch(zend_fiber *prev, zend_fiber *next)
+{
+	uint64_t now;
+
+	now = zend_fiber_clock();
+
+	/* Time spent in a fiber resumed by prev is not charged to the slice of prev. */
+	if (prev != NULL && prev->slice_start != 0) {
+		prev->slice_time += now - prev->slice_start;
+	}
+
+	next->slice_start = now;
+}
+
+
+void zend_fiber_watchdog_return(zend_fiber *prev)
+{
+	if (prev != NULL) {
+		prev->slice_start = zend_fiber_clock();
+	}
+}
+
+
+static void zend_fiber_watchdog_report(zend_fiber *fiber, uint64_t elapsed, zend_bool finished)
+{
+	zend_string *name;
+	zval handler;
+	zval trace;
+	zval retval;
+	zval args[3];
+
+	name = zend_get_callable_name(&fiber->fci.function_name);
+
+	/* The frames of a finished fiber are gone already, there is no point in reporting the runner frame. */
+	if (finished) {
+		array_init(&trace);
+	} else {
+		zend_fetch_debug_backtrace(&trace, 0, DEBUG_BACKTRACE_IGNORE_ARGS, 0);
+	}
+
+	if (Z_ISUNDEF(FIBER_G(slow_slice_handler))) {
+#if PHP_VERSION_ID >= 80000
+		zend_string *str;
+
+		str = zend_trace_to_string(Z_ARRVAL(trace), 0);
+
+		zend_error(E_WARNING, "Fiber %s ran for %.3F ms without suspending%s%s",
+			ZSTR_VAL(name), (double) elapsed / 1000000.0, ZSTR_LEN(str) ? "\nStack trace:\n" : "", ZSTR_VAL(str));
+
+		zend_string_release(str);
+#else
+		zend_error(E_WARNING, "Fiber %s ran for %.3F ms without suspending", ZSTR_VAL(name), (double) elapsed / 1000000.0);
+#endif
+	} else {
+		/* The handler may replace itself. */
+		ZVAL_COPY(&handler, &FIBER_G(slow_slice_handler));
+
+		ZVAL_OBJ(&args[0], &fiber->std);
+		ZVAL_DOUBLE(&args[1], (double) elapsed / 1000000.0);
+		ZVAL_COPY_VALUE(&args[2], &trace);
+
+		if (call_user_function(NULL, NULL, &handler, &retval, 3, args) == SUCCESS) {
+			zval_ptr_dtor(&retval);
+		}
+
+		zval_ptr_dtor(&handler);
+	}
+
+	zval_ptr_dtor(&trace);
+	zend_string_release(name);
+}
+
+
+void zend_fiber_watchdog_check(zend_fiber *fiber, zend_bool finished)
+{
+	uint64_t elapsed;
+
+	/* Fiber has been switched to while the watchdog was disabled. */
+	if (fiber->slice_start == 0) {
+		return;
+	}
+
+	elapsed = fiber->slice_time + (zend_fiber_clock() - fiber->slice_start);
+
+	fiber->slice_time = 0;
+	fiber->slice_start = 0;
+
+	if (elapsed < (uint64_t) FIBER_G(slow_slice) * 1000000 || FIBER_G(watchdog_active) || EG(exception)) {
+		return;
+	}
+
+	/* Suspending from within the handler must not report again. */
+	FIBER_G(watchdog_active) = 1;
+
+	zend_fiber_watchdog_report(fiber, elapsed, finished);
+
+	FIBER_G(watchdog_active) = 0;
+}
+
+
+void zend_fiber_watchdog_shutdown()
+{
+	zval_ptr_dtor(&FIBER_G(slow_slice_handler));
+	ZVAL_UNDEF(&FIBER_G(slow_slice_handler));
+}
+
+/*
+ * vim: sw=4 ts=4
+ * vim600: fdm=marker
+ */
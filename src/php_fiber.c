@@ -20,7 +20,25 @@
 
 #include "php_fiber.h"
 #include "fiber.h"
+#include "fiber_group.h"
+#include "fiber_interrupt.h"
+#include "fiber_ipc.h"
+#include "fiber_local.h"
+#include "fiber_perf.h"
+#include "fiber_profiler.h"
+#include "fiber_poll.h"
+#include "fiber_process.h"
+#include "fiber_server.h"
 #include "fiber_stack.h"
+#include "fiber_stats.h"
+#include "fiber_stream.h"
+#include "fiber_thread_pool.h"
+#include "fiber_uring.h"
+#include "fiber_watchdog.h"
+
+#ifdef ZEND_FIBER_POLL
+#include <pthread.h>
+#endif
 
 ZEND_DECLARE_MODULE_GLOBALS(fiber)
 
@@ -49,8 +67,51 @@ static PHP_INI_MH(OnUpdateFiberStackSize)
 	return SUCCESS;
 }
 
+static PHP_INI_MH(OnUpdateFiberMaxStackMemory)
+{
+	zend_long tmp;
+
+#if PHP_VERSION_ID >= 80200
+	tmp = zend_ini_parse_quantity_warn(new_value, entry->name);
+#else
+	tmp = zend_atol(ZSTR_VAL(new_value), ZSTR_LEN(new_value));
+#endif
+
+	if (tmp < 0) {
+		return FAILURE;
+	}
+
+	FIBER_G(max_stack_memory) = tmp;
+
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateFiberShutdownPolicy)
+{
+	if (zend_string_equals_literal_ci(new_value, "unwind")) {
+		FIBER_G(shutdown_policy) = ZEND_FIBER_SHUTDOWN_UNWIND;
+	} else if (zend_string_equals_literal_ci(new_value, "release")) {
+		FIBER_G(shutdown_policy) = ZEND_FIBER_SHUTDOWN_RELEASE;
+	} else {
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
 PHP_INI_BEGIN()
 	STD_PHP_INI_ENTRY("fiber.stack_size", "0", PHP_INI_ALL, OnUpdateFiberStackSize, stack_size, zend_fiber_globals, fiber_globals)
+	STD_PHP_INI_ENTRY("fiber.thread_pool_size", "4", PHP_INI_SYSTEM, OnUpdateLongGEZero, thread_pool_size, zend_fiber_globals, fiber_globals)
+	STD_PHP_INI_BOOLEAN("fiber.async_streams", "0", PHP_INI_ALL, OnUpdateBool, async_streams, zend_fiber_globals, fiber_globals)
+	STD_PHP_INI_ENTRY("fiber.offload_threshold", "65536", PHP_INI_ALL, OnUpdateLongGEZero, offload_threshold, zend_fiber_globals, fiber_globals)
+	STD_PHP_INI_ENTRY("fiber.time_slice_ms", "0", PHP_INI_ALL, OnUpdateLongGEZero, time_slice, zend_fiber_globals, fiber_globals)
+	STD_PHP_INI_ENTRY("fiber.slow_slice_ms", "0", PHP_INI_ALL, OnUpdateLongGEZero, slow_slice, zend_fiber_globals, fiber_globals)
+	STD_PHP_INI_BOOLEAN("fiber.perf_counters", "0", PHP_INI_SYSTEM, OnUpdateBool, perf_counters, zend_fiber_globals, fiber_globals)
+	STD_PHP_INI_ENTRY("fiber.stack_pool", "16", PHP_INI_ALL, OnUpdateLongGEZero, stack_pool_size, zend_fiber_globals, fiber_globals)
+	PHP_INI_ENTRY("fiber.max_stack_memory", "0", PHP_INI_ALL, OnUpdateFiberMaxStackMemory)
+	PHP_INI_ENTRY("fiber.shutdown_policy", "unwind", PHP_INI_ALL, OnUpdateFiberShutdownPolicy)
+	STD_PHP_INI_BOOLEAN("fiber.shutdown_report", "0", PHP_INI_ALL, OnUpdateBool, shutdown_report, zend_fiber_globals, fiber_globals)
+	STD_PHP_INI_BOOLEAN("fiber.leak_report", "0", PHP_INI_ALL, OnUpdateBool, leak_report, zend_fiber_globals, fiber_globals)
 PHP_INI_END()
 
 
@@ -61,20 +122,70 @@ static PHP_GINIT_FUNCTION(fiber)
 #endif
 
 	ZEND_SECURE_ZERO(fiber_globals, sizeof(zend_fiber_globals));
+
+	fiber_globals->poll_fd = -1;
 }
 
+static PHP_GSHUTDOWN_FUNCTION(fiber)
+{
+	zend_fiber_ticker_stop();
+	zend_fiber_local_gshutdown();
+	zend_fiber_perf_shutdown();
+	zend_fiber_thread_pool_shutdown();
+	zend_fiber_uring_shutdown();
+	zend_fiber_signal_shutdown();
+	zend_fiber_poll_shutdown();
+	zend_fiber_stack_pool_shutdown();
+}
+
+#ifdef ZEND_FIBER_POLL
+/* Runs in the child after fork(), threads are gone and descriptors are shared with the parent. Everything is
+ * created again on first use, the poller has to go first as the others are registered with it. */
+static void zend_fiber_atfork_child()
+{
+	zend_fiber_poll_fork();
+	zend_fiber_signal_shutdown();
+	zend_fiber_thread_pool_fork();
+	zend_fiber_uring_fork();
+	zend_fiber_ticker_fork();
+	zend_fiber_profiler_fork();
+	zend_fiber_perf_fork();
+}
+#endif
+
 PHP_MINIT_FUNCTION(fiber)
 {
+	zend_fiber_stats_startup();
+
 	zend_fiber_ce_register();
+	zend_fiber_group_ce_register();
+	zend_fiber_poll_ce_register();
+	zend_fiber_blocking_ce_register();
+	zend_fiber_offload_ce_register();
+	zend_fiber_uring_ce_register();
+	zend_fiber_process_ce_register();
+	zend_fiber_profiler_ce_register();
+	zend_fiber_local_ce_register();
+	zend_fiber_ipc_ce_register();
+	zend_fiber_server_ce_register();
 
 	REGISTER_INI_ENTRIES();
 
+	zend_fiber_stream_startup();
+	zend_fiber_interrupt_startup();
+
+#ifdef ZEND_FIBER_POLL
+	pthread_atfork(NULL, NULL, zend_fiber_atfork_child);
+#endif
+
 	return SUCCESS;
 }
 
 
 PHP_MSHUTDOWN_FUNCTION(fiber)
 {
+	zend_fiber_interrupt_shutdown();
+	zend_fiber_stream_shutdown();
 	zend_fiber_ce_unregister();
 
 	UNREGISTER_INI_ENTRIES();
@@ -87,6 +198,17 @@ static PHP_MINFO_FUNCTION(fiber)
 {
 	php_info_print_table_start();
 	php_info_print_table_row(2, "Fiber backend", zend_fiber_backend_info());
+#ifdef HAVE_FIBER_URING
+	php_info_print_table_row(2, "io_uring support", "enabled");
+#else
+	php_info_print_table_row(2, "io_uring support", "disabled");
+#endif
+#ifdef HAVE_FIBER_DTRACE
+	php_info_print_table_row(2, "Static probes", "enabled");
+#else
+	php_info_print_table_row(2, "Static probes", "disabled");
+#endif
+	zend_fiber_stats_info();
 	php_info_print_table_end();
 
 	DISPLAY_INI_ENTRIES();
@@ -99,18 +221,47 @@ static PHP_RINIT_FUNCTION(fiber)
 	ZEND_TSRMLS_CACHE_UPDATE();
 #endif
 
+	zend_fiber_stream_activate();
+
 	return SUCCESS;
 }
 
 static PHP_RSHUTDOWN_FUNCTION(fiber)
 {
+	/* Fibers left parked by a fatal error or exit() have not been unwound, their waiters live on stacks that are
+	 * about to be freed. Nothing registered with the poller may survive into the next request. */
+	zend_fiber_poll_abandon_all();
+	zend_fiber_thread_pool_reset();
+	zend_fiber_uring_shutdown();
+	zend_fiber_signal_shutdown();
+	zend_fiber_poll_shutdown();
+
+	zend_fiber_profiler_shutdown();
+	zend_fiber_watchdog_shutdown();
 	zend_fiber_shutdown();
 
+	zend_fiber_locals_destroy(&FIBER_G(locals));
+
+	FIBER_G(shutdown_done) = 0;
+
 	return SUCCESS;
 }
 
+/* Fiber\Offload uses ext/hash, which is always built in since PHP 7.4. */
+static const zend_module_dep fiber_deps[] = {
+#if PHP_VERSION_ID < 70400
+	ZEND_MOD_REQUIRED("hash")
+#else
+	ZEND_MOD_OPTIONAL("hash")
+#endif
+	ZEND_MOD_OPTIONAL("openssl")
+	ZEND_MOD_END
+};
+
 zend_module_entry fiber_module_entry = {
-	STANDARD_MODULE_HEADER,
+	STANDARD_MODULE_HEADER_EX,
+	NULL,
+	fiber_deps,
 	"fiber",
 	NULL,
 	PHP_MINIT(fiber),
@@ -121,7 +272,7 @@ zend_module_entry fiber_module_entry = {
 	PHP_FIBER_VERSION,
 	PHP_MODULE_GLOBALS(fiber),
 	PHP_GINIT(fiber),
-	NULL,
+	PHP_GSHUTDOWN(fiber),
 	NULL,
 	STANDARD_MODULE_PROPERTIES_EX
 };
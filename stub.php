@@ -1,6 +1,12 @@
 <?php
 
-final class Fiber
+namespace
+{
+/**
+ * Iterating a fiber with foreach starts it (if not started yet) and resumes it with NULL for every step, the values
+ * given to Fiber::suspend() are the values of the loop, keys count from 0. Preemptions are not steps of the loop.
+ */
+final class Fiber implements Traversable
 {
     public const STATUS_INIT = 0;
     public const STATUS_SUSPENDED = 1;
@@ -32,9 +38,11 @@ final class Fiber
     /**
      * @param mixed $value Value to return from {@see Fiber::suspend()}.
      *
-     * @return mixed Value given to next {@see Fiber::suspend()} call or NULL if the fiber returns (finishes).
+     * @return mixed Value given to next {@see Fiber::suspend()} call or NULL if the fiber returns (finishes) or is
+     *     preempted, {@see Fiber::isPreempted()} tells the latter apart.
      *
      * @throws Throwable If the fiber throws, the exception will be thrown from this call.
+     * @throws FiberError If a value other than NULL is given to a preempted fiber.
      */
     public function resume(mixed $value = null): mixed { }
 
@@ -54,6 +62,76 @@ final class Fiber
      */
     public function getReturn(): mixed { }
 
+    /**
+     * Socket stream operations (stream_socket_client(), fsockopen(), stream_socket_accept(), fread(), fwrite(),
+     * fgets(), ...) run by this fiber park it on the native poller instead of blocking, including those on streams
+     * opened before the fiber started. Connects of plain TCP and Unix sockets are non-blocking too, DNS resolution
+     * and TLS handshakes still block. Stream timeouts apply to the parked fiber as they would to a blocking call
+     * (stream_get_meta_data() reports timed_out). Streams the user switched to non-blocking mode are left untouched,
+     * and nothing changes outside of fibers. Socket streams dispatch through replaced stream ops, extensions comparing
+     * the ops of a stream do not recognize them. Transports registered by extensions started after this one are
+     * hooked on the next request, not at all in ZTS builds.
+     *
+     * @param bool|null $enabled True or false to override the fiber.async_streams setting, null to use it.
+     */
+    public function setAsyncStreams(?bool $enabled): void { }
+
+    /**
+     * With fiber.time_slice_ms set, a fiber that runs for a whole quantum without suspending is suspended at the
+     * next safe point of the VM (loop back-edge or function entry) and control returns to its resumer, which can
+     * resume it like any other suspended fiber, but without a value as it is not waiting in {@see Fiber::suspend()}.
+     *
+     * @param bool $preemptible False to never preempt this fiber (e.g. while holding a lock shared with others).
+     */
+    public function setPreemptible(bool $preemptible): void { }
+
+    /**
+     * @return bool True if the fiber is suspended because its time slice was used up.
+     */
+    public function isPreempted(): bool { }
+
+    /**
+     * Runtime counters of the fiber, updated on every switch. Times include the current running or suspended
+     * period, time spent in fibers resumed by this fiber is not counted as run time.
+     *
+     * memory_bytes is the net change of memory usage (memory_get_usage()) while the fiber was running, memory
+     * released by other fibers or the main thread is not credited. vm_stack_bytes is the size of the VM stack pages.
+     *
+     * @return array{resumes: int, run_time_ns: int, suspended_time_ns: int, time_to_first_run_ns: int|null,
+     *     stack_size: int, vm_stack_bytes: int, memory_bytes: int, memory_budget: int|null}
+     */
+    public function getStats(): array { }
+
+    /**
+     * Sets a soft memory budget, a warning is raised once after a switch back from the fiber if its memory_bytes
+     * (see {@see Fiber::getStats()}) exceeds the budget. The fiber keeps running.
+     *
+     * @param int $bytes Budget in bytes, 0 to remove the budget.
+     *
+     * @throws FiberError If the budget is negative.
+     */
+    public function setMemoryBudget(int $bytes): void { }
+
+    /**
+     * Hardware performance counters (user space only) charged to the fiber while it was running, requires
+     * fiber.perf_counters=1. Counters the CPU does not provide are omitted.
+     *
+     * @return array{cycles?: int, instructions?: int, cache_misses?: int, branch_misses?: int}|null Null if the mode
+     *         is disabled or the kernel denied access (see /proc/sys/kernel/perf_event_paranoid).
+     */
+    public function getPerfCounters(): ?array { }
+
+    /**
+     * Backtrace of the fiber in the format of debug_backtrace(), taken without resuming it. For a suspended fiber
+     * the first frame is the call that suspended it (e.g. Fiber::suspend()), frames end at the fiber callable.
+     *
+     * @param int $options DEBUG_BACKTRACE_* flags as accepted by debug_backtrace().
+     * @param int $limit Maximum number of frames, 0 for all.
+     *
+     * @return array Empty if the fiber has not been started or has finished.
+     */
+    public function getTrace(int $options = DEBUG_BACKTRACE_PROVIDE_OBJECT, int $limit = 0): array { }
+
     /**
      * @param mixed $value Suspension value, which is then returned from {@see Fiber::resume()} or
      *                     {@see Fiber::throw()}.
@@ -71,9 +149,456 @@ final class Fiber
 	 * @return Fiber|null
 	 */
 	public static function getCurrent(): ?Fiber { }
+
+    /**
+     * Sets the callable invoked when a fiber ran longer than fiber.slow_slice_ms without suspending. It is invoked
+     * within the fiber right before it suspends (or once it returns) and must not suspend itself. Without a handler
+     * an E_WARNING naming the fiber callable, the duration and the stack trace is raised instead.
+     *
+     * @param callable|null $handler Receives the fiber, the slice duration in milliseconds and the backtrace
+     *                               (without args) of the point where the fiber suspended, null to restore warnings.
+     */
+    public static function setSlowSliceHandler(?callable $handler): void { }
+
+    /**
+     * @return Fiber[] All started, unfinished fibers of the current thread, most recently started first.
+     */
+    public static function getAll(): array { }
+
+    /**
+     * Summary of all started, unfinished fibers. Fibers with identical state (suspended, parked, preempted or
+     * running) and identical stack are merged into one entry, entries are ordered by number of fibers.
+     *
+     * @return string Text report, e.g. "120 fibers parked\n  #0 fread\n  #1 Conn::read /app/Conn.php:42\n..."
+     */
+    public static function dumpAll(): string { }
+
+    /**
+     * Lists suspended fibers grouped by the file and line they have been created at, their state and their stack,
+     * largest groups first, with the longest time a fiber of the group has been suspended and the native stack memory
+     * mapped for the group (guard pages included). Only the 20 largest groups are listed. With fiber.leak_report=1
+     * the same report is written to the error log at request end for fibers that are still suspended.
+     *
+     * @return string|null Text report, e.g. "312 fibers created at /app/Pool.php:31 suspended for up to 812.004 s,
+     *     328433664 mapped stack bytes\n  #0 Pool::wait /app/Pool.php:58\n...", NULL if no fiber is suspended.
+     */
+    public static function getLeakReport(): ?string { }
+
+    /**
+     * Resumes every fiber with the same value, in iteration order.
+     *
+     * @param iterable<Fiber> $fibers
+     * @param mixed $value Value returned from Fiber::suspend() in each fiber.
+     * @param array|null $errors Receives the exceptions thrown by (or FiberErrors for) fibers, by key of the fiber.
+     *
+     * @return array Values given to the next Fiber::suspend() call of each fiber (NULL if it finished), by key of
+     *     the fiber. Fibers that failed or were preempted are not part of the result. Preempted fibers are resumed
+     *     without $value.
+     *
+     * @throws Throwable The first error once all fibers have been resumed, if $errors is not given.
+     * @throws TypeError If an element is not a fiber, the remaining fibers are not resumed.
+     */
+    public static function resumeAll(iterable $fibers, $value = null, ?array &$errors = null): array { }
+
+    /**
+     * Same as {@see Fiber::resumeAll()}, each fiber is resumed with the element of $values with its key (NULL if
+     * there is none). A preempted fiber with an element other than NULL fails with a FiberError.
+     *
+     * @param iterable<Fiber> $fibers
+     * @param array $values
+     * @param array|null $errors
+     *
+     * @return array
+     */
+    public static function resumeEach(iterable $fibers, array $values, ?array &$errors = null): array { }
 }
 
+namespace Fiber
+{
+    /**
+     * Owns a set of child fibers that can be joined or cancelled together.
+     */
+    final class Group
+    {
+        /**
+         * Creates a child fiber owned by the group and starts it with the given arguments.
+         *
+         * @param callable $callback Function to invoke when starting the Fiber.
+         * @param mixed ...$args
+         *
+         * @return \Fiber The started child fiber.
+         *
+         * @throws \Throwable If the child throws before suspending for the first time.
+         */
+        public function spawn(callable $callback, mixed ...$args): \Fiber { }
+
+        /**
+         * Waits until all children have finished. Outside of a fiber suspended children are resumed until they
+         * finish, within a fiber the calling fiber is parked and resumed by the native poller once the last child
+         * has finished.
+         *
+         * If a child resumed by joinAll() fails, the remaining children are cancelled and the first error is thrown.
+         * Errors of children resumed elsewhere are thrown to whoever resumed them.
+         *
+         * @throws \Throwable First error thrown by a child.
+         * @throws \FiberError If called from within one of the children of the group.
+         */
+        public function joinAll(): void { }
+
+        /**
+         * Destroys all suspended children in one pass, running their finally blocks.
+         */
+        public function cancel(): void { }
+    }
+
+    /**
+     * Native poller (epoll) that resumes fibers parked on native events.
+     */
+    final class Poller
+    {
+        /**
+         * Waits for native events and resumes the fibers that have been waiting for them.
+         *
+         * @param int $timeout Timeout in milliseconds, -1 to wait until at least one event is available.
+         *
+         * @return int Number of events that have been dispatched.
+         *
+         * @throws \Throwable If a resumed fiber throws.
+         */
+        public static function poll(int $timeout = -1): int { }
+
+        /**
+         * Dispatches events until no fiber is waiting for a native event anymore.
+         *
+         * @throws \Throwable If a resumed fiber throws.
+         */
+        public static function run(): void { }
+
+        /**
+         * @return int Number of parked fibers and pending thread pool jobs.
+         */
+        public static function count(): int { }
+    }
+
+    /**
+     * Runs blocking native operations on a pool of worker threads (fiber.thread_pool_size) while the calling
+     * fiber is suspended. Called from outside a fiber the native poller is run until the operation completes.
+     */
+    final class Blocking
+    {
+        /**
+         * Supported operations:
+         *  - getaddrinfo(string $host, ?string $service = null): list<string>
+         *  - read(string $path, int $offset = 0, int $length = -1): string
+         *  - write(string $path, string $data, int $flags = 0): int (FILE_APPEND is supported)
+         *  - stat(string $path): array
+         *  - fsync(string|resource $file): bool
+         *  - flock(resource $stream, int $operation): bool
+         *
+         * @param string $operation Name of the operation.
+         * @param mixed ...$args Arguments of the operation.
+         *
+         * @return mixed Result of the operation or false on failure (a warning is emitted).
+         *
+         * @throws \FiberError If the operation is not supported.
+         */
+        public static function run(string $operation, mixed ...$args): mixed { }
+    }
+
+    /**
+     * Runs CPU-heavy builtins on the worker threads of {@see Blocking} so that other fibers keep running. The input
+     * is copied to the worker and the result is built once the calling fiber has been resumed. Inputs smaller than
+     * fiber.offload_threshold bytes are processed inline.
+     */
+    final class Offload
+    {
+        /**
+         * Same as hash().
+         */
+        public static function hash(string $algo, string $data, bool $binary = false): string { }
+
+        /**
+         * Same as zlib_encode(), the encoding defaults to ZLIB_ENCODING_DEFLATE (gzcompress() format).
+         *
+         * @return string|false
+         */
+        public static function compress(string $data, int $level = -1, int $encoding = ZLIB_ENCODING_DEFLATE) { }
+
+        /**
+         * Same as zlib_decode(), zlib and gzip data are detected automatically when $encoding is 0.
+         *
+         * @return string|false
+         */
+        public static function decompress(string $data, int $max_length = 0, int $encoding = 0) { }
+    }
+
+    /**
+     * Waits for processes started by proc_open() without polling.
+     */
+    final class Process
+    {
+        /**
+         * Suspends the calling fiber until the process has exited (pidfd_open(), or SIGCHLD routed through the
+         * signalfd of Fiber\Signal on kernels without pidfd support). The process is not reaped, proc_get_status()
+         * and proc_close() keep working afterwards.
+         *
+         * @param resource $process Resource returned by proc_open().
+         *
+         * @return int|false Exit code of the process, or the negated number of the signal that terminated it.
+         */
+        public static function wait($process) { }
+    }
+
+    /**
+     * Waits for signals through a signalfd registered with the native poller.
+     */
+    final class Signal
+    {
+        /**
+         * Suspends the calling fiber until the signal has been received. The signal is blocked and routed to the
+         * signalfd while at least one fiber waits for it, all waiting fibers are resumed for each delivery.
+         * Handlers installed with pcntl_signal() are not invoked during that time.
+         *
+         * @return array{signo: int, errno: int, code: int, pid: int, uid: int}
+         */
+        public static function await(int $signo): array { }
+    }
+
+    /**
+     * Variable holding a separate value in every fiber, the main thread has its own value as well. Values are
+     * released once the fiber has finished and in all fibers when the local is destroyed.
+     */
+    final class Local
+    {
+        /**
+         * @return mixed Value set in the running fiber (or main thread), null if none has been set.
+         */
+        public function get() { }
+
+        /**
+         * @param mixed $value Value for the running fiber (or main thread).
+         */
+        public function set($value): void { }
+
+        /**
+         * @return bool True if a value has been set in the running fiber (or main thread).
+         */
+        public function has(): bool { }
+
+        /**
+         * Removes the value of the running fiber (or main thread).
+         */
+        public function delete(): void { }
+    }
+
+    /**
+     * Sampling profiler attributing samples to the fiber on CPU. A helper thread requests a sample whenever the PHP
+     * thread consumed another interval of CPU time, the stack is then taken at the next safe point of the VM.
+     * Stacks of fibers end at the fiber callable, the resumer is not part of them.
+     */
+    final class Profiler
+    {
+        /** No root frame, stacks of all fibers are merged. */
+        public const GROUP_NONE = 0;
+
+        /** Root frame "fiber:<callable>" (or "main"), one flame graph tower per fiber callable. */
+        public const GROUP_CALLABLE = 1;
+
+        /** Root frame "fiber#<id>:<callable>" (or "main"), one tower per fiber. */
+        public const GROUP_FIBER = 2;
+
+        /**
+         * @param int $interval Sampling interval in microseconds of CPU time.
+         * @param int $group One of the GROUP_* constants.
+         *
+         * @throws \FiberError If the profiler is already running.
+         */
+        public static function start(int $interval = 10000, int $group = self::GROUP_CALLABLE): void { }
+
+        /**
+         * Stops sampling and returns the samples collected since start().
+         *
+         * @return string Samples in folded stack format ("frame;frame;frame count" per line), ready for
+         *                flamegraph.pl or speedscope.
+         */
+        public static function stop(): string { }
+    }
+
+    /**
+     * File and socket I/O through io_uring. Operations are queued with the calling fiber and submitted together
+     * with a single io_uring_enter() right before the native poller blocks, completions resume their fibers in one
+     * batch. Without io_uring (not compiled in, old kernel or operation unsupported) plain syscalls are used, sockets
+     * are still awaited on the native poller.
+     *
+     * File descriptors may be given as int or stream resource, the buffers of PHP streams are bypassed.
+     * The descriptor must stay open until the call returns.
+     */
+    final class Uring
+    {
+        public const O_RDONLY = 0;
+        public const O_WRONLY = 1;
+        public const O_RDWR = 2;
+        public const O_CREAT = 64;
+        public const O_EXCL = 128;
+        public const O_TRUNC = 512;
+        public const O_APPEND = 1024;
+
+        /**
+         * Reads from the descriptor of a stream, a stream that still buffers data read before (fgets(), fread(), ...)
+         * throws as that data would be skipped. The same applies to readv(), accept() and recv(). Without io_uring
+         * pipes and sockets are switched to non-blocking mode for each attempt and the fiber parks until they are ready.
+         *
+         * @param resource|int $fd
+         * @param int $offset File offset or -1 to use (and advance) the file position.
+         *
+         * @return string|false Data read directly into the returned string, empty at end of file.
+         */
+        public static function read($fd, int $length, int $offset = -1) { }
+
+        /**
+         * @param resource|int $fd
+         *
+         * @return int|false Number of bytes written.
+         */
+        public static function write($fd, string $data, int $offset = -1) { }
+
+        /**
+         * @param resource|int $fd
+         * @param int[] $lengths Size of each buffer.
+         *
+         * @return string[]|false One string per buffer, filled in order.
+         */
+        public static function readv($fd, array $lengths, int $offset = -1) { }
+
+        /**
+         * @param int $flags Combination of the O_* constants.
+         *
+         * @return resource|false Plain file stream.
+         */
+        public static function openat(string $path, int $flags = self::O_RDONLY, int $mode = 0666) { }
+
+        /**
+         * @param resource|int $fd
+         */
+        public static function fsync($fd, bool $datasync = false): bool { }
+
+        /**
+         * @param resource|int $socket Listening socket, e.g. created by stream_socket_server().
+         *
+         * @return resource|false Socket stream of the accepted connection.
+         */
+        public static function accept($socket) { }
+
+        /**
+         * @param resource|int $socket
+         *
+         * @return string|false Empty string if the peer closed the connection.
+         */
+        public static function recv($socket, int $length, int $flags = 0) { }
+
+        /**
+         * @param resource|int $socket
+         *
+         * @return int|false Number of bytes sent.
+         */
+        public static function send($socket, string $data, int $flags = 0) { }
+
+        /**
+         * @return bool True if operations are executed by io_uring rather than the syscall fallback.
+         */
+        public static function isAvailable(): bool { }
+    }
+
+    /**
+     * Byte message channel between processes, backed by a shared memory ring (memfd) that is inherited by
+     * processes forked after the channel has been created. Any number of processes may send and receive.
+     * Sending and receiving copy the message once and make no syscall unless the other side is parked.
+     * A process that dies while holding the ring lock does not block the others.
+     *
+     * Linux only (requires the native poller).
+     */
+    final class IpcChannel
+    {
+        /**
+         * @param int $capacity Size of the shared ring in bytes, each message takes its length plus 4 bytes.
+         *
+         * @throws \Error If the shared memory or eventfds cannot be created.
+         */
+        public function __construct(int $capacity = 1048576) { }
+
+        /**
+         * Parks the current fiber (or runs the poller in main thread) while the ring is full.
+         *
+         * @throws \FiberError If the channel has been closed or the message exceeds the capacity.
+         */
+        public function send(string $message): void { }
+
+        /**
+         * Parks the current fiber (or runs the poller in main thread) until a message is available.
+         *
+         * @return string|null Next message, NULL once the channel has been closed and all messages are received.
+         */
+        public function receive(): ?string { }
+
+        /**
+         * Closes the channel for all processes, parked senders throw and parked receivers return NULL.
+         */
+        public function close(): void { }
+
+        public function isClosed(): bool { }
+    }
+
+    /**
+     * TCP server running the handler in a new fiber for every accepted connection. Connections are accepted in C
+     * whenever the native poller runs (e.g. Fiber\Poller::run()), reads and writes on the connection stream park
+     * the fiber of the connection. Stacks of finished fibers are reused, see fiber.stack_pool.
+     *
+     * Linux only (requires the native poller).
+     */
+    final class Server
+    {
+        private function __construct() { }
+
+        /**
+         * Uncaught errors of a handler are reported as warnings. Listening stops when the server is closed or
+         * released, connections that are still being handled are cancelled once the server is released.
+         *
+         * @param string $address Numeric "host:port" or "[host]:port", port 0 picks a free port.
+         * @param callable(resource $connection): void $handler
+         * @param array{backlog?: int, max_connections?: int, batch?: int, reuseport?: bool} $options
+         *     backlog: Listen backlog, defaults to SOMAXCONN.
+         *     max_connections: Accepting pauses while this many connections are being handled, 0 (default) for
+         *         no limit. Pending connections wait in the backlog.
+         *     batch: Connections accepted per readiness notification, defaults to 64.
+         *     reuseport: Bind with SO_REUSEPORT (default) so that forked workers can listen on the same port.
+         *
+         * @throws \Error If the address is invalid or the socket cannot be bound.
+         */
+        public static function listen(string $address, callable $handler, array $options = []): Server { }
+
+        /**
+         * @return string Bound address, e.g. "127.0.0.1:8080".
+         */
+        public function getAddress(): string { }
+
+        /**
+         * @return int Connections whose handler has not finished yet.
+         */
+        public function getConnectionCount(): int { }
+
+        public function getAcceptedCount(): int { }
+
+        /**
+         * Closes the listening socket, connections that are being handled are not affected.
+         */
+        public function close(): void { }
+    }
+}
+
+namespace
+{
 /**
  * Exception thrown due to invalid fiber actions, such as suspending from outside a fiber.
  */
 final class FiberError extends Error { }
+}